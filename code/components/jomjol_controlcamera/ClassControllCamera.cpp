@@ -200,9 +200,44 @@ void CCamera::SetQualitySize(int qual, framesize_t resol)
 }
 
 
+/* Quality and resolution requested by a web request, valid until RestoreQualitySize(). The camera must be locked,
+ * otherwise the flow or a stream could capture with them or restore their own settings in between.
+ * -1 / FRAMESIZE_INVALID keep the current setting. */
+void CCamera::SetQualitySizeTemporary(int _quality, framesize_t _resolution)
+{
+    if (_quality < 0)
+        _quality = ActualQuality;
+    if (_resolution == FRAMESIZE_INVALID)
+        _resolution = ActualResolution;
+
+    qualitySizeChanged = (_quality != ActualQuality) || (_resolution != ActualResolution);
+    if (!qualitySizeChanged)
+        return;
+
+    qualityOrg = ActualQuality;
+    resolutionOrg = ActualResolution;
+    widthOrg = image_width;
+    heightOrg = image_height;
+    SetQualitySize(_quality, _resolution);
+}
+
+
+void CCamera::RestoreQualitySize()
+{
+    if (!qualitySizeChanged)
+        return;
+
+    SetQualitySize(qualityOrg, resolutionOrg);
+    image_width = widthOrg;
+    image_height = heightOrg;
+    qualitySizeChanged = false;
+}
+
+
 void CCamera::EnableAutoExposure(int flash_duration)
 {
     ESP_LOGD(TAG, "EnableAutoExposure");
+    LockCamera();
     LEDOnOff(true);
     if (flash_duration > 0)
         LightOnOff(true);
@@ -225,6 +260,7 @@ void CCamera::EnableAutoExposure(int flash_duration)
     sensor_t * s = esp_camera_sensor_get(); 
     s->set_gain_ctrl(s, 0);
     s->set_exposure_ctrl(s, 0);
+    UnlockCamera();
 
 
     LEDOnOff(false);  
@@ -241,7 +277,8 @@ esp_err_t CCamera::CaptureToBasisImage(CImageBasis *_Image, int delay)
 	#endif
 
     _Image->EmptyImage(); //Delete previous stored raw image -> black image
-    
+
+    LockCamera();
     LEDOnOff(true);
 
     if (delay > 0) 
@@ -261,6 +298,7 @@ esp_err_t CCamera::CaptureToBasisImage(CImageBasis *_Image, int delay)
     if (!fb) {
         LEDOnOff(false);
         LightOnOff(false);
+        UnlockCamera();
 
         ESP_LOGE(TAG, "CaptureToBasisImage: Capture Failed");
         LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "is not working anymore (CCamera::CaptureToBasisImage) - most probably caused by a hardware problem (instablility, ...). "
@@ -278,6 +316,7 @@ esp_err_t CCamera::CaptureToBasisImage(CImageBasis *_Image, int delay)
     CImageBasis* _zwImage = new CImageBasis();
     _zwImage->LoadFromMemory(fb->buf, fb->len);
     esp_camera_fb_return(fb);        
+    UnlockCamera();
 
     #ifdef DEBUG_DETAIL_ON
         LogFile.WriteHeapInfo("CCamera::CaptureToBasisImage - After fb_get");
@@ -327,10 +366,12 @@ esp_err_t CCamera::CaptureToBasisImage(CImageBasis *_Image, int delay)
 }
 
 
-esp_err_t CCamera::CaptureToFile(std::string nm, int delay)
+esp_err_t CCamera::CaptureToFile(std::string nm, int delay, int _quality, framesize_t _resolution)
 {
     string ftype;
 
+    LockCamera();
+    SetQualitySizeTemporary(_quality, _resolution);
      LEDOnOff(true);              // Switched off to save power !
 
     if (delay > 0) 
@@ -350,6 +391,8 @@ esp_err_t CCamera::CaptureToFile(std::string nm, int delay)
         LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Capture Failed (CCamera::CaptureToFile) --> Reboot! "
                 "Check that your camera module is working and connected properly.");
         //doReboot();
+        RestoreQualitySize();
+        UnlockCamera();
 
         return ESP_FAIL;
     }
@@ -408,6 +451,8 @@ esp_err_t CCamera::CaptureToFile(std::string nm, int delay)
         free(buf);
 
     esp_camera_fb_return(fb);
+    RestoreQualitySize();
+    UnlockCamera();
 
     if (delay > 0) 
     {
@@ -418,7 +463,7 @@ esp_err_t CCamera::CaptureToFile(std::string nm, int delay)
 }
 
 
-esp_err_t CCamera::CaptureToHTTP(httpd_req_t *req, int delay)
+esp_err_t CCamera::CaptureToHTTP(httpd_req_t *req, int delay, int _quality, framesize_t _resolution)
 {
     camera_fb_t * fb = NULL;
     esp_err_t res = ESP_OK;
@@ -426,6 +471,8 @@ esp_err_t CCamera::CaptureToHTTP(httpd_req_t *req, int delay)
     int64_t fr_start = esp_timer_get_time();
 
 
+    LockCamera();
+    SetQualitySizeTemporary(_quality, _resolution);
     LEDOnOff(true);
 
     if (delay > 0) 
@@ -445,6 +492,8 @@ esp_err_t CCamera::CaptureToHTTP(httpd_req_t *req, int delay)
         LightOnOff(false);
         httpd_resp_send_500(req);
 //        doReboot();
+        RestoreQualitySize();
+        UnlockCamera();
 
         return ESP_FAIL;
     }
@@ -477,6 +526,8 @@ esp_err_t CCamera::CaptureToHTTP(httpd_req_t *req, int delay)
         }
     }
     esp_camera_fb_return(fb);
+    RestoreQualitySize();
+    UnlockCamera();
     int64_t fr_end = esp_timer_get_time();
     
     ESP_LOGI(TAG, "JPG: %uKB %ums", (uint32_t)(fb_len/1024), (uint32_t)((fr_end - fr_start)/1000));
@@ -490,6 +541,96 @@ esp_err_t CCamera::CaptureToHTTP(httpd_req_t *req, int delay)
 }
 
 
+/* Flow and web server use the camera from different tasks. A task which waits for the camera ends a running stream. */
+bool CCamera::LockCamera(TickType_t _wait)
+{
+    if (_wait == 0) {
+        return (xSemaphoreTake(cameraMutex, 0) == pdTRUE);
+    }
+
+    cameraRequests++;
+    bool result = (xSemaphoreTake(cameraMutex, _wait) == pdTRUE);
+    cameraRequests--;
+
+    return result;
+}
+
+
+void CCamera::UnlockCamera()
+{
+    xSemaphoreGive(cameraMutex);
+}
+
+
+/* MJPEG stream (multipart/x-mixed-replace): the JPEG frame buffers are sent as they are, without decoding / re-encoding.
+ * The camera stays locked while streaming. The stream ends when the client disconnects or another task (e.g. the flow) needs the camera,
+ * afterwards the previous quality and resolution are restored. */
+esp_err_t CCamera::StreamToHTTP(httpd_req_t *req, int fps)
+{
+    if (!LockCamera(0)) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Camera busy (flow round or capture running), try again later");
+        return ESP_OK;
+    }
+
+    int quality;
+    framesize_t resolution;
+    GetCameraParameter(req, quality, resolution);
+    SetQualitySizeTemporary(quality, resolution);
+
+    httpd_resp_set_type(req, "multipart/x-mixed-replace;boundary=" CAMERA_STREAM_BOUNDARY);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    LogFile.WriteToFile(ESP_LOG_INFO, TAG, "Stream started (" + std::to_string(fps) + " fps)");
+
+    char header[100];
+    esp_err_t res = ESP_OK;
+    int frames = 0;
+    const TickType_t xFrameTime = (1000 / fps) / portTICK_PERIOD_MS;
+    TickType_t xLastWakeTime = xTaskGetTickCount();
+
+    while ((res == ESP_OK) && (cameraRequests == 0)) {
+        camera_fb_t * fb = esp_camera_fb_get();
+        if (!fb) {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Stream: Camera capture failed");
+            res = ESP_FAIL;
+            break;
+        }
+
+        if (demoMode) { // Use images stored on SD-Card instead of camera image
+            loadNextDemoImage(fb);
+        }
+        else if (fb->format != PIXFORMAT_JPEG) {
+            esp_camera_fb_return(fb);
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Stream: Frame buffer is not a JPEG");
+            res = ESP_FAIL;
+            break;
+        }
+
+        int len = snprintf(header, sizeof(header), "\r\n--" CAMERA_STREAM_BOUNDARY "\r\nContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n", (unsigned int)fb->len);
+        res = httpd_resp_send_chunk(req, header, len);
+        if (res == ESP_OK) {
+            res = httpd_resp_send_chunk(req, (const char *)fb->buf, fb->len);
+        }
+        esp_camera_fb_return(fb);
+        frames++;
+
+        vTaskDelayUntil(&xLastWakeTime, xFrameTime);
+    }
+
+    if (res == ESP_OK) {    // camera requested by another task, finish the response properly
+        httpd_resp_sendstr_chunk(req, "\r\n--" CAMERA_STREAM_BOUNDARY "--\r\n");
+        httpd_resp_sendstr_chunk(req, NULL);
+    }
+
+    RestoreQualitySize();
+    UnlockCamera();
+
+    LogFile.WriteToFile(ESP_LOG_INFO, TAG, "Stream ended after " + std::to_string(frames) + " frames");
+    return ESP_OK;
+}
+
+
 void CCamera::LightOnOff(bool status)
 {
     GpioHandler* gpioHandler = gpio_handler_get();
@@ -546,8 +687,8 @@ void CCamera::GetCameraParameter(httpd_req_t *req, int &qual, framesize_t &resol
     char _qual[10];
     char _size[10];
 
-    resol = ActualResolution;
-    qual = ActualQuality;
+    resol = FRAMESIZE_INVALID;      // not requested: the current setting is used
+    qual = -1;
 
 
     if (httpd_req_get_url_query_str(req, _query, 100) == ESP_OK)
@@ -614,6 +755,8 @@ CCamera::CCamera()
     contrast = -5;
     saturation = -5;
     isFixedExposure = false;
+    cameraMutex = xSemaphoreCreateMutex();
+    cameraRequests = 0;
 
     ledc_init();    
 }
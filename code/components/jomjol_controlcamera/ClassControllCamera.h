@@ -8,9 +8,11 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/event_groups.h"
+#include "freertos/semphr.h"
 
 #include "esp_camera.h"
 #include <string>
+#include <atomic>
 #include <esp_http_server.h>
 #include "CImageBasis.h"
 #include "../../include/defines.h"
@@ -28,6 +30,17 @@ class CCamera {
         bool CameraInitSuccessful = false;
         bool demoMode = false;
 
+        SemaphoreHandle_t cameraMutex = NULL;
+        std::atomic<int> cameraRequests;            // number of tasks waiting for the camera, a running stream ends then
+
+        int qualityOrg;                             // settings before SetQualitySizeTemporary()
+        framesize_t resolutionOrg;
+        int widthOrg, heightOrg;
+        bool qualitySizeChanged = false;
+
+        void SetQualitySizeTemporary(int _quality, framesize_t _resolution);
+        void RestoreQualitySize();
+
         bool loadNextDemoImage(camera_fb_t *fb);
         long GetFileSize(std::string filename);
 
@@ -39,7 +52,10 @@ class CCamera {
 
         void LightOnOff(bool status);
         void LEDOnOff(bool status);
-        esp_err_t CaptureToHTTP(httpd_req_t *req, int delay = 0);
+        esp_err_t CaptureToHTTP(httpd_req_t *req, int delay = 0, int _quality = -1, framesize_t _resolution = FRAMESIZE_INVALID);
+        esp_err_t StreamToHTTP(httpd_req_t *req, int fps);
+        bool LockCamera(TickType_t _wait = portMAX_DELAY);
+        void UnlockCamera();
         void SetQualitySize(int qual, framesize_t resol);
         bool SetBrightnessContrastSaturation(int _brightness, int _contrast, int _saturation);
         void GetCameraParameter(httpd_req_t *req, int &qual, framesize_t &resol);
@@ -52,7 +68,7 @@ class CCamera {
 
         framesize_t TextToFramesize(const char * text);
 
-        esp_err_t CaptureToFile(std::string nm, int delay = 0);
+        esp_err_t CaptureToFile(std::string nm, int delay = 0, int _quality = -1, framesize_t _resolution = FRAMESIZE_INVALID);
         esp_err_t CaptureToBasisImage(CImageBasis *_Image, int delay = 0);
 };
 
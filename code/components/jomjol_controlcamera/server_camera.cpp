@@ -104,10 +104,8 @@ esp_err_t handler_capture(httpd_req_t *req)
             ESP_LOGD(TAG, "Size: %d, Quality: %d", res, quality);
         #endif
 
-        Camera.SetQualitySize(quality, res);
-
         esp_err_t result;
-        result = Camera.CaptureToHTTP(req);
+        result = Camera.CaptureToHTTP(req, 0, quality, res);
 
         #ifdef DEBUG_DETAIL_ON   
             LogFile.WriteHeapInfo("handler_capture - Done");
@@ -159,15 +157,8 @@ esp_err_t handler_capture_with_light(httpd_req_t *req)
             ESP_LOGD(TAG, "Size: %d, Quality: %d", res, quality);
         #endif
 
-        Camera.SetQualitySize(quality, res);
-        Camera.LightOnOff(true);
-        const TickType_t xDelay = delay / portTICK_PERIOD_MS;
-        vTaskDelay( xDelay );
-
         esp_err_t result;
-        result = Camera.CaptureToHTTP(req);  
-
-        Camera.LightOnOff(false);
+        result = Camera.CaptureToHTTP(req, delay, quality, res);      // switches the flash light on for delay ms
 
         #ifdef DEBUG_DETAIL_ON   
             LogFile.WriteHeapInfo("handler_capture_with_light - Done");
@@ -232,10 +223,9 @@ esp_err_t handler_capture_save_to_file(httpd_req_t *req)
         #ifdef DEBUG_DETAIL_ON   
             ESP_LOGD(TAG, "Size: %d, Quality: %d", res, quality);
         #endif
-        Camera.SetQualitySize(quality, res);
 
         esp_err_t result;
-        result = Camera.CaptureToFile(fn, delay);  
+        result = Camera.CaptureToFile(fn, delay, quality, res);  
 
         const char* resp_str = (const char*) fn.c_str();
         httpd_resp_send(req, resp_str, strlen(resp_str));
@@ -254,6 +244,80 @@ esp_err_t handler_capture_save_to_file(httpd_req_t *req)
 }
 
 
+esp_err_t handler_stream(httpd_req_t *req)
+{
+    #ifdef DEBUG_DETAIL_ON   
+        LogFile.WriteHeapInfo("handler_stream - Start");
+    #endif
+
+    if (Camera.getCameraInitSuccessful()) 
+    {
+        char _query[100];
+        char _fps[10];
+        int fps = CAMERA_STREAM_FPS_DEFAULT;
+
+        if (httpd_req_get_url_query_str(req, _query, 100) == ESP_OK)
+        {
+            if (httpd_query_key_value(_query, "fps", _fps, 10) == ESP_OK)
+            {
+                fps = atoi(_fps);
+
+                if (fps < 1)
+                    fps = 1;
+                if (fps > CAMERA_STREAM_FPS_MAX)
+                    fps = CAMERA_STREAM_FPS_MAX;
+            }
+        }
+
+        esp_err_t result = Camera.StreamToHTTP(req, fps);
+
+        #ifdef DEBUG_DETAIL_ON   
+            LogFile.WriteHeapInfo("handler_stream - Done");
+        #endif
+
+        return result;
+    }
+    else 
+    {
+        httpd_resp_send_err(req, HTTPD_403_FORBIDDEN, "Camera not initialized: REST API /stream not available!");
+        return ESP_ERR_NOT_FOUND;
+    }
+}
+
+
+/* A stream blocks its server task as long as it runs, so it gets its own server */
+httpd_handle_t start_stream_server(void)
+{
+    httpd_handle_t stream_server = NULL;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+
+    config.task_priority = tskIDLE_PRIORITY+2;
+    config.stack_size = 4096;
+    config.core_id = 1;
+    config.server_port = CAMERA_STREAM_PORT;
+    config.ctrl_port = CAMERA_STREAM_CTRL_PORT;
+    config.max_open_sockets = 2;
+    config.max_uri_handlers = 1;
+    config.backlog_conn = 2;
+    config.lru_purge_enable = true;
+
+    ESP_LOGI(TAG, "Starting stream server on port: '%d'", config.server_port);
+    if (httpd_start(&stream_server, &config) != ESP_OK) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Error starting stream server!");
+        return NULL;
+    }
+
+    httpd_uri_t camuri = { };
+    camuri.method    = HTTP_GET;
+    camuri.uri       = "/stream";
+    camuri.handler   = handler_stream;
+    camuri.user_ctx  = NULL; 
+    httpd_register_uri_handler(stream_server, &camuri);
+
+    return stream_server;
+}
+
+
 void register_server_camera_uri(httpd_handle_t server)
 {
 #ifdef DEBUG_DETAIL_ON   
@@ -10,6 +10,7 @@
 //#include "ClassControllCamera.h"
 
 void register_server_camera_uri(httpd_handle_t server);
+httpd_handle_t start_stream_server(void);
 
 void PowerResetCamera();
 
@@ -0,0 +1,446 @@
+#include "DirectoryIndex.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "ClassLogFile.h"
+
+static const char* TAG = "DIR INDEX";
+
+DirectoryIndex DirIndex;
+
+
+DirectoryIndex::DirectoryIndex()
+{
+    useCounter = 0;
+    mutex = xSemaphoreCreateMutex();
+}
+
+
+std::string DirectoryIndex::NormalizePath(std::string _path)
+{
+    while ((_path.length() > 1) && (_path[_path.length() - 1] == '/')) {
+        _path = _path.substr(0, _path.length() - 1);
+    }
+    return _path;
+}
+
+
+void DirectoryIndex::FreeDirectory(CachedDirectory &_dir)
+{
+    if (_dir.entries)
+        free(_dir.entries);
+    if (_dir.names)
+        free(_dir.names);
+
+    _dir.entries = NULL;
+    _dir.names = NULL;
+    _dir.count = _dir.capacity = 0;
+    _dir.namesSize = _dir.namesCapacity = 0;
+}
+
+
+bool DirectoryIndex::AddEntry(CachedDirectory &_dir, const char* _name, bool _isDir, uint32_t _size, uint32_t _mtime)
+{
+    size_t len = strlen(_name) + 1;
+
+    if (_dir.count >= _dir.capacity) {
+        int capacity = _dir.capacity ? 2 * _dir.capacity : DIRECTORY_INDEX_INITIAL_ENTRIES;
+        DirectoryIndexEntry* entries = (DirectoryIndexEntry*) heap_caps_realloc(_dir.entries, capacity * sizeof(DirectoryIndexEntry), MALLOC_CAP_SPIRAM);
+        if (!entries) {
+            return false;
+        }
+        _dir.entries = entries;
+        _dir.capacity = capacity;
+    }
+
+    if (_dir.namesSize + len > _dir.namesCapacity) {
+        size_t capacity = std::max(2 * _dir.namesCapacity, _dir.namesSize + len + DIRECTORY_INDEX_INITIAL_ENTRIES * 32);
+        char* names = (char*) heap_caps_realloc(_dir.names, capacity, MALLOC_CAP_SPIRAM);
+        if (!names) {
+            return false;
+        }
+        _dir.names = names;
+        _dir.namesCapacity = capacity;
+    }
+
+    DirectoryIndexEntry &entry = _dir.entries[_dir.count++];
+    entry.nameOffset = _dir.namesSize;
+    entry.size = _size;
+    entry.mtime = _mtime;
+    entry.isDir = _isDir;
+
+    memcpy(_dir.names + _dir.namesSize, _name, len);
+    _dir.namesSize += len;
+
+    return true;
+}
+
+
+bool DirectoryIndex::ReadDirectory(CachedDirectory &_dir, std::string _opendirPath)
+{
+    int64_t start = esp_timer_get_time();
+    struct stat entry_stat;
+    struct dirent *entry;
+
+    FreeDirectory(_dir);
+    _dir.sorted = false;
+
+    DIR *dir = opendir(_opendirPath.c_str());
+    if (!dir) {
+        return false;
+    }
+
+    _dir.dirMtime = (stat(_dir.path.c_str(), &entry_stat) == 0) ? entry_stat.st_mtime : 0;
+    _dir.readTime = start;
+
+    std::string entrypath = _dir.path + "/";
+    const size_t dirpath_len = entrypath.length();
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp("wlan.ini", entry->d_name) == 0) {       // wlan.ini soll nicht angezeigt werden!
+            continue;
+        }
+
+        bool isDir = (entry->d_type == DT_DIR);
+        uint32_t size = 0;
+        uint32_t mtime = 0;
+
+        entrypath.resize(dirpath_len);
+        entrypath += entry->d_name;
+        if (stat(entrypath.c_str(), &entry_stat) == 0) {
+            size = isDir ? 0 : entry_stat.st_size;
+            mtime = entry_stat.st_mtime;
+        }
+        else {
+            ESP_LOGE(TAG, "Failed to stat %s", entrypath.c_str());
+            continue;
+        }
+
+        if (!AddEntry(_dir, entry->d_name, isDir, size, mtime)) {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Not enough memory for the index of " + _dir.path);
+            break;
+        }
+    }
+    closedir(dir);
+
+    Sort(_dir, DirSortName, false);
+
+    ESP_LOGI(TAG, "%s: %d entries indexed in %lld ms", _dir.path.c_str(), _dir.count, (esp_timer_get_time() - start) / 1000);
+    return true;
+}
+
+
+void DirectoryIndex::Sort(CachedDirectory &_dir, t_DirectorySort _sort, bool _desc)
+{
+    if (_dir.sorted && (_dir.sort == _sort) && (_dir.sortDesc == _desc)) {
+        return;
+    }
+
+    const char* names = _dir.names;
+
+    // Directories always first, equal sizes / dates ordered by name
+    std::sort(_dir.entries, _dir.entries + _dir.count, [names, _sort, _desc](const DirectoryIndexEntry &a, const DirectoryIndexEntry &b) {
+        if (a.isDir != b.isDir) {
+            return a.isDir > b.isDir;
+        }
+
+        int cmp = 0;
+        if ((_sort == DirSortSize) && (a.size != b.size)) {
+            cmp = (a.size < b.size) ? -1 : 1;
+        }
+        else if ((_sort == DirSortDate) && (a.mtime != b.mtime)) {
+            cmp = (a.mtime < b.mtime) ? -1 : 1;
+        }
+        else {
+            cmp = strcmp(names + a.nameOffset, names + b.nameOffset);
+        }
+
+        return _desc ? (cmp > 0) : (cmp < 0);
+    });
+
+    _dir.sort = _sort;
+    _dir.sortDesc = _desc;
+    _dir.sorted = true;
+}
+
+
+/* Applies a change of a single file. Must be called with the mutex taken */
+void DirectoryIndex::UpdateEntry(CachedDirectory &_dir, const DirectoryChange &_change)
+{
+    if (_change.name.empty()) {         // the whole directory
+        _dir.readTime = 0;              // read again with the next request
+        return;
+    }
+
+    if (_change.name == "wlan.ini") {   // wlan.ini soll nicht angezeigt werden!
+        return;
+    }
+
+    int i = 0;
+    while ((i < _dir.count) && (strcmp(_dir.names + _dir.entries[i].nameOffset, _change.name.c_str()) != 0)) {
+        i++;
+    }
+
+    if (i < _dir.count) {
+        if (_change.exists) {
+            _dir.entries[i].isDir = _change.isDir;
+            _dir.entries[i].size = _change.size;
+            _dir.entries[i].mtime = _change.mtime;
+        }
+        else {
+            _dir.entries[i] = _dir.entries[--_dir.count];     // the name stays in the name block until the next read
+        }
+    }
+    else if (_change.exists) {
+        if (!AddEntry(_dir, _change.name.c_str(), _change.isDir, _change.size, _change.mtime)) {
+            _dir.readTime = 0;
+        }
+    }
+
+    _dir.sorted = false;
+}
+
+
+/* Must be called with the mutex taken */
+bool DirectoryIndex::IsReading(std::string _path)
+{
+    return std::find(reading.begin(), reading.end(), _path) != reading.end();
+}
+
+
+/* Must be called with the mutex taken */
+bool DirectoryIndex::IsOutdated(CachedDirectory &_dir, time_t _dirMtime)
+{
+    // Large directories take long to read, they are kept up to date by InvalidateFile()
+    int maxAge = (_dir.count > DIRECTORY_INDEX_LARGE_ENTRIES) ? DIRECTORY_INDEX_LARGE_MAX_AGE : DIRECTORY_INDEX_MAX_AGE;
+    bool expired = (esp_timer_get_time() - _dir.readTime) > (int64_t) maxAge * 1000000;
+
+    return (_dir.readTime == 0) || expired || (_dirMtime != _dir.dirMtime);
+}
+
+
+/* Must be called with the mutex taken */
+CachedDirectory* DirectoryIndex::Find(std::string _path)
+{
+    for (int i = 0; i < dirs.size(); ++i) {
+        if (dirs[i].path == _path) {
+            return &dirs[i];
+        }
+    }
+    return NULL;
+}
+
+
+/* Puts a directory read without the mutex into the index, replaces an older copy.
+ * Must be called with the mutex taken */
+CachedDirectory* DirectoryIndex::Store(CachedDirectory &_read, bool _readOK)
+{
+    reading.erase(std::find(reading.begin(), reading.end(), _read.path));
+    bool stillReading = IsReading(_read.path);
+
+    // Files changed during the read may or may not be in the result
+    for (int i = 0; i < changes.size(); ) {
+        if (changes[i].directory != _read.path) {
+            i++;
+            continue;
+        }
+
+        if (_readOK) {
+            UpdateEntry(_read, changes[i]);
+        }
+
+        if (stillReading) {
+            i++;
+        }
+        else {
+            changes.erase(changes.begin() + i);
+        }
+    }
+
+    CachedDirectory* dir = Find(_read.path);
+
+    if (!_readOK) {
+        FreeDirectory(_read);
+        if (dir) {
+            FreeDirectory(*dir);
+            dirs.erase(dirs.begin() + (dir - &dirs[0]));
+        }
+        return NULL;
+    }
+
+    if (dir) {
+        FreeDirectory(*dir);
+        *dir = _read;
+        return dir;
+    }
+
+    if (dirs.size() >= DIRECTORY_INDEX_MAX_DIRS) {    // replace the least recently used directory
+        int oldest = 0;
+        for (int i = 1; i < dirs.size(); ++i) {
+            if (dirs[i].lastUse < dirs[oldest].lastUse)
+                oldest = i;
+        }
+        FreeDirectory(dirs[oldest]);
+        dirs.erase(dirs.begin() + oldest);
+    }
+
+    dirs.push_back(_read);
+    return &dirs.back();
+}
+
+
+/* Copies the entries offset .. offset + limit - 1 in the requested order.
+ * _path is passed to opendir() as it is, returns false if the directory can't be read. */
+bool DirectoryIndex::GetPage(std::string _path, t_DirectorySort _sort, bool _desc, int _offset, int _limit,
+                             std::vector<DirectoryEntry> &_page, int &_total)
+{
+    std::string path = NormalizePath(_path);
+    struct stat dir_stat;
+    time_t dirMtime = (stat(path.c_str(), &dir_stat) == 0) ? dir_stat.st_mtime : 0;
+
+    _page.clear();
+    _total = 0;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    useCounter++;
+    CachedDirectory* dir = Find(path);
+
+    if ((dir == NULL) || IsOutdated(*dir, dirMtime)) {
+        // readdir + stat of every entry takes seconds in large directories, the writers (e.g. the image log)
+        // must not wait for it. Their changes during the read are collected and applied to the result.
+        reading.push_back(path);
+        xSemaphoreGive(mutex);
+
+        CachedDirectory read = {};
+        read.path = path;
+        bool readOK = ReadDirectory(read, _path);
+
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        dir = Store(read, readOK);
+        if (dir == NULL) {
+            xSemaphoreGive(mutex);
+            return false;
+        }
+    }
+
+    dir->lastUse = useCounter;
+    Sort(*dir, _sort, _desc);
+    _total = dir->count;
+
+    if (_offset < 0)
+        _offset = 0;
+
+    for (int i = _offset; (i < dir->count) && (i < _offset + _limit); ++i) {
+        DirectoryEntry entry;
+        entry.name = std::string(dir->names + dir->entries[i].nameOffset);
+        entry.isDir = dir->entries[i].isDir;
+        entry.size = dir->entries[i].size;
+        entry.mtime = dir->entries[i].mtime;
+        _page.push_back(entry);
+    }
+
+    xSemaphoreGive(mutex);
+    return true;
+}
+
+
+void DirectoryIndex::Invalidate(std::string _directory)
+{
+    DirectoryChange change = {};
+    change.directory = NormalizePath(_directory);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    CachedDirectory* dir = Find(change.directory);
+    if (dir) {
+        UpdateEntry(*dir, change);      // read again with the next request
+    }
+    if (IsReading(change.directory)) {
+        changes.push_back(change);
+    }
+    xSemaphoreGive(mutex);
+}
+
+
+/* The file (or folder) was written, created or deleted. Only its entry is updated, the directory is not read again */
+void DirectoryIndex::InvalidateFile(std::string _filepath)
+{
+    std::string filepath = NormalizePath(_filepath);
+    size_t pos = filepath.find_last_of('/');
+
+    if ((pos == std::string::npos) || (pos == 0)) {
+        return;
+    }
+
+    DirectoryChange change = {};
+    change.directory = filepath.substr(0, pos);
+    change.name = filepath.substr(pos + 1);
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool indexed = (Find(change.directory) != NULL) || IsReading(change.directory);
+    xSemaphoreGive(mutex);
+
+    if (!indexed) {                     // nothing to update, no stat needed
+        return;
+    }
+
+    struct stat file_stat;
+    change.exists = (stat(filepath.c_str(), &file_stat) == 0);
+    if (change.exists) {
+        change.isDir = S_ISDIR(file_stat.st_mode);
+        change.size = change.isDir ? 0 : file_stat.st_size;
+        change.mtime = file_stat.st_mtime;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    CachedDirectory* dir = Find(change.directory);
+    if (dir) {
+        UpdateEntry(*dir, change);
+    }
+    if (IsReading(change.directory)) {
+        changes.push_back(change);
+    }
+    xSemaphoreGive(mutex);
+}
+
+
+void DirectoryIndex::InvalidateAll()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < dirs.size(); ++i) {
+        FreeDirectory(dirs[i]);
+    }
+    dirs.clear();
+    xSemaphoreGive(mutex);
+}
+
+
+t_DirectorySort DirectoryIndex::ParseSort(std::string _sort)
+{
+    if (_sort == "size")
+        return DirSortSize;
+    if (_sort == "date")
+        return DirSortDate;
+    return DirSortName;
+}
+
+
+const char* DirectoryIndex::SortName(t_DirectorySort _sort)
+{
+    switch (_sort) {
+        case DirSortSize:
+            return "size";
+        case DirSortDate:
+            return "date";
+        default:
+            return "name";
+    }
+}
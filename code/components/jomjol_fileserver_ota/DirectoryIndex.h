@@ -0,0 +1,111 @@
+#pragma once
+
+#ifndef DIRECTORYINDEX_H
+#define DIRECTORYINDEX_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "../../include/defines.h"
+
+
+enum t_DirectorySort {
+    DirSortName,
+    DirSortSize,
+    DirSortDate
+};
+
+
+struct DirectoryEntry {
+    std::string name;
+    bool isDir;
+    uint32_t size;
+    time_t mtime;
+};
+
+
+/* Compact entry of the index, the names are stored one after the other in one block */
+struct DirectoryIndexEntry {
+    uint32_t nameOffset;
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t isDir;
+};
+
+
+struct CachedDirectory {
+    std::string path;               // without trailing '/'
+    time_t dirMtime;
+    int64_t readTime;               // esp_timer_get_time() of the last readdir
+    uint32_t lastUse;
+
+    DirectoryIndexEntry* entries;   // PSRAM
+    int count, capacity;
+    char* names;                    // PSRAM
+    size_t namesSize, namesCapacity;
+
+    t_DirectorySort sort;
+    bool sortDesc;
+    bool sorted;                    // entries are in the order sort / sortDesc
+};
+
+
+/* File written, created or deleted in a directory of the index (name empty: the whole directory) */
+struct DirectoryChange {
+    std::string directory;          // without trailing '/'
+    std::string name;
+    bool exists;
+    bool isDir;
+    uint32_t size;
+    uint32_t mtime;
+};
+
+
+/* Name, size and mtime of the entries of the last used directories (readdir + stat for every
+ * entry takes very long in the image log folders). Writers report new and deleted files with
+ * InvalidateFile(), only their entry is updated. A directory is read again if its mtime changed,
+ * it was invalidated (upload, delete) or after DIRECTORY_INDEX_MAX_AGE (DIRECTORY_INDEX_LARGE_MAX_AGE
+ * for large directories), as FAT does not update the mtime of a directory when files are added.
+ * The directory is read without the mutex, changes during the read are applied afterwards. */
+class DirectoryIndex
+{
+    protected:
+        std::vector<CachedDirectory> dirs;
+        std::vector<std::string> reading;           // directories being read at the moment
+        std::vector<DirectoryChange> changes;       // changes in them since the start of the read
+        uint32_t useCounter;
+        SemaphoreHandle_t mutex;
+
+        static std::string NormalizePath(std::string _path);
+        void FreeDirectory(CachedDirectory &_dir);
+        bool AddEntry(CachedDirectory &_dir, const char* _name, bool _isDir, uint32_t _size, uint32_t _mtime);
+        bool ReadDirectory(CachedDirectory &_dir, std::string _opendirPath);
+        void Sort(CachedDirectory &_dir, t_DirectorySort _sort, bool _desc);
+        void UpdateEntry(CachedDirectory &_dir, const DirectoryChange &_change);
+        bool IsReading(std::string _path);
+        bool IsOutdated(CachedDirectory &_dir, time_t _dirMtime);
+        CachedDirectory* Find(std::string _path);
+        CachedDirectory* Store(CachedDirectory &_read, bool _readOK);
+
+    public:
+        DirectoryIndex();
+
+        bool GetPage(std::string _path, t_DirectorySort _sort, bool _desc, int _offset, int _limit,
+                     std::vector<DirectoryEntry> &_page, int &_total);
+
+        void Invalidate(std::string _directory);
+        void InvalidateFile(std::string _filepath);     // updates the entry of the file (or folder)
+        void InvalidateAll();
+
+        static t_DirectorySort ParseSort(std::string _sort);
+        static const char* SortName(t_DirectorySort _sort);
+};
+
+extern DirectoryIndex DirIndex;
+
+#endif //DIRECTORYINDEX_H
@@ -35,10 +35,12 @@ extern "C" {
 
 #include "../../include/defines.h"
 #include "ClassLogFile.h"
+#include "ClassDataSeries.h"
 
 #include "server_tflite.h"
 
 #include "server_help.h"
+#include "DirectoryIndex.h"
 #ifdef ENABLE_MQTT
     #include "interface_mqtt.h"
 #endif //ENABLE_MQTT
@@ -46,6 +48,7 @@ extern "C" {
 
 #include "Helper.h"
 #include "miniz.h"
+#include "mbedtls/sha256.h"
 
 
 static const char *TAG = "OTA FILE";
@@ -180,15 +183,13 @@ esp_err_t get_tflite_file_handler(httpd_req_t *req)
  * a list of all files and folders under the requested path.
  * In case of SPIFFS this returns empty list when path is any
  * string other than '/', since SPIFFS doesn't support directories */
-static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath, const char* uripath, bool readonly)
+static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath, const char* uripath, bool readonly,
+                                    t_DirectorySort sort, bool desc, int offset, int limit)
 {
-    char entrypath[FILE_PATH_MAX];
     char entrysize[16];
+    char entrydate[24];
     const char *entrytype;
 
-    struct dirent *entry;
-    struct stat entry_stat;
-
     char dirpath_corrected[FILE_PATH_MAX];
     strcpy(dirpath_corrected, dirpath);
 
@@ -196,16 +197,12 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath, const
     if ((strlen(dirpath_corrected)-1) > strlen(server_data->base_path))      // if dirpath is not mountpoint, the last "\" needs to be removed
         dirpath_corrected[strlen(dirpath_corrected)-1] = '\0';
 
-    DIR *dir = opendir(dirpath_corrected);
-
-    const size_t dirpath_len = strlen(dirpath);
-    ESP_LOGD(TAG, "Dirpath: <%s>, Pathlength: %d", dirpath, dirpath_len);
-
-    /* Retrieve the base path of file storage to construct the full path */
-    strlcpy(entrypath, dirpath, sizeof(entrypath));
-    ESP_LOGD(TAG, "entrypath: <%s>", entrypath);
+    ESP_LOGD(TAG, "Dirpath: <%s>", dirpath);
 
-    if (!dir) {
+    /* Name, size and date come from the directory index, only one page is rendered */
+    std::vector<DirectoryEntry> entries;
+    int total;
+    if (!DirIndex.GetPage(dirpath_corrected, sort, desc, offset, limit, entries, total)) {
         LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Failed to stat dir: " + std::string(dirpath) + "!");
         /* Respond with 404 Not Found */
         httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, get404());
@@ -242,85 +239,172 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath, const
     _zw = _zw.substr(8, _zw.length() - 8);
     _zw = "/delete/" + _zw + "?task=deldircontent"; 
 
+    /* Query of the links for sorting and paging */
+    auto pageLink = [&](t_DirectorySort _sort, bool _desc, int _offset) {
+        std::string link = "?sort=" + std::string(DirectoryIndex::SortName(_sort)) + "&order=" + (_desc ? "desc" : "asc");
+        if (_offset > 0)
+            link += "&offset=" + std::to_string(_offset);
+        if (limit != DIRECTORY_PAGE_SIZE_DEFAULT)
+            link += "&limit=" + std::to_string(limit);
+        if (readonly)
+            link += "&readonly=true";
+        return link;
+    };
+    auto sortLink = [&](t_DirectorySort _sort, std::string _label) {
+        return "<a href=\"" + pageLink(_sort, (sort == _sort) && !desc, 0) + "\">" + _label + "</a>";
+    };
 
     /* Send file-list table definition and column labels */
-    httpd_resp_sendstr_chunk(req,
-        "<table id=\"files_table\">"
-        "<col width=\"800px\" /><col width=\"300px\" /><col width=\"300px\" /><col width=\"100px\" />"
-        "<thead><tr><th>Name</th><th>Type</th><th>Size</th>");
+    std::string html = "<table id=\"files_table\">"
+        "<col width=\"800px\" /><col width=\"300px\" /><col width=\"300px\" /><col width=\"300px\" /><col width=\"100px\" />"
+        "<thead><tr><th>" + sortLink(DirSortName, "Name") + "</th><th>Type</th><th>" + sortLink(DirSortSize, "Size") +
+        "</th><th>" + sortLink(DirSortDate, "Date") + "</th>";
     if (!readonly) {
-        httpd_resp_sendstr_chunk(req, "<th>"
-            "<form method=\"post\" action=\"");
-        httpd_resp_sendstr_chunk(req, _zw.c_str());
-        httpd_resp_sendstr_chunk(req,
-            "\"><button type=\"submit\">DELETE ALL!</button></form>"
-            "</th></tr>");
+        html += "<th><form method=\"post\" action=\"" + _zw + "\"><button type=\"submit\">DELETE ALL!</button></form></th>";
     }
-    httpd_resp_sendstr_chunk(req, "</thead><tbody>\n");
+    html += "</tr></thead><tbody>\n";
 
-    /* Iterate over all files / folders and fetch their names and sizes */
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp("wlan.ini", entry->d_name) != 0 )        // wlan.ini soll nicht angezeigt werden!
-        {
-            entrytype = (entry->d_type == DT_DIR ? "directory" : "file");
+    /* The rows are collected and sent in larger chunks */
+    for (int i = 0; i < entries.size(); ++i) {
+        DirectoryEntry &entry = entries[i];
+        entrytype = (entry.isDir ? "directory" : "file");
 
-            strlcpy(entrypath + dirpath_len, entry->d_name, sizeof(entrypath) - dirpath_len);
-            ESP_LOGD(TAG, "Entrypath: %s", entrypath);
-            if (stat(entrypath, &entry_stat) == -1) {
-                ESP_LOGE(TAG, "Failed to stat %s: %s", entrytype, entry->d_name);
-                continue;
-            }
-
-            if (entry->d_type == DT_DIR) {
-                strcpy(entrysize, "-\0");
+        if (entry.isDir) {
+            strcpy(entrysize, "-\0");
+        }
+        else {
+            if (entry.size >= 1024) {
+                sprintf(entrysize, "%lu KiB", (unsigned long) entry.size / 1024); // kBytes
             }
             else {
-                if (entry_stat.st_size >= 1024) {
-                    sprintf(entrysize, "%ld KiB", entry_stat.st_size / 1024); // kBytes
-                }
-                else {
-                    sprintf(entrysize, "%ld B", entry_stat.st_size); // Bytes
-                }
+                sprintf(entrysize, "%lu B", (unsigned long) entry.size); // Bytes
             }
+        }
 
-            ESP_LOGI(TAG, "Found %s: %s (%s bytes)", entrytype, entry->d_name, entrysize);
+        struct tm timeinfo;
+        localtime_r(&entry.mtime, &timeinfo);
+        strftime(entrydate, sizeof(entrydate), "%Y-%m-%d %H:%M:%S", &timeinfo);
 
-            /* Send chunk of HTML file containing table entries with file name and size */
-            httpd_resp_sendstr_chunk(req, "<tr><td><a href=\"");
-            httpd_resp_sendstr_chunk(req, "/fileserver");
-            httpd_resp_sendstr_chunk(req, uripath);
-            httpd_resp_sendstr_chunk(req, entry->d_name);
-            if (entry->d_type == DT_DIR) {
-                httpd_resp_sendstr_chunk(req, "/");
-            }
-            httpd_resp_sendstr_chunk(req, "\">");
-            httpd_resp_sendstr_chunk(req, entry->d_name);
-            httpd_resp_sendstr_chunk(req, "</a></td><td>");
-            httpd_resp_sendstr_chunk(req, entrytype);
-            httpd_resp_sendstr_chunk(req, "</td><td>");
-            httpd_resp_sendstr_chunk(req, entrysize);
-            if (!readonly) {
-                httpd_resp_sendstr_chunk(req, "</td><td>");
-                httpd_resp_sendstr_chunk(req, "<form method=\"post\" action=\"/delete");
-                httpd_resp_sendstr_chunk(req, uripath);
-                httpd_resp_sendstr_chunk(req, entry->d_name);
-                httpd_resp_sendstr_chunk(req, "\"><button type=\"submit\">Delete</button></form>");
+        html += "<tr><td><a href=\"/fileserver" + std::string(uripath) + entry.name + (entry.isDir ? "/" : "") + "\">";
+        html += entry.name + "</a></td><td>" + entrytype + "</td><td>" + entrysize + "</td><td>" + entrydate;
+        if (!readonly) {
+            html += "</td><td><form method=\"post\" action=\"/delete" + std::string(uripath) + entry.name +
+                    "\"><button type=\"submit\">Delete</button></form>";
+        }
+        html += "</td></tr>\n";
+
+        if (html.length() > SERVER_FILER_SCRATCH_BUFSIZE) {
+            if (httpd_resp_sendstr_chunk(req, html.c_str()) != ESP_OK) {
+                ESP_LOGE(TAG, "File list sending failed!");
+                return ESP_FAIL;
             }
-            httpd_resp_sendstr_chunk(req, "</td></tr>\n");
+            html = "";
         }
     }
-    closedir(dir);
 
     /* Finish the file list table */
-    httpd_resp_sendstr_chunk(req, "</tbody></table>");
+    html += "</tbody></table>";
+
+    if (total > entries.size()) {
+        html += "<p>Entries " + std::to_string(offset + 1) + " - " + std::to_string(offset + entries.size()) +
+                " of " + std::to_string(total);
+        if (offset > 0) {
+            html += " &nbsp; <a href=\"" + pageLink(sort, desc, std::max(0, offset - limit)) + "\">&laquo; previous</a>";
+        }
+        if (offset + limit < total) {
+            html += " &nbsp; <a href=\"" + pageLink(sort, desc, offset + limit) + "\">next &raquo;</a>";
+        }
+        html += "</p>";
+    }
 
     /* Send remaining chunk of HTML file to complete it */
-    httpd_resp_sendstr_chunk(req, "</body></html>");
+    html += "</body></html>";
+    httpd_resp_sendstr_chunk(req, html.c_str());
 
     /* Send empty chunk to signal HTTP response completion */
     httpd_resp_sendstr_chunk(req, NULL);
     return ESP_OK;
 }
+
+
+/* Reads offset, limit, sort (name, size, date) and order (asc, desc) of a directory listing */
+static void get_dir_page_query(const char *_query, t_DirectorySort &_sort, bool &_desc, int &_offset, int &_limit)
+{
+    char param[32];
+
+    if (httpd_query_key_value(_query, "sort", param, sizeof(param)) == ESP_OK)
+        _sort = DirectoryIndex::ParseSort(std::string(param));
+    if (httpd_query_key_value(_query, "order", param, sizeof(param)) == ESP_OK)
+        _desc = (strcmp(param, "desc") == 0);
+    if (httpd_query_key_value(_query, "offset", param, sizeof(param)) == ESP_OK)
+        _offset = std::max(0, atoi(param));
+    if (httpd_query_key_value(_query, "limit", param, sizeof(param)) == ESP_OK)
+        _limit = std::min(std::max(1, atoi(param)), DIRECTORY_PAGE_SIZE_MAX);
+}
+
+
+/* Paginated directory listing from the directory index:
+ * /dirlist?path=/log/source/&offset=0&limit=200&sort=name|size|date&order=asc|desc
+ * Directories come first in every order.
+ * Response: {"path":"/log/source/","total":1234,"offset":0,"limit":200,"sort":"name","order":"asc",
+ *            "entries":[{"name":"...","type":"file","size":123,"mtime":1700000000},...]} */
+static esp_err_t dirlist_get_handler(httpd_req_t *req)
+{
+    char _query[FILE_PATH_MAX + 100];
+    char _valuechar[FILE_PATH_MAX];
+    std::string path = "/";
+    t_DirectorySort sort = DirSortName;
+    bool desc = false;
+    int offset = 0;
+    int limit = DIRECTORY_PAGE_SIZE_DEFAULT;
+
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    if (httpd_req_get_url_query_str(req, _query, sizeof(_query)) == ESP_OK)
+    {
+        if (httpd_query_key_value(_query, "path", _valuechar, sizeof(_valuechar)) == ESP_OK)
+            path = std::string(_valuechar);
+        get_dir_page_query(_query, sort, desc, offset, limit);
+    }
+
+    if ((path.length() == 0) || (path[0] != '/') || (path.find("..") != std::string::npos)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Parameter path invalid!");
+        return ESP_FAIL;
+    }
+
+    std::vector<DirectoryEntry> entries;
+    int total;
+    std::string dirpath = std::string(((struct file_server_data *)req->user_ctx)->base_path) + path;
+    if ((dirpath.length() > 1) && (path.length() > 1) && (dirpath[dirpath.length() - 1] == '/'))      // mountpoint keeps its "/"
+        dirpath = dirpath.substr(0, dirpath.length() - 1);
+
+    if (!DirIndex.GetPage(dirpath, sort, desc, offset, limit, entries, total)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Directory not found!");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+
+    std::string zw = "{\"path\":\"" + EscapeJson(path) + "\",\"total\":" + std::to_string(total) + ",\"offset\":" + std::to_string(offset) +
+                     ",\"limit\":" + std::to_string(limit) + ",\"sort\":\"" + DirectoryIndex::SortName(sort) +
+                     "\",\"order\":\"" + (desc ? "desc" : "asc") + "\",\"entries\":[";
+
+    for (int i = 0; i < entries.size(); ++i) {
+        zw += std::string(i ? "," : "") + "{\"name\":\"" + EscapeJson(entries[i].name) + "\",\"type\":\"" + (entries[i].isDir ? "directory" : "file") +
+              "\",\"size\":" + std::to_string(entries[i].size) + ",\"mtime\":" + std::to_string((long) entries[i].mtime) + "}";
+
+        if (zw.length() > SERVER_FILER_SCRATCH_BUFSIZE) {
+            httpd_resp_sendstr_chunk(req, zw.c_str());
+            zw = "";
+        }
+    }
+
+    zw += "]}";
+    httpd_resp_sendstr_chunk(req, zw.c_str());
+    httpd_resp_sendstr_chunk(req, NULL);
+
+    return ESP_OK;
+}
 /*
 #define IS_FILE_EXT(filename, ext) \
     (strcasecmp(&filename[strlen(filename) - sizeof(ext) + 1], ext) == 0)
@@ -335,6 +419,72 @@ static esp_err_t logfileact_get_last_part_handler(httpd_req_t *req) {
     return send_logfile(req, false);
 }
 
+/* Readings of one number from the binary data series:
+ * /dataseries?number=main&from=<unix time>&to=<unix time>&points=<n>
+ * from/to default to the last 24 hours, points > 0 reduces the result to the last reading of n equal intervals.
+ * Response: {"number":"main","readings":[[time,value,raw,rate,flags],...]} */
+static esp_err_t dataseries_get_handler(httpd_req_t *req)
+{
+    char _query[200];
+    char _valuechar[60];
+    std::string number = "";
+    time_t to = time(NULL);
+    time_t from = to - 24 * 60 * 60;
+    int points = 0;
+
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    if (httpd_req_get_url_query_str(req, _query, 200) == ESP_OK)
+    {
+        if (httpd_query_key_value(_query, "number", _valuechar, 60) == ESP_OK)
+            number = std::string(_valuechar);
+        if (httpd_query_key_value(_query, "from", _valuechar, 60) == ESP_OK)
+            from = atol(_valuechar);
+        if (httpd_query_key_value(_query, "to", _valuechar, 60) == ESP_OK)
+            to = atol(_valuechar);
+        if (httpd_query_key_value(_query, "points", _valuechar, 60) == ESP_OK)
+            points = atoi(_valuechar);
+    }
+
+    if (from < 0)
+        from = 0;
+
+    if ((number == "") || (to < from)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Parameter number missing or invalid time range!");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+
+    std::string zw = "{\"number\":\"" + EscapeJson(number) + "\",\"readings\":[";
+    bool first = true;
+    char line[100];
+
+    bool found = DataSeries.Query(number, from, to, points, [&](const DataSeriesRecord &_record) {
+        snprintf(line, sizeof(line), "%s[%lu,%.6g,%.6g,%.6g,%u]", first ? "" : ",", (unsigned long) _record.timestamp, 
+                _record.value, _record.raw, _record.rate, _record.flags);
+        zw += line;
+        first = false;
+
+        if (zw.length() > SERVER_FILER_SCRATCH_BUFSIZE) {
+            httpd_resp_sendstr_chunk(req, zw.c_str());
+            zw = "";
+        }
+    });
+
+    if (!found) { // Query fails before the first reading, so nothing is sent yet
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Number not found in the data series!");
+        return ESP_FAIL;
+    }
+
+    zw += "]}";
+    httpd_resp_sendstr_chunk(req, zw.c_str());
+    httpd_resp_sendstr_chunk(req, NULL);
+
+    return ESP_OK;
+}
+
+
 static esp_err_t datafileact_get_full_handler(httpd_req_t *req) {
     return send_datafile(req, true);
 }
@@ -355,6 +505,9 @@ static esp_err_t send_datafile(httpd_req_t *req, bool send_full_file)
 
     ESP_LOGD(TAG, "uri: %s, filename: %s, filepath: %s", req->uri, currentfilename.c_str(), currentfilename.c_str());
 
+    // Since the data file could still be open for appending, we need to close it first
+    LogFile.CloseDataLogAppendHandle();
+
     fd = fopen(currentfilename.c_str(), "r");
     if (!fd) {
         LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Failed to read file: " + std::string(currentfilename) +"!");
@@ -368,7 +521,14 @@ static esp_err_t send_datafile(httpd_req_t *req, bool send_full_file)
 //    ESP_LOGI(TAG, "Sending file: %s (%ld bytes)...", &filename, file_stat.st_size);
     set_content_type_from_file(req, currentfilename.c_str());
 
-    if (!send_full_file) { // Send only last part of file
+    if (send_full_file) { // "Range: bytes=<last size>-" allows to fetch only the new lines
+        esp_err_t res = send_file_range(req, fd, currentfilename.c_str(), ((struct file_server_data *)req->user_ctx)->scratch, SERVER_FILER_SCRATCH_BUFSIZE);
+        if (res != ESP_ERR_NOT_FOUND) {
+            fclose(fd);
+            return res;
+        }
+    }
+    else { // Send only last part of file
         ESP_LOGD(TAG, "Sending last %d bytes of the actual datafile!", LOGFILE_LAST_PART_BYTES);
 
         /* Adapted from https://www.geeksforgeeks.org/implement-your-own-tail-read-last-n-lines-of-a-huge-file/ */
@@ -454,7 +614,14 @@ static esp_err_t send_logfile(httpd_req_t *req, bool send_full_file)
 //    ESP_LOGI(TAG, "Sending file: %s (%ld bytes)...", &filename, file_stat.st_size);
     set_content_type_from_file(req, filename);
 
-    if (!send_full_file) { // Send only last part of file
+    if (send_full_file) { // "Range: bytes=<last size>-" allows to fetch only the new lines
+        esp_err_t res = send_file_range(req, fd, currentfilename.c_str(), ((struct file_server_data *)req->user_ctx)->scratch, SERVER_FILER_SCRATCH_BUFSIZE);
+        if (res != ESP_ERR_NOT_FOUND) {
+            fclose(fd);
+            return res;
+        }
+    }
+    else { // Send only last part of file
         ESP_LOGD(TAG, "Sending last %d bytes of the actual logfile!", LOGFILE_LAST_PART_BYTES);
 
         /* Adapted from https://www.geeksforgeeks.org/implement-your-own-tail-read-last-n-lines-of-a-huge-file/ */
@@ -539,6 +706,10 @@ static esp_err_t download_get_handler(httpd_req_t *req)
     /* If name has trailing '/', respond with directory contents */
     if (filename[strlen(filename) - 1] == '/') {
         bool readonly = false;
+        t_DirectorySort sort = DirSortName;
+        bool desc = false;
+        int offset = 0;
+        int limit = DIRECTORY_PAGE_SIZE_DEFAULT;
         size_t buf_len = httpd_req_get_url_query_len(req) + 1;
         if (buf_len > 1) {
             char buf[buf_len];
@@ -550,11 +721,12 @@ static esp_err_t download_get_handler(httpd_req_t *req)
                     ESP_LOGI(TAG, "Found URL query parameter => readonly=%s", param);
                     readonly = param && strcmp(param,"true")==0;
                 }
+                get_dir_page_query(buf, sort, desc, offset, limit);
             }
         }
 
         ESP_LOGD(TAG, "uri: %s, filename: %s, filepath: %s", req->uri, filename, filepath);
-        return http_resp_dir_html(req, filepath, filename, readonly);
+        return http_resp_dir_html(req, filepath, filename, readonly, sort, desc, offset, limit);
     }
 
     std::string testwlan = toUpper(std::string(filename));
@@ -582,26 +754,25 @@ static esp_err_t download_get_handler(httpd_req_t *req)
     ESP_LOGD(TAG, "Sending file: %s (%ld bytes)...", filename, file_stat.st_size);
     set_content_type_from_file(req, filename);
 
-    /* Retrieve the pointer to scratch buffer for temporary storage */
+    /* Reading from SD card and sending overlap for large files */
     char *chunk = ((struct file_server_data *)req->user_ctx)->scratch;
-    size_t chunksize;
-    do {
-        /* Read file in chunks into the scratch buffer */
-        chunksize = fread(chunk, 1, SERVER_FILER_SCRATCH_BUFSIZE, fd);
 
-        /* Send the buffer contents as HTTP response chunk */
-        if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK) {
-            fclose(fd);
-            ESP_LOGE(TAG, "File sending failed!");
-            /* Abort sending file */
-            httpd_resp_sendstr_chunk(req, NULL);
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file!");
-            return ESP_FAIL;
-        }
+    /* Resume of an interrupted download or only the new part of a growing file */
+    esp_err_t res = send_file_range(req, fd, filename, chunk, SERVER_FILER_SCRATCH_BUFSIZE);
+    if (res != ESP_ERR_NOT_FOUND) {
+        fclose(fd);
+        return res;
+    }
 
-        /* Keep looping till the whole file is sent */
-    } while (chunksize != 0);
+    if (send_file_content(req, fd, file_stat.st_size, chunk, SERVER_FILER_SCRATCH_BUFSIZE) != ESP_OK) {
+        fclose(fd);
+        ESP_LOGE(TAG, "File sending failed!");
+        /* Abort sending file */
+        httpd_resp_sendstr_chunk(req, NULL);
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file!");
+        return ESP_FAIL;
+    }
 
     /* Close file after sending complete */
     fclose(fd);
@@ -669,56 +840,40 @@ static esp_err_t upload_post_handler(httpd_req_t *req)
 
     ESP_LOGI(TAG, "Receiving file: %s...", filename);
 
-    /* Retrieve the pointer to scratch buffer for temporary storage */
+    /* Receiving and writing to SD card overlap for large files.
+     * Content length of the request gives the size of the file being uploaded */
     char *buf = ((struct file_server_data *)req->user_ctx)->scratch;
-    int received;
-
-    /* Content length of the request gives
-     * the size of the file being uploaded */
-    int remaining = req->content_len;
-
-    while (remaining > 0) {
-
-        ESP_LOGI(TAG, "Remaining size: %d", remaining);
-        /* Receive the file part by part into a buffer */
-        if ((received = httpd_req_recv(req, buf, MIN(remaining, SERVER_FILER_SCRATCH_BUFSIZE))) <= 0) {
-            if (received == HTTPD_SOCK_ERR_TIMEOUT) {
-                /* Retry if timeout occurred */
-                continue;
-            }
-
-            /* In case of unrecoverable error,
-             * close and delete the unfinished file*/
-            fclose(fd);
-            unlink(filepath);
+    esp_err_t res = receive_file_content(req, fd, req->content_len, buf, SERVER_FILER_SCRATCH_BUFSIZE);
 
-            ESP_LOGE(TAG, "File reception failed!");
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive file");
-            return ESP_FAIL;
-        }
+    if (res != ESP_OK) {
+        /* In case of unrecoverable error,
+         * close and delete the unfinished file*/
+        fclose(fd);
+        unlink(filepath);
 
-        /* Write buffer content to file on storage */
-        if (received && (received != fwrite(buf, 1, received, fd))) {
+        if (res == ESP_ERR_INVALID_STATE) {
             /* Couldn't write everything to file!
              * Storage may be full? */
-            fclose(fd);
-            unlink(filepath);
-
             ESP_LOGE(TAG, "File write failed!");
             /* Respond with 500 Internal Server Error */
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
-            return ESP_FAIL;
         }
-
-        /* Keep track of remaining size of
-         * the file left to be uploaded */
-        remaining -= received;
+        else {
+            ESP_LOGE(TAG, "File reception failed!");
+            /* Respond with 500 Internal Server Error */
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive file");
+        }
+        return ESP_FAIL;
     }
 
     /* Close file upon upload completion */
     fclose(fd);
     ESP_LOGI(TAG, "File reception complete");
+    DirIndex.InvalidateFile(filepath);
+
+    if (is_precompressible_file(filepath)) {
+        unlink((std::string(filepath) + ".gz").c_str());     // precompressed copy is outdated now
+    }
 
     std::string directory = std::string(filepath);
 	size_t zw = directory.find("/");
@@ -803,6 +958,7 @@ static esp_err_t delete_post_handler(httpd_req_t *req)
         ESP_LOGD(TAG, "Directory to delete: %s", zw.c_str());
 
         delete_all_in_directory(zw);
+        DirIndex.Invalidate(zw);
 //        directory = std::string(filepath);
 //        directory = "/fileserver" + directory;
         ESP_LOGD(TAG, "Location after delete directory content: %s", directory.c_str());
@@ -848,6 +1004,10 @@ static esp_err_t delete_post_handler(httpd_req_t *req)
         ESP_LOGI(TAG, "Deleting file: %s", filename);
         /* Delete file */
         unlink(filepath);
+        if (is_precompressible_file(filepath)) {
+            unlink((std::string(filepath) + ".gz").c_str());     // otherwise the precompressed copy would still be served
+        }
+        DirIndex.InvalidateFile(filepath);
 
         directory = std::string(filepath);
         size_t zw = directory.find("/");
@@ -905,13 +1065,152 @@ void delete_all_in_directory(std::string _directory)
     closedir(dir);
 }
 
+/* gzip file (header, raw deflate, crc32, size) for the precompressed web interface, see send_file().
+ * It is written while the original file is extracted. */
+struct GzipWriter {
+    FILE* file;
+    tdefl_compressor* comp;
+    mz_ulong crc;
+    uint32_t size;
+};
+
+
+static mz_bool GzipPutBuf(const void* _buf, int _len, void* _user)
+{
+    return (fwrite(_buf, 1, _len, (FILE*) _user) == (size_t) _len);
+}
+
+
+static bool GzipOpen(GzipWriter &_gz, std::string _filename)
+{
+    static const uint8_t header[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff};
+
+    _gz.crc = MZ_CRC32_INIT;
+    _gz.size = 0;
+    _gz.file = NULL;
+    _gz.comp = (tdefl_compressor*) GET_MEMORY(sizeof(tdefl_compressor));      // ca. 320 kB
+    if (!_gz.comp) {
+        return false;
+    }
+
+    _gz.file = fopen(_filename.c_str(), "wb");
+    if (!_gz.file) {
+        free(_gz.comp);
+        _gz.comp = NULL;
+        return false;
+    }
+
+    int flags = tdefl_create_comp_flags_from_zip_params(MZ_DEFAULT_LEVEL, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY);
+    tdefl_init(_gz.comp, GzipPutBuf, _gz.file, flags);
+    fwrite(header, 1, sizeof(header), _gz.file);
+    return true;
+}
+
+
+static bool GzipWrite(GzipWriter &_gz, const void* _data, size_t _size)
+{
+    _gz.crc = mz_crc32(_gz.crc, (const unsigned char*) _data, _size);
+    _gz.size += _size;
+    return (tdefl_compress_buffer(_gz.comp, _data, _size, TDEFL_NO_FLUSH) == TDEFL_STATUS_OKAY);
+}
+
+
+static void GzipClose(GzipWriter &_gz, std::string _filename, bool _ok)
+{
+    uint8_t trailer[8];
+    for (int i = 0; i < 4; ++i) {
+        trailer[i] = (_gz.crc >> (8 * i)) & 0xff;
+        trailer[4 + i] = (_gz.size >> (8 * i)) & 0xff;
+    }
+
+    _ok = _ok && (tdefl_compress_buffer(_gz.comp, NULL, 0, TDEFL_FINISH) == TDEFL_STATUS_DONE);
+    _ok = _ok && (fwrite(trailer, 1, sizeof(trailer), _gz.file) == sizeof(trailer));
+    fclose(_gz.file);
+    free(_gz.comp);
+
+    if (!_ok) {
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Can't write " + _filename);
+        unlink(_filename.c_str());
+    }
+}
+
+
+/* Inflates one archive entry block by block directly into _target (no heap block of the whole file needed).
+ * The CRC32 of the entry is checked by miniz, the SHA-256 is calculated on the fly. */
+static bool ExtractFileStreaming(mz_zip_archive* _zip, int _index, std::string _target, bool _gzip, std::string &_sha256)
+{
+    mz_zip_reader_extract_iter_state* iter = mz_zip_reader_extract_iter_new(_zip, _index, 0);
+    if (!iter) {
+        ESP_LOGE(TAG, "mz_zip_reader_extract_iter_new() failed on %s", _target.c_str());
+        return false;
+    }
+
+    uint8_t* buf = (uint8_t*) GET_MEMORY(UNZIP_WRITE_BUFFER_SIZE);
+    FILE* fpTargetFile = fopen(_target.c_str(), "wb");
+    if (!buf || !fpTargetFile) {
+        ESP_LOGE(TAG, "Can't extract %s (no memory or file can't be created)", _target.c_str());
+        if (buf)
+            free(buf);
+        if (fpTargetFile)
+            fclose(fpTargetFile);
+        mz_zip_reader_extract_iter_free(iter);
+        return false;
+    }
+
+    GzipWriter gz;
+    if (_gzip && !GzipOpen(gz, _target + ".gz")) {
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Can't create " + _target + ".gz");
+        _gzip = false;
+    }
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    mbedtls_sha256_starts_ret(&sha, 0);
+
+    bool isokay = true;
+    bool gzipokay = true;
+    size_t read;
+
+    while ((read = mz_zip_reader_extract_iter_read(iter, buf, UNZIP_WRITE_BUFFER_SIZE)) > 0) {
+        if (fwrite(buf, 1, read, fpTargetFile) != read) {
+            ESP_LOGE(TAG, "ERROR in writting extracted file (function fwrite) \"%s\"", _target.c_str());
+            isokay = false;
+            break;
+        }
+        mbedtls_sha256_update_ret(&sha, buf, read);
+
+        if (_gzip && gzipokay)
+            gzipokay = GzipWrite(gz, buf, read);
+    }
+
+    fclose(fpTargetFile);
+    free(buf);
+
+    if (!mz_zip_reader_extract_iter_free(iter)) {       // also false on a CRC32 mismatch
+        ESP_LOGE(TAG, "Inflating \"%s\" failed (corrupted archive?)", _target.c_str());
+        isokay = false;
+    }
+
+    if (_gzip)
+        GzipClose(gz, _target + ".gz", isokay && gzipokay);
+
+    unsigned char hash[32];
+    char hex[65];
+    mbedtls_sha256_finish_ret(&sha, hash);
+    mbedtls_sha256_free(&sha);
+    for (int i = 0; i < 32; ++i)
+        sprintf(hex + 2 * i, "%02x", hash[i]);
+    _sha256 = std::string(hex);
+
+    return isokay;
+}
+
+
 std::string unzip_new(std::string _in_zip_file, std::string _target_zip, std::string _target_bin, std::string _main, bool _initial_setup)
 {
     int i, sort_iter;
     mz_bool status;
-    size_t uncomp_size;
     mz_zip_archive zip_archive;
-    void* p;
     char archive_filename[64];
     std::string zw, ret = "";
     std::string directory = "";
@@ -931,6 +1230,7 @@ std::string unzip_new(std::string _in_zip_file, std::string _target_zip, std::st
     // Get and print information about each file in the archive.
     int numberoffiles = (int)mz_zip_reader_get_num_files(&zip_archive);
     ESP_LOGI(TAG, "Numbers of files to be extracted: %d", numberoffiles);
+    mz_zip_reader_end(&zip_archive);
 
     sort_iter = 0;
     {
@@ -949,16 +1249,6 @@ std::string unzip_new(std::string _in_zip_file, std::string _target_zip, std::st
             sprintf(archive_filename, file_stat.m_filename);
             
             if (!file_stat.m_is_directory) {
-            // Try to extract all the files to the heap.
-            p = mz_zip_reader_extract_file_to_heap(&zip_archive, archive_filename, &uncomp_size, 0);
-                if (!p)
-                {
-                    ESP_LOGE(TAG, "mz_zip_reader_extract_file_to_heap() failed on file %s", archive_filename);
-                    mz_zip_reader_end(&zip_archive);
-                    return ret;
-                }
-            
-                // Save to File.
                 zw = std::string(archive_filename);
                 ESP_LOGD(TAG, "Rohfilename: %s", zw.c_str());
 
@@ -998,37 +1288,34 @@ std::string unzip_new(std::string _in_zip_file, std::string _target_zip, std::st
 
                 // extrahieren in zwischendatei
                 DeleteFile(filename_zw);
-                FILE* fpTargetFile = fopen(filename_zw.c_str(), "wb");
-                uint writtenbytes = fwrite(p, 1, (uint)uncomp_size, fpTargetFile);
-                fclose(fpTargetFile);
-                
-                bool isokay = true;
-
-                if (writtenbytes == (uint)uncomp_size)
-                {
-                    isokay = true;
-                }
-                else
-                {
-                    isokay = false;
-                    ESP_LOGD(TAG, "ERROR in writting extracted file (function fwrite) extracted file \"%s\", size %u", archive_filename, (uint)uncomp_size);
-                }
+                bool gzip = is_precompressible_file(zw) && (file_stat.m_uncomp_size >= GZIP_MIN_FILE_SIZE);
+                std::string sha256;
+                bool isokay = ExtractFileStreaming(&zip_archive, i, filename_zw, gzip, sha256);
 
                 DeleteFile(zw);
                 if (!isokay)
-                    ESP_LOGE(TAG, "ERROR in fwrite \"%s\", size %u", archive_filename, (uint)uncomp_size);
+                    DeleteFile(filename_zw);
                 isokay = isokay && RenameFile(filename_zw, zw);
                 if (!isokay)
                     ESP_LOGE(TAG, "ERROR in Rename \"%s\" to \"%s\"", filename_zw.c_str(), zw.c_str());
 
+                if (isokay && gzip)
+                {
+                    DeleteFile(zw + ".gz");
+                    RenameFile(filename_zw + ".gz", zw + ".gz");
+                }
+
                 if (isokay)
-                    ESP_LOGI(TAG, "Successfully extracted file \"%s\", size %u", archive_filename, (uint)uncomp_size);
+                {
+                    ESP_LOGI(TAG, "Successfully extracted file \"%s\", size %u, SHA-256 %s", archive_filename, (uint)file_stat.m_uncomp_size, sha256.c_str());
+                    if (toUpper(std::string(archive_filename)) == "FIRMWARE.BIN")
+                        LogFile.WriteToFile(ESP_LOG_INFO, TAG, "firmware.bin extracted, SHA-256 " + sha256);
+                }
                 else
                 {
-                    ESP_LOGE(TAG, "ERROR in extracting file \"%s\", size %u", archive_filename, (uint)uncomp_size);
+                    ESP_LOGE(TAG, "ERROR in extracting file \"%s\", size %u", archive_filename, (uint)file_stat.m_uncomp_size);
                     ret = "ERROR";
                 }
-                mz_free(p);
             }
         }
 
@@ -1036,6 +1323,7 @@ std::string unzip_new(std::string _in_zip_file, std::string _target_zip, std::st
         mz_zip_reader_end(&zip_archive);
     }
 
+    DirIndex.InvalidateAll();
     ESP_LOGD(TAG, "Success.");
     return ret;
 }
@@ -1043,9 +1331,7 @@ std::string unzip_new(std::string _in_zip_file, std::string _target_zip, std::st
 void unzip(std::string _in_zip_file, std::string _target_directory){
     int i, sort_iter;
     mz_bool status;
-    size_t uncomp_size;
     mz_zip_archive zip_archive;
-    void* p;
     char archive_filename[64];
     std::string zw;
 //    static const char* s_Test_archive_filename = "testhtml.zip";
@@ -1065,6 +1351,7 @@ void unzip(std::string _in_zip_file, std::string _target_directory){
 
     // Get and print information about each file in the archive.
     int numberoffiles = (int)mz_zip_reader_get_num_files(&zip_archive);
+    mz_zip_reader_end(&zip_archive);
     for (sort_iter = 0; sort_iter < 2; sort_iter++)
     {
         memset(&zip_archive, 0, sizeof(zip_archive));
@@ -1081,34 +1368,27 @@ void unzip(std::string _in_zip_file, std::string _target_directory){
             mz_zip_reader_file_stat(&zip_archive, i, &file_stat);
             sprintf(archive_filename, file_stat.m_filename);
  
-            // Try to extract all the files to the heap.
-            p = mz_zip_reader_extract_file_to_heap(&zip_archive, archive_filename, &uncomp_size, 0);
-            if (!p)
-            {
-                ESP_LOGD(TAG, "mz_zip_reader_extract_file_to_heap() failed!");
-                mz_zip_reader_end(&zip_archive);
-                return;
-            }
-
             // Save to File.
             zw = std::string(archive_filename);
             zw = _target_directory + zw;
             ESP_LOGD(TAG, "Filename to extract: %s", zw.c_str());
-            FILE* fpTargetFile = fopen(zw.c_str(), "wb");
-            fwrite(p, 1, (uint)uncomp_size, fpTargetFile);
-            fclose(fpTargetFile);
 
-            ESP_LOGD(TAG, "Successfully extracted file \"%s\", size %u", archive_filename, (uint)uncomp_size);
-            //            ESP_LOGD(TAG, "File data: \"%s\"", (const char*)p);
+            std::string sha256;
+            if (!ExtractFileStreaming(&zip_archive, i, zw, false, sha256))
+            {
+                ESP_LOGD(TAG, "ExtractFileStreaming() failed!");
+                mz_zip_reader_end(&zip_archive);
+                return;
+            }
 
-            // We're done.
-            mz_free(p);
+            ESP_LOGD(TAG, "Successfully extracted file \"%s\", size %u", archive_filename, (uint)file_stat.m_uncomp_size);
         }
 
         // Close the archive, freeing any resources it was using
         mz_zip_reader_end(&zip_archive);
     }
 
+    DirIndex.InvalidateAll();
     ESP_LOGD(TAG, "Success.");
 }
 
@@ -1173,6 +1453,23 @@ void register_server_file_uri(httpd_handle_t server, const char *base_path)
     };
     httpd_register_uri_handler(server, &file_datafile_last_part_handle);
 
+
+    httpd_uri_t file_dataseries = {
+        .uri       = "/dataseries",
+        .method    = HTTP_GET,
+        .handler   = dataseries_get_handler,
+        .user_ctx  = server_data    // Pass server data as context
+    };
+    httpd_register_uri_handler(server, &file_dataseries);
+
+    httpd_uri_t file_dirlist = {
+        .uri       = "/dirlist",
+        .method    = HTTP_GET,
+        .handler   = dirlist_get_handler,
+        .user_ctx  = server_data    // Pass server data as context
+    };
+    httpd_register_uri_handler(server, &file_dirlist);
+
     httpd_uri_t file_logfileact = {
         .uri       = "/logfileact",  // Match all URIs of type /path/to/file
         .method    = HTTP_GET,
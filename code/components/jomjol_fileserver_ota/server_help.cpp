@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <sys/param.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
@@ -14,8 +15,14 @@ extern "C" {
 }
 #endif
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 
 #include "Helper.h"
 
@@ -37,9 +44,331 @@ bool endsWith(std::string const &str, std::string const &suffix) {
 }
 
 
+/* Pipelined file transfer: a helper task works on the SD card (fread / fwrite) while the http task
+ * sends / receives the other buffer. Buffers are passed between both tasks by two queues. */
+struct TransferBuffer {
+    char *data;
+    int len;                    // > 0: data, 0: end of file, < 0: error
+};
+
+struct TransferContext {
+    FILE *fd;
+    size_t buffersize;
+    size_t remaining;           // bytes still to read (download)
+    QueueHandle_t freeQueue;    // empty buffers
+    QueueHandle_t fullQueue;    // buffers with data (+ end marker)
+    SemaphoreHandle_t done;     // given by the helper task when it does no longer touch any buffer
+    volatile bool abort;        // http side failed (download)
+    volatile bool failed;       // SD side failed (upload)
+};
+
+
+static int transfer_alloc_buffers(char *buffers[FILE_TRANSFER_BUFFERS])
+{
+    int anz = 0;
+
+    for (int i = 0; i < FILE_TRANSFER_BUFFERS; ++i) {
+        buffers[i] = NULL;
+        // The SD card driver can only use DMA directly with internal RAM, but that must not get short
+        if (heap_caps_get_free_size(MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL) > FILE_TRANSFER_MIN_FREE_INTERNAL + FILE_TRANSFER_BUFFER_SIZE) {
+            buffers[i] = (char*) heap_caps_malloc(FILE_TRANSFER_BUFFER_SIZE, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        }
+        if (!buffers[i]) {
+            buffers[i] = (char*) GET_MEMORY(FILE_TRANSFER_BUFFER_SIZE);
+        }
+        if (buffers[i]) {
+            anz++;
+        }
+    }
+
+    return anz;
+}
+
+
+static bool transfer_init(TransferContext &ctx, FILE *fd, char *buffers[FILE_TRANSFER_BUFFERS], size_t limit = SIZE_MAX)
+{
+    ctx.fd = fd;
+    ctx.buffersize = FILE_TRANSFER_BUFFER_SIZE;
+    ctx.remaining = limit;
+    ctx.abort = false;
+    ctx.failed = false;
+    ctx.freeQueue = xQueueCreate(FILE_TRANSFER_BUFFERS, sizeof(TransferBuffer));
+    ctx.fullQueue = xQueueCreate(FILE_TRANSFER_BUFFERS + 1, sizeof(TransferBuffer));
+    ctx.done = xSemaphoreCreateBinary();
+
+    if ((transfer_alloc_buffers(buffers) < FILE_TRANSFER_BUFFERS) || !ctx.freeQueue || !ctx.fullQueue || !ctx.done) {
+        return false;
+    }
+
+    for (int i = 0; i < FILE_TRANSFER_BUFFERS; ++i) {
+        TransferBuffer buf = {buffers[i], 0};
+        xQueueSend(ctx.freeQueue, &buf, 0);
+    }
+    return true;
+}
+
+
+static void transfer_free(TransferContext &ctx, char *buffers[FILE_TRANSFER_BUFFERS])
+{
+    for (int i = 0; i < FILE_TRANSFER_BUFFERS; ++i) {
+        if (buffers[i]) {
+            free(buffers[i]);
+        }
+    }
+    if (ctx.freeQueue)
+        vQueueDelete(ctx.freeQueue);
+    if (ctx.fullQueue)
+        vQueueDelete(ctx.fullQueue);
+    if (ctx.done)
+        vSemaphoreDelete(ctx.done);
+}
+
+
+static void task_TransferReader(void *pvParameter)
+{
+    TransferContext *ctx = (TransferContext*) pvParameter;
+    TransferBuffer buf;
+
+    while (!ctx->abort && (xQueueReceive(ctx->freeQueue, &buf, portMAX_DELAY) == pdTRUE)) {
+        if (ctx->abort) {
+            break;
+        }
+
+        buf.len = fread(buf.data, 1, MIN(ctx->buffersize, ctx->remaining), ctx->fd);
+        if ((buf.len == 0) && ferror(ctx->fd)) {
+            buf.len = -1;
+        }
+        else {
+            ctx->remaining -= buf.len;
+        }
+        xQueueSend(ctx->fullQueue, &buf, portMAX_DELAY);
+
+        if (buf.len <= 0) {
+            break;
+        }
+    }
+
+    xSemaphoreGive(ctx->done);
+    vTaskDelete(NULL);
+}
+
+
+static void task_TransferWriter(void *pvParameter)
+{
+    TransferContext *ctx = (TransferContext*) pvParameter;
+    TransferBuffer buf;
+
+    while (xQueueReceive(ctx->fullQueue, &buf, portMAX_DELAY) == pdTRUE) {
+        if (buf.len <= 0) {
+            break;
+        }
+
+        if (!ctx->failed && ((int)fwrite(buf.data, 1, buf.len, ctx->fd) != buf.len)) {
+            ctx->failed = true;
+        }
+        xQueueSend(ctx->freeQueue, &buf, portMAX_DELAY);
+    }
+
+    xSemaphoreGive(ctx->done);
+    vTaskDelete(NULL);
+}
+
+
+/* Sends one block either as http chunk or (raw = true) as plain data after an own response head */
+static esp_err_t send_block(httpd_req_t *req, const char *buf, size_t len, bool raw)
+{
+    if (!raw) {
+        return httpd_resp_send_chunk(req, buf, len);
+    }
+
+    while (len > 0) {
+        int sent = httpd_send(req, buf, len);
+        if (sent == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;       // Retry if timeout occurred
+        }
+        if (sent <= 0) {
+            return ESP_FAIL;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return ESP_OK;
+}
+
+
+/* raw = false: Sends fd up to its end as http chunks, size is only the expected size.
+ * raw = true: Sends exactly size bytes, the response head was already sent (Content-Length). */
+static esp_err_t send_content(httpd_req_t *req, FILE *fd, size_t size, bool raw, char *scratch, size_t scratchsize)
+{
+    char *buffers[FILE_TRANSFER_BUFFERS] = {};
+    TransferContext ctx = {};
+    esp_err_t res = ESP_OK;
+    size_t sent = 0;
+
+    if ((size > FILE_TRANSFER_BUFFER_SIZE) && transfer_init(ctx, fd, buffers, raw ? size : SIZE_MAX) &&
+            (xTaskCreate(&task_TransferReader, "file_reader", FILE_TRANSFER_TASK_STACK, &ctx, tskIDLE_PRIORITY+3, NULL) == pdPASS)) {
+        TransferBuffer buf;
+
+        while (xQueueReceive(ctx.fullQueue, &buf, portMAX_DELAY) == pdTRUE) {
+            if (buf.len <= 0) {
+                res = (buf.len < 0) ? ESP_FAIL : ESP_OK;
+                break;
+            }
+
+            if (send_block(req, buf.data, buf.len, raw) != ESP_OK) {
+                res = ESP_FAIL;
+                ctx.abort = true;
+            }
+            sent += buf.len;
+            xQueueSend(ctx.freeQueue, &buf, 0);    // also wakes up the reader after an abort
+
+            if (ctx.abort) {
+                break;
+            }
+        }
+
+        xSemaphoreTake(ctx.done, portMAX_DELAY);
+        transfer_free(ctx, buffers);
+    }
+    else {
+        transfer_free(ctx, buffers);
+
+        size_t chunksize;
+        while ((chunksize = fread(scratch, 1, raw ? MIN(scratchsize, size - sent) : scratchsize, fd)) > 0) {
+            if (send_block(req, scratch, chunksize, raw) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            sent += chunksize;
+        }
+    }
+
+    if ((res == ESP_OK) && raw && (sent != size)) {    // File got shorter, the announced Content-Length can't be kept
+        res = ESP_FAIL;
+    }
+    return res;
+}
+
+
+/* Sends the content of fd as http chunks (without the final empty chunk).
+ * Files larger than one transfer buffer are read ahead by a helper task, small files
+ * (or if there is not enough memory) are sent sequentially with scratch. */
+esp_err_t send_file_content(httpd_req_t *req, FILE *fd, size_t size, char *scratch, size_t scratchsize)
+{
+    return send_content(req, fd, size, false, scratch, scratchsize);
+}
+
+
+/* Receives size bytes of the request body into fd. Large uploads are received into one buffer
+ * while a helper task writes the previous one to the SD card.
+ * Returns ESP_FAIL if the reception failed and ESP_ERR_INVALID_STATE if the file could not be written. */
+esp_err_t receive_file_content(httpd_req_t *req, FILE *fd, size_t size, char *scratch, size_t scratchsize)
+{
+    char *buffers[FILE_TRANSFER_BUFFERS] = {};
+    TransferContext ctx = {};
+    int remaining = size;
+    int received;
+
+    if ((size > FILE_TRANSFER_BUFFER_SIZE) && transfer_init(ctx, fd, buffers) &&
+            (xTaskCreate(&task_TransferWriter, "file_writer", FILE_TRANSFER_TASK_STACK, &ctx, tskIDLE_PRIORITY+3, NULL) == pdPASS)) {
+        esp_err_t res = ESP_OK;
+        TransferBuffer buf;
+
+        while ((remaining > 0) && (res == ESP_OK) && !ctx.failed) {
+            xQueueReceive(ctx.freeQueue, &buf, portMAX_DELAY);
+            buf.len = 0;
+
+            /* Fill the whole buffer, the SD card is faster with large blocks */
+            while ((buf.len < (int)ctx.buffersize) && (remaining > 0)) {
+                received = httpd_req_recv(req, buf.data + buf.len, MIN(remaining, (int)ctx.buffersize - buf.len));
+                if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+                    continue;       // Retry if timeout occurred
+                }
+                if (received <= 0) {
+                    res = ESP_FAIL;
+                    break;
+                }
+                buf.len += received;
+                remaining -= received;
+            }
+
+            if (buf.len > 0) {
+                xQueueSend(ctx.fullQueue, &buf, portMAX_DELAY);
+            }
+            else {
+                xQueueSend(ctx.freeQueue, &buf, portMAX_DELAY);
+            }
+        }
+
+        TransferBuffer endmarker = {NULL, 0};
+        xQueueSend(ctx.fullQueue, &endmarker, portMAX_DELAY);
+        xSemaphoreTake(ctx.done, portMAX_DELAY);
+
+        if ((res == ESP_OK) && ctx.failed) {
+            res = ESP_ERR_INVALID_STATE;
+        }
+        transfer_free(ctx, buffers);
+        return res;
+    }
+    transfer_free(ctx, buffers);
+
+    while (remaining > 0) {
+        ESP_LOGI(TAG, "Remaining size: %d", remaining);
+        if ((received = httpd_req_recv(req, scratch, MIN(remaining, (int)scratchsize))) <= 0) {
+            if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+                continue;   // Retry if timeout occurred
+            }
+            return ESP_FAIL;
+        }
+
+        if (received != fwrite(scratch, 1, received, fd)) {
+            return ESP_ERR_INVALID_STATE;
+        }
+        remaining -= received;
+    }
+    return ESP_OK;
+}
+
+
+/* Text files of the web interface, a gzip compressed copy (<file>.gz) is created at the html update */
+bool is_precompressible_file(std::string filename)
+{
+    return endsWith(filename, ".html") ||
+           endsWith(filename, ".htm") ||
+           endsWith(filename, ".css") ||
+           endsWith(filename, ".js");
+}
+
+
+static bool accepts_gzip(httpd_req_t *req)
+{
+    char acceptEncoding[100];
+
+    if (httpd_req_get_hdr_value_str(req, "Accept-Encoding", acceptEncoding, sizeof(acceptEncoding)) != ESP_OK) {
+        return false;
+    }
+    return (strstr(acceptEncoding, "gzip") != NULL);
+}
+
+
 esp_err_t send_file(httpd_req_t *req, std::string filename)
 {
-    FILE *fd = fopen(filename.c_str(), "r");
+    /* Use the precompressed copy if the browser accepts it. It must not be older than the file itself
+       (e.g. file replaced by an upload), otherwise the old content would be served. */
+    bool gzip = false;
+    std::string filetoread = filename;
+
+    if (is_precompressible_file(filename) && accepts_gzip(req)) {
+        struct stat gz_stat, file_stat;
+        std::string gzfilename = filename + ".gz";
+
+        if ((stat(gzfilename.c_str(), &gz_stat) == 0) &&
+                ((stat(filename.c_str(), &file_stat) != 0) || (gz_stat.st_mtime >= file_stat.st_mtime))) {
+            gzip = true;
+            filetoread = gzfilename;
+        }
+    }
+
+    FILE *fd = fopen(filetoread.c_str(), "r");
     if (!fd) {
         ESP_LOGE(TAG, "Failed to read file: %s", filename.c_str());
         /* Respond with 404 Error */
@@ -65,27 +394,26 @@ esp_err_t send_file(httpd_req_t *req, std::string filename)
     }
 
     set_content_type_from_file(req, filename.c_str());
+    if (is_precompressible_file(filename)) {
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    }
+    if (gzip) {
+        ESP_LOGD(TAG, "Sending precompressed file: %s", filetoread.c_str());
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
 
-    /* Retrieve the pointer to scratch buffer for temporary storage */
-    char *chunk = scratch;
-    size_t chunksize;
-    do {
-        /* Read file in chunks into the scratch buffer */
-        chunksize = fread(chunk, 1, SERVER_HELPER_SCRATCH_BUFSIZE, fd);
-
-        /* Send the buffer contents as HTTP response chunk */
-        if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK) {
-            fclose(fd);
-            ESP_LOGE(TAG, "File sending failed!");
-            /* Abort sending file */
-            httpd_resp_sendstr_chunk(req, NULL);
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
-            return ESP_FAIL;
-        }
+    struct stat st;
+    size_t size = (stat(filetoread.c_str(), &st) == 0) ? st.st_size : 0;
 
-        /* Keep looping till the whole file is sent */
-    } while (chunksize != 0);
+    if (send_file_content(req, fd, size, scratch, SERVER_HELPER_SCRATCH_BUFSIZE) != ESP_OK) {
+        fclose(fd);
+        ESP_LOGE(TAG, "File sending failed!");
+        /* Abort sending file */
+        httpd_resp_sendstr_chunk(req, NULL);
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
+        return ESP_FAIL;
+    }
 
     /* Close file after sending complete */
     fclose(fd);
@@ -126,25 +454,154 @@ const char* get_path_from_uri(char *dest, const char *base_path, const char *uri
 }
 
 
-/* Set HTTP response content type according to file extension */
-esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filename)
+/* HTTP content type according to file extension */
+const char* get_content_type_from_file(const char *filename)
 {
     if (IS_FILE_EXT(filename, ".pdf")) {
-        return httpd_resp_set_type(req, "application/pdf");
+        return "application/pdf";
     } else if (IS_FILE_EXT(filename, ".html")) {
-        return httpd_resp_set_type(req, "text/html");
+        return "text/html";
     } else if (IS_FILE_EXT(filename, ".jpeg")) {
-        return httpd_resp_set_type(req, "image/jpeg");
+        return "image/jpeg";
     } else if (IS_FILE_EXT(filename, ".jpg")) {
-        return httpd_resp_set_type(req, "image/jpeg");
+        return "image/jpeg";
     } else if (IS_FILE_EXT(filename, ".ico")) {
-        return httpd_resp_set_type(req, "image/x-icon");
+        return "image/x-icon";
     } else if (IS_FILE_EXT(filename, ".js")) {
-        return httpd_resp_set_type(req, "text/javascript");
+        return "text/javascript";
     } else if (IS_FILE_EXT(filename, ".css")) {
-        return httpd_resp_set_type(req, "text/css");
+        return "text/css";
     }
     /* This is a limited set only */
     /* For any other type always set as plain text */
-    return httpd_resp_set_type(req, "text/plain");
+    return "text/plain";
+}
+
+
+/* Set HTTP response content type according to file extension */
+esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filename)
+{
+    return httpd_resp_set_type(req, get_content_type_from_file(filename));
+}
+
+
+/* Parses "bytes=<start>-<end>", "bytes=<start>-" and "bytes=-<suffix length>".
+ * Returns 1 for a valid range, -1 if the range is outside of the file and 0 if the header
+ * can't be used (syntax, several ranges), then the whole file is sent. */
+static int parse_range(const char *range, size_t filesize, size_t &start, size_t &end)
+{
+    if ((strncmp(range, "bytes=", 6) != 0) || strchr(range, ',')) {
+        return 0;
+    }
+    range += 6;
+
+    const char *minus = strchr(range, '-');
+    if (!minus || (minus == range && !isdigit((unsigned char)minus[1]))) {
+        return 0;
+    }
+
+    char *endptr;
+    if (minus == range) {   // suffix: the last n bytes
+        unsigned long suffix = strtoul(minus + 1, &endptr, 10);
+        if (*endptr != '\0') {
+            return 0;
+        }
+        if ((suffix == 0) || (filesize == 0)) {
+            return -1;
+        }
+        start = (suffix < filesize) ? filesize - suffix : 0;
+        end = filesize - 1;
+        return 1;
+    }
+
+    if (!isdigit((unsigned char)range[0])) {
+        return 0;
+    }
+    start = strtoul(range, &endptr, 10);
+    if (endptr != minus) {
+        return 0;
+    }
+
+    if (minus[1] == '\0') {
+        end = filesize - 1;
+    }
+    else {
+        if (!isdigit((unsigned char)minus[1])) {
+            return 0;
+        }
+        end = strtoul(minus + 1, &endptr, 10);
+        if ((*endptr != '\0') || (end < start)) {
+            return 0;
+        }
+        end = MIN(end, filesize - 1);
+    }
+
+    if (start >= filesize) {
+        return -1;
+    }
+    return 1;
+}
+
+
+/* Answers a request with a "Range: bytes=" header with 206 Partial Content (or 416 if the range
+ * is outside of the file). Returns ESP_ERR_NOT_FOUND if there is no usable range, the caller
+ * sends the whole file then (Accept-Ranges is already set). fd is positioned anywhere afterwards. */
+esp_err_t send_file_range(httpd_req_t *req, FILE *fd, const char *filename, char *scratch, size_t scratchsize)
+{
+    char range[HTTP_RANGE_HEADER_MAX];
+    size_t start = 0, end = 0;
+
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+
+    size_t len = httpd_req_get_hdr_value_len(req, "Range");
+    if ((len == 0) || (len >= sizeof(range)) || (httpd_req_get_hdr_value_str(req, "Range", range, sizeof(range)) != ESP_OK)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (fseek(fd, 0, SEEK_END) != 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    long filesize = ftell(fd);
+    fseek(fd, 0, SEEK_SET);
+    if (filesize < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    int result = parse_range(range, filesize, start, end);
+    if (result == 0) {
+        ESP_LOGD(TAG, "Range \"%s\" ignored", range);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char head[256];
+    if (result < 0) {
+        ESP_LOGD(TAG, "Range \"%s\" not satisfiable (%ld bytes)", range, filesize);
+        snprintf(head, sizeof(head), "bytes */%ld", filesize);
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        httpd_resp_set_hdr(req, "Content-Range", head);
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    if (fseek(fd, start, SEEK_SET) != 0) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read file");
+        return ESP_FAIL;
+    }
+
+    /* httpd_resp_send_chunk() can't be used with a Content-Length and httpd_resp_send() needs the whole
+     * content in RAM, so the response head is written here and the range is sent as plain data */
+    size_t length = end - start + 1;
+    snprintf(head, sizeof(head), "HTTP/1.1 206 Partial Content\r\n"
+                                 "Content-Type: %s\r\n"
+                                 "Content-Length: %u\r\n"
+                                 "Content-Range: bytes %u-%u/%ld\r\n"
+                                 "Accept-Ranges: bytes\r\n"
+                                 "Access-Control-Allow-Origin: *\r\n\r\n",
+                                 get_content_type_from_file(filename), (unsigned)length, (unsigned)start, (unsigned)end, filesize);
+    ESP_LOGD(TAG, "Sending range %u-%u of %s", (unsigned)start, (unsigned)end, filename);
+
+    if ((send_block(req, head, strlen(head), true) != ESP_OK) || (send_content(req, fd, length, true, scratch, scratchsize) != ESP_OK)) {
+        ESP_LOGE(TAG, "Range sending failed!");
+        return ESP_FAIL;    // closes the connection, the client notices the missing bytes
+    }
+    return ESP_OK;
 }
@@ -4,6 +4,7 @@
 #define SERVERHELP_H
 
 #include <string>
+#include <stdio.h>
 //#include <sys/param.h>
 #include "esp_http_server.h"
 
@@ -13,5 +14,12 @@ const char* get_path_from_uri(char *dest, const char *base_path, const char *uri
 esp_err_t send_file(httpd_req_t *req, std::string filename);
 
 esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filename);
+const char* get_content_type_from_file(const char *filename);
+
+bool is_precompressible_file(std::string filename);
+
+esp_err_t send_file_content(httpd_req_t *req, FILE *fd, size_t size, char *scratch, size_t scratchsize);
+esp_err_t send_file_range(httpd_req_t *req, FILE *fd, const char *filename, char *scratch, size_t scratchsize);
+esp_err_t receive_file_content(httpd_req_t *req, FILE *fd, size_t size, char *scratch, size_t scratchsize);
 
 #endif //SERVERHELP_H
\ No newline at end of file
@@ -16,6 +16,21 @@ static const char *TAG = "ALIGN";
 // #define DEBUG_DETAIL_ON  
 
 
+static std::shared_ptr<CachedJPG> EncodeJPG(CImageBasis *_image)
+{
+    size_t size = 0;
+    uint8_t* jpg = _image->writeToBufferAsJPG(size);
+
+    if (!jpg)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Not enough memory to encode the aligned image");
+        return NULL;
+    }
+
+    return std::shared_ptr<CachedJPG>(new CachedJPG(jpg, size));
+}
+
+
 void ClassFlowAlignment::SetInitialParameter(void)
 {
     initalrotate = 0;
@@ -36,6 +51,7 @@ void ClassFlowAlignment::SetInitialParameter(void)
     previousElement = NULL;
     disabled = false;
     SAD_criteria = 0.05;
+    roi_direct_sampling = false;
 }
 
 
@@ -43,6 +59,7 @@ ClassFlowAlignment::ClassFlowAlignment(std::vector<ClassFlow*>* lfc)
 {
     SetInitialParameter();
     ListFlowControll = lfc;
+    alignedJPGMutex = xSemaphoreCreateMutex();
 
     for (int i = 0; i < ListFlowControll->size(); ++i)
     {
@@ -107,6 +124,11 @@ bool ClassFlowAlignment::ReadParameter(FILE* pfile, string& aktparamgraph)
             if (toUpper(splitted[1]) == "TRUE")
                 use_antialiasing = true;
         }   
+        if ((toUpper(splitted[0]) == "ROIDIRECTSAMPLING") && (splitted.size() > 1))
+        {
+            if (toUpper(splitted[1]) == "TRUE")
+                roi_direct_sampling = true;
+        }   
         if ((splitted.size() == 3) && (anz_ref < 2))
         {
             References[anz_ref].image_file = FormatFileName("/sdcard" + splitted[0]);
@@ -181,90 +203,151 @@ bool ClassFlowAlignment::doFlow(string time)
             }
         }
 
-        if (AlgROI)
+        if (AlgROI && !roi_direct_sampling)         // with ROIDirectSampling alg_roi.jpg is kept in alignedROIJPG
         {
             ImageBasis->writeToMemoryAsJPG((ImageData*)AlgROI, 90);
         }
     #endif
 
+    int raw_width = ImageBasis->width;
+    int raw_height = ImageBasis->height;
+    int target_width = initialflip ? raw_height : raw_width;
+    int target_height = initialflip ? raw_width : raw_height;
+
+    /* Mirror, initial rotation and alignment are collected in one transformation (target pixel -> raw pixel),
+     * the raw image is only resampled where an intermediate result is needed for the template search */
+    transform = AffineTransform();
+    AffineTransform initial;
+    if (initialmirror)
+    {
+        ESP_LOGD(TAG, "do mirror");
+        initial = CRotateImage::MirrorTransform(raw_width);
+    }
+    if ((initalrotate != 0) || initialflip)
+        initial = initial.Compose(CRotateImage::RotateTransform(initalrotate, raw_width / 2, raw_height / 2, initialflip, raw_width, raw_height));
+
     if (!ImageTMP) 
     {
-        ImageTMP = new CImageBasis(ImageBasis);
-        if (!ImageTMP) 
+        ImageTMP = new CImageBasis(target_width, target_height, ImageBasis->channels);
+        if (!ImageTMP || !ImageTMP->ImageOkay()) 
         {
             LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't allocate ImageTMP -> Exec this round aborted!");
             LogFile.WriteHeapInfo("ClassFlowAlignment-doFlow");
+            delete ImageTMP;
+            ImageTMP = NULL;
             return false;
         }
     }
 
-    delete AlignAndCutImage;
-    AlignAndCutImage = new CAlignAndCutImage(ImageBasis, ImageTMP);
-    if (!AlignAndCutImage) 
+    CRotateImage rt(ImageBasis, ImageTMP);
+    bool rendered = false;              // ImageTMP contains ImageBasis rendered with "initial"
+
+    if (!initial.isIdentity())
     {
-        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't allocate AlignAndCutImage -> Exec this round aborted!");
-        LogFile.WriteHeapInfo("ClassFlowAlignment-doFlow");
-        return false;
+        rt.Warp(initial, use_antialiasing, ImageTMP);
+        rendered = true;
+
+        if (SaveAllFiles)
+            ImageTMP->SaveToFile(FormatFileName("/sdcard/img_tmp/rot.jpg"));
     }
 
-    CRotateImage rt(AlignAndCutImage, ImageTMP, initialflip);
-    if (initialflip)
+    delete AlignAndCutImage;
+    AlignAndCutImage = NULL;
+
+    AffineTransform alignment;
+
+    //no align algo if set to 3 = off //add disable aligment algo |01.2023
+    if(References[0].alignment_algo != 3){
+        int dx, dy;
+        float d_winkel;
+        CAlignAndCutImage search(rendered ? ImageTMP : ImageBasis, NULL);
+
+        if (!search.FindAlignment(&References[0], &References[1], dx, dy, d_winkel)) 
+        {
+            SaveReferenceAlignmentValues();
+        }
+
+        alignment = CRotateImage::TranslateTransform(dx, dy).Compose(CRotateImage::RotateTransform(d_winkel, References[0].target_x, References[0].target_y));
+    }// no align
+
+    if (roi_direct_sampling)
     {
-        int _zw = ImageBasis->height;
-        ImageBasis->height = ImageBasis->width;
-        ImageBasis->width = _zw;
+        // ImageBasis stays the raw image, the ROIs are sampled directly from it
+        transform = initial.Compose(alignment);
+    }
+    else if (!initial.Compose(alignment).isIdentity())
+    {
+        if (!rendered || !alignment.isIdentity())
+            rt.Warp(initial.Compose(alignment), use_antialiasing, ImageTMP);
 
-        _zw = ImageTMP->width;
-        ImageTMP->width = ImageTMP->height;
-        ImageTMP->height = _zw;
+        ImageBasis->width = target_width;
+        ImageBasis->height = target_height;
+        ImageBasis->CopyFromMemory(ImageTMP->rgb_image, target_width * target_height * ImageBasis->channels);
     }
 
-    if (initialmirror)
+    AlignAndCutImage = new CAlignAndCutImage(ImageBasis, ImageTMP);
+    if (!AlignAndCutImage) 
     {
-        ESP_LOGD(TAG, "do mirror");
-        rt.Mirror();
-        
-        if (SaveAllFiles)
-            AlignAndCutImage->SaveToFile(FormatFileName("/sdcard/img_tmp/mirror.jpg"));
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't allocate AlignAndCutImage -> Exec this round aborted!");
+        LogFile.WriteHeapInfo("ClassFlowAlignment-doFlow");
+        return false;
     }
- 
-    if ((initalrotate != 0) || initialflip)
+
+    if (roi_direct_sampling)
     {
-        if (use_antialiasing)
-            rt.RotateAntiAliasing(initalrotate);
+        // The aligned image is only needed for the web interface. It is rendered once per round here on the
+        // flow task (the raw image is not protected against the next round), the web server sends the JPGs.
+        xSemaphoreTake(alignedJPGMutex, portMAX_DELAY);
+        alignedJPG = NULL;              // memory for the new ones, requests still sending them keep their reference
+        alignedROIJPG = NULL;
+        xSemaphoreGive(alignedJPGMutex);
+
+        if (transform.isIdentity())
+            ImageTMP->CopyFromMemory(ImageBasis->rgb_image, target_width * target_height * ImageBasis->channels);
         else
-            rt.Rotate(initalrotate);
-        
-        if (SaveAllFiles)
-            AlignAndCutImage->SaveToFile(FormatFileName("/sdcard/img_tmp/rot.jpg"));
-    }
+            rt.Warp(transform, use_antialiasing, ImageTMP);
 
+        std::shared_ptr<CachedJPG> alg = EncodeJPG(ImageTMP);
+        if (SaveAllFiles)
+            ImageTMP->SaveToFile(FormatFileName("/sdcard/img_tmp/alg.jpg"));
 
-        //no align algo if set to 3 = off //add disable aligment algo |01.2023
+        //no align algo if set to 3 = off => no draw ref //add disable aligment algo |01.2023
         if(References[0].alignment_algo != 3){
-            if (!AlignAndCutImage->Align(&References[0], &References[1])) 
-            {
-                SaveReferenceAlignmentValues();
-            }
-        }// no align
+            DrawRef(ImageTMP);
+        }
+        tfliteflow.DigitalDrawROI(ImageTMP);
+        tfliteflow.AnalogDrawROI(ImageTMP);
 
+        std::shared_ptr<CachedJPG> algROI = EncodeJPG(ImageTMP);
+        if (SaveAllFiles)
+            ImageTMP->SaveToFile(FormatFileName("/sdcard/img_tmp/alg_roi.jpg"));
 
-    #ifdef ALGROI_LOAD_FROM_MEM_AS_JPG
-        if (AlgROI) {
-            //no align algo if set to 3 = off => no draw ref //add disable aligment algo |01.2023
-            if(References[0].alignment_algo != 3){
-                DrawRef(ImageTMP);
+        xSemaphoreTake(alignedJPGMutex, portMAX_DELAY);
+        alignedJPG = alg;
+        alignedROIJPG = algROI;
+        xSemaphoreGive(alignedJPGMutex);
+    }
+    else
+    {
+        ImageTMP->CopyFromMemory(ImageBasis->rgb_image, target_width * target_height * ImageBasis->channels);
+
+        #ifdef ALGROI_LOAD_FROM_MEM_AS_JPG
+            if (AlgROI) {
+                //no align algo if set to 3 = off => no draw ref //add disable aligment algo |01.2023
+                if(References[0].alignment_algo != 3){
+                    DrawRef(ImageTMP);
+                }
+                tfliteflow.DigitalDrawROI(ImageTMP);
+                tfliteflow.AnalogDrawROI(ImageTMP);
+                ImageTMP->writeToMemoryAsJPG((ImageData*)AlgROI, 90);
             }
-            tfliteflow.DigitalDrawROI(ImageTMP);
-            tfliteflow.AnalogDrawROI(ImageTMP);
-            ImageTMP->writeToMemoryAsJPG((ImageData*)AlgROI, 90);
+        #endif
+        
+        if (SaveAllFiles)
+        {
+            AlignAndCutImage->SaveToFile(FormatFileName("/sdcard/img_tmp/alg.jpg"));
+            ImageTMP->SaveToFile(FormatFileName("/sdcard/img_tmp/alg_roi.jpg"));
         }
-    #endif
-    
-    if (SaveAllFiles)
-    {
-        AlignAndCutImage->SaveToFile(FormatFileName("/sdcard/img_tmp/alg.jpg"));
-        ImageTMP->SaveToFile(FormatFileName("/sdcard/img_tmp/alg_roi.jpg"));
     }
 
     // must be deleted to have memory space for loading tflite
@@ -280,6 +363,17 @@ bool ClassFlowAlignment::doFlow(string time)
 }
 
 
+/* alg.jpg (_withROI: alg_roi.jpg) of the last round, only rendered with ROIDirectSampling. NULL if not available */
+std::shared_ptr<CachedJPG> ClassFlowAlignment::GetAlignedJPG(bool _withROI)
+{
+    xSemaphoreTake(alignedJPGMutex, portMAX_DELAY);
+    std::shared_ptr<CachedJPG> jpg = _withROI ? alignedROIJPG : alignedJPG;
+    xSemaphoreGive(alignedJPGMutex);
+
+    return jpg;
+}
+
+
 void ClassFlowAlignment::SaveReferenceAlignmentValues()
 {
     FILE* pFile;
@@ -6,9 +6,12 @@
 #include "ClassFlow.h"
 #include "Helper.h"
 #include "CAlignAndCutImage.h"
+#include "CRotateImage.h"
 #include "CFindTemplate.h"
+#include "FlowImageCache.h"
 
 #include <string>
+#include <memory>
 
 using namespace std;
 
@@ -27,6 +30,10 @@ protected:
     CAlignAndCutImage *AlignAndCutImage;
     std::string FileStoreRefAlignment;
     float SAD_criteria;
+    bool roi_direct_sampling;
+    AffineTransform transform;          // aligned image -> raw image, with ROIDirectSampling the ROIs are sampled with it
+    std::shared_ptr<CachedJPG> alignedJPG, alignedROIJPG;      // with ROIDirectSampling: alg.jpg and alg_roi.jpg of the last round
+    SemaphoreHandle_t alignedJPGMutex;
 
     void SetInitialParameter(void);
     bool LoadReferenceAlignmentValues(void);
@@ -41,6 +48,9 @@ public:
     ClassFlowAlignment(std::vector<ClassFlow*>* lfc);
 
     CAlignAndCutImage* GetAlignAndCutImage(){return AlignAndCutImage;};
+    bool ROIDirectSampling(){return roi_direct_sampling;};
+    AffineTransform GetTransform(){return transform;};
+    std::shared_ptr<CachedJPG> GetAlignedJPG(bool _withROI);
 
     void DrawRef(CImageBasis *_zw);
 
@@ -4,6 +4,8 @@
 #include <iomanip> 
 #include <sys/types.h>
 #include <sstream>      // std::stringstream
+#include <sys/stat.h>
+#include <algorithm>
 
 #include "CTfLiteClass.h"
 #include "ClassLogFile.h"
@@ -26,6 +28,7 @@ ClassFlowCNNGeneral::ClassFlowCNNGeneral(ClassFlowAlignment *_flowalign, t_CNNTy
     modelxsize = 1;
     modelysize = 1;
     CNNGoodThreshold = 0.0;
+    arenaMargin = TFLITE_ARENA_MARGIN;
     ListFlowControll = NULL;
     previousElement = NULL;   
     SaveAllFiles = false; 
@@ -35,6 +38,17 @@ ClassFlowCNNGeneral::ClassFlowCNNGeneral(ClassFlowAlignment *_flowalign, t_CNNTy
     CNNType = _cnntype;
     flowpostalignment = _flowalign;
     logfileRetentionInDays = 5;
+    tflite = NULL;
+    tflitefileLoaded = "";
+    tflitefileMTime = 0;
+    roiJPGRequested = false;
+    roiJPGMutex = xSemaphoreCreateMutex();
+}
+
+
+ClassFlowCNNGeneral::~ClassFlowCNNGeneral()
+{
+    delete tflite;
 }
 
 
@@ -51,17 +65,35 @@ string ClassFlowCNNGeneral::getReadout(int _analog = 0, bool _extendedResolution
         float number = GENERAL[_analog]->ROI[GENERAL[_analog]->ROI.size() - 1]->result_float;
         int result_after_decimal_point = ((int) floor(number * 10) + 10) % 10;
         
-        prev = PointerEvalAnalogNew(GENERAL[_analog]->ROI[GENERAL[_analog]->ROI.size() - 1]->result_float, prev);
-//        LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "getReadout(analog) number=" + std::to_string(number) + ", result_after_decimal_point=" + std::to_string(result_after_decimal_point) + ", prev=" + std::to_string(prev));
-        result = std::to_string(prev);
+        if (number >= 0)       // NaN? (ROI could not be evaluated)
+        {
+            prev = PointerEvalAnalogNew(GENERAL[_analog]->ROI[GENERAL[_analog]->ROI.size() - 1]->result_float, prev);
+//            LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "getReadout(analog) number=" + std::to_string(number) + ", result_after_decimal_point=" + std::to_string(result_after_decimal_point) + ", prev=" + std::to_string(prev));
+            result = std::to_string(prev);
 
-        if (_extendedResolution && (CNNType != Digital))
-            result = result + std::to_string(result_after_decimal_point);
+            if (_extendedResolution && (CNNType != Digital))
+                result = result + std::to_string(result_after_decimal_point);
+        }
+        else
+        {
+            prev = -1;
+            result = "N";
+            if (_extendedResolution && (CNNType != Digital))
+                result = "NN";
+        }
 
         for (int i = GENERAL[_analog]->ROI.size() - 2; i >= 0; --i)
         {
-            prev = PointerEvalAnalogNew(GENERAL[_analog]->ROI[i]->result_float, prev);
-            result = std::to_string(prev) + result;
+            if (GENERAL[_analog]->ROI[i]->result_float >= 0)
+            {
+                prev = PointerEvalAnalogNew(GENERAL[_analog]->ROI[i]->result_float, prev);
+                result = std::to_string(prev) + result;
+            }
+            else
+            {
+                prev = -1;
+                result = "N" + result;
+            }
         }
         return result;
     }
@@ -349,6 +381,13 @@ bool ClassFlowCNNGeneral::ReadParameter(FILE* pfile, string& aktparamgraph)
         {
             CNNGoodThreshold = std::stof(splitted[1]);
         }
+
+        if ((toUpper(splitted[0]) == "TENSORARENAMARGIN") && (splitted.size() > 1))
+        {
+            int margin = std::stoi(splitted[1]);       // kB
+            if (margin >= 0)
+                arenaMargin = margin * 1024;
+        }
         if (splitted.size() >= 5)
         {
             general* _analog = GetGENERAL(splitted[0], true);
@@ -502,36 +541,88 @@ bool ClassFlowCNNGeneral::doAlignAndCut(string time)
     if (disabled)
         return true;
 
-    CAlignAndCutImage *caic = flowpostalignment->GetAlignAndCutImage();    
+    // The network input is sampled directly from the image (see doNeuralNetwork), the ROI images are only cut
+    // for the image log, SaveAllFiles and the web interface (if an ROI image was requested since the last round).
+    // This is done here on the flow task, as the image of the alignment is not protected against the next round.
+    xSemaphoreTake(roiJPGMutex, portMAX_DELAY);
+    bool renderJPG = roiJPGRequested;
+    roiJPGRequested = false;
+    roiJPG.clear();                     // requests still sending a JPG keep their reference
+    xSemaphoreGive(roiJPGMutex);
+
+    if (!isLogImage && !SaveAllFiles && !renderJPG)
+        return true;
+
+    std::map<std::string, std::shared_ptr<CachedJPG>> jpgs;
 
     for (int _ana = 0; _ana < GENERAL.size(); ++_ana)
         for (int i = 0; i < GENERAL[_ana]->ROI.size(); ++i)
         {
             ESP_LOGD(TAG, "General %d - Align&Cut", i);
-            
-            caic->CutAndSave(GENERAL[_ana]->ROI[i]->posx, GENERAL[_ana]->ROI[i]->posy, GENERAL[_ana]->ROI[i]->deltax, GENERAL[_ana]->ROI[i]->deltay, GENERAL[_ana]->ROI[i]->image_org);
+            CutROIImages(GENERAL[_ana]->ROI[i], SaveAllFiles);
+            string filename = ROIFileName(GENERAL[_ana], GENERAL[_ana]->ROI[i]);
+
             if (SaveAllFiles)
             {
-                if (GENERAL[_ana]->name == "default")
-                    GENERAL[_ana]->ROI[i]->image_org->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
-                else
-                    GENERAL[_ana]->ROI[i]->image_org->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->name + "_" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
+                GENERAL[_ana]->ROI[i]->image_org->SaveToFile(FormatFileName("/sdcard/img_tmp/" + filename));
+                GENERAL[_ana]->ROI[i]->image->SaveToFile(FormatFileName("/sdcard/img_tmp/" + filename));
             } 
 
-            GENERAL[_ana]->ROI[i]->image_org->Resize(modelxsize, modelysize, GENERAL[_ana]->ROI[i]->image);
-            if (SaveAllFiles)
+            if (renderJPG)
             {
-                if (GENERAL[_ana]->name == "default")
-                    GENERAL[_ana]->ROI[i]->image->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
+                size_t size = 0;
+                uint8_t* jpg = GENERAL[_ana]->ROI[i]->image_org->writeToBufferAsJPG(size);
+
+                if (jpg)
+                    jpgs[filename] = std::shared_ptr<CachedJPG>(new CachedJPG(jpg, size));
                 else
-                    GENERAL[_ana]->ROI[i]->image->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->name + "_" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
-            } 
+                    LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Not enough memory to encode " + filename);
+            }
         }
 
+    if (renderJPG)
+    {
+        xSemaphoreTake(roiJPGMutex, portMAX_DELAY);
+        roiJPG = jpgs;
+        xSemaphoreGive(roiJPGMutex);
+    }
+
     return true;
 } 
 
 
+/* Transformation from a _width x _height image of the ROI onto the image of the alignment
+ * (with ROIDirectSampling this is the raw image) */
+AffineTransform ClassFlowCNNGeneral::GetROITransform(roi *_roi, int _width, int _height)
+{
+    float scale_x = (float) _roi->deltax / _width;
+    float scale_y = (float) _roi->deltay / _height;
+
+    return flowpostalignment->GetTransform().Compose(CRotateImage::CropTransform(_roi->posx, _roi->posy, scale_x, scale_y));
+}
+
+
+/* Cuts image_org of the ROI (_withImage: also image, the ROI in the size of the model) */
+void ClassFlowCNNGeneral::CutROIImages(roi *_roi, bool _withImage)
+{
+    CRotateImage rt(flowpostalignment->ImageBasis, NULL);
+
+    rt.Warp(GetROITransform(_roi, _roi->image_org->width, _roi->image_org->height), true, _roi->image_org);
+    if (_withImage)
+        rt.Warp(GetROITransform(_roi, _roi->image->width, _roi->image->height), true, _roi->image);
+}
+
+
+/* Name of the ROI image in /img_tmp */
+string ClassFlowCNNGeneral::ROIFileName(general *_general, roi *_roi)
+{
+    if (_general->name == "default")
+        return _roi->name + ".jpg";
+
+    return _general->name + "_" + _roi->name + ".jpg";
+}
+
+
 void ClassFlowCNNGeneral::DrawROI(CImageBasis *_zw)
 {
     if (_zw->ImageOkay()) 
@@ -561,26 +652,60 @@ void ClassFlowCNNGeneral::DrawROI(CImageBasis *_zw)
 } 
 
 
-bool ClassFlowCNNGeneral::getNetworkParameter()
+bool ClassFlowCNNGeneral::loadNetwork()
 {
-    if (disabled)
-        return true;
-
-    CTfLiteClass *tflite = new CTfLiteClass;  
     string zwcnn = "/sdcard" + cnnmodelfile;
     zwcnn = FormatFileName(zwcnn);
+
+    struct stat stat_buf;
+    if (stat(zwcnn.c_str(), &stat_buf) != 0) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Model file " + zwcnn + " does not exist!");
+        return false;
+    }
+
+    if (tflite && (zwcnn == tflitefileLoaded) && (stat_buf.st_mtime == tflitefileMTime))
+        return true;            // resident model is still up to date -> reuse interpreter and tensor arena
+
+    if (tflite) {
+        LogFile.WriteToFile(ESP_LOG_INFO, TAG, "Model file " + zwcnn + " changed -> reload model");
+        delete tflite;
+        tflite = NULL;
+    }
+    tflitefileLoaded = "";
+
     ESP_LOGD(TAG, "%s", zwcnn.c_str());
+    tflite = new CTfLiteClass;
+
     if (!tflite->LoadModel(zwcnn)) {
-        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't load tflite model " + cnnmodelfile + " -> Init aborted!");
-        LogFile.WriteHeapInfo("getNetworkParameter-LoadModel");
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't load tflite model " + cnnmodelfile);
+        LogFile.WriteHeapInfo("loadNetwork-LoadModel");
         delete tflite;
+        tflite = NULL;
         return false;
     } 
 
-    if (!tflite->MakeAllocate()) {
-        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't allocate tflite model -> Init aborted!");
-        LogFile.WriteHeapInfo("getNetworkParameter-MakeAllocate");
+    if (!tflite->MakeAllocate(arenaMargin)) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't allocate tflite model " + cnnmodelfile);
+        LogFile.WriteHeapInfo("loadNetwork-MakeAllocate");
         delete tflite;
+        tflite = NULL;
+        return false;
+    }
+
+    tflitefileLoaded = zwcnn;
+    tflitefileMTime = stat_buf.st_mtime;
+
+    return true;
+}
+
+
+bool ClassFlowCNNGeneral::getNetworkParameter()
+{
+    if (disabled)
+        return true;
+
+    if (!loadNetwork()) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't load tflite model " + cnnmodelfile + " -> Init aborted!");
         return false;
     }
 
@@ -629,7 +754,6 @@ bool ClassFlowCNNGeneral::getNetworkParameter()
         }
     }
 
-    delete tflite;
     return true;
 }
 
@@ -641,24 +765,14 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time)
 
     string logPath = CreateLogFolder(time);
 
-    CTfLiteClass *tflite = new CTfLiteClass;  
-    string zwcnn = "/sdcard" + cnnmodelfile;
-    zwcnn = FormatFileName(zwcnn);
-    ESP_LOGD(TAG, "%s", zwcnn.c_str());
-
-    if (!tflite->LoadModel(zwcnn)) {
+    if (!loadNetwork()) {
         LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't load tflite model " + cnnmodelfile + " -> Exec aborted this round!");
-        LogFile.WriteHeapInfo("doNeuralNetwork-LoadModel");
-        delete tflite;
         return false;
     }
 
-    if (!tflite->MakeAllocate()) {
-        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't allocate tfilte model -> Exec aborted this round!");
-        LogFile.WriteHeapInfo("doNeuralNetwork-MakeAllocate");
-        delete tflite;
-        return false;
-    }
+    // Models with a batch dimension > 1 process several ROIs of a number with one Invoke(), batch size 1 is the ROI by ROI evaluation
+    int batchsize = tflite->GetBatchSize();
+    std::vector<bool> inputLoaded(batchsize, false);     // ROI of the slot is in the input tensor
 
     for (int n = 0; n < GENERAL.size(); ++n) // For each NUMBER
     {
@@ -668,6 +782,35 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time)
             LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "ROI #" + std::to_string(roi) + " - TfLite");
             //ESP_LOGD(TAG, "General %d - TfLite", i);
 
+            int slot = roi % batchsize;         // position of the ROI in the batch
+            if (slot == 0)
+            {
+                int anz = std::min(batchsize, (int) GENERAL[n]->ROI.size() - roi);
+                int loaded = 0;
+                for (int k = 0; k < anz; ++k)
+                {
+                    inputLoaded[k] = tflite->LoadInputImageBasis(flowpostalignment->ImageBasis, GetROITransform(GENERAL[n]->ROI[roi + k], modelxsize, modelysize), k);
+                    if (inputLoaded[k])
+                        loaded++;
+                    else
+                        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't load ROI " + GENERAL[n]->name + "_" + GENERAL[n]->ROI[roi + k]->name + " into the input tensor -> ROI is invalid this round");
+                }
+
+                if (loaded > 0)
+                {
+                    tflite->Invoke();
+                    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "After Invoke (" + std::to_string(loaded) + " ROIs)");
+                }
+            }
+
+            if (!inputLoaded[slot])     // no valid input -> "N" (same as a NaN result)
+            {
+                GENERAL[n]->ROI[roi]->result_float = -1;
+                GENERAL[n]->ROI[roi]->result_klasse = 10;
+                GENERAL[n]->ROI[roi]->isReject = true;
+                continue;
+            }
+
             switch (CNNType) {
                 case Analogue:
                     LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "CNN Type: Analogue");
@@ -675,12 +818,8 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time)
                         float f1, f2;
                         f1 = 0; f2 = 0;
 
-                        tflite->LoadInputImageBasis(GENERAL[n]->ROI[roi]->image);        
-                        tflite->Invoke();
-                        LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "After Invoke");
-
-                        f1 = tflite->GetOutputValue(0);
-                        f2 = tflite->GetOutputValue(1);
+                        f1 = tflite->GetOutputValue(0, slot);
+                        f2 = tflite->GetOutputValue(1, slot);
                         float result = fmod(atan2(f1, f2) / (M_PI * 2) + 2, 1);
                               
                         if(GENERAL[n]->ROI[roi]->CCW)
@@ -697,7 +836,7 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time)
                     LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "CNN Type: Digital");
                     {
                         GENERAL[n]->ROI[roi]->result_klasse = 0;
-                        GENERAL[n]->ROI[roi]->result_klasse = tflite->GetClassFromImageBasis(GENERAL[n]->ROI[roi]->image);
+                        GENERAL[n]->ROI[roi]->result_klasse = tflite->GetOutClassification(-1, -1, slot);
                         ESP_LOGD(TAG, "General result (Digit)%i: %d", roi, GENERAL[n]->ROI[roi]->result_klasse);
 
                         if (isLogImage)
@@ -724,17 +863,13 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time)
                         float _fit;
                         float _result_save_file;
 
-                        tflite->LoadInputImageBasis(GENERAL[n]->ROI[roi]->image);        
-                        tflite->Invoke();
-                        LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "After Invoke");
-
-                        _num = tflite->GetOutClassification(0, 9);
+                        _num = tflite->GetOutClassification(0, 9, slot);
                         _numplus = (_num + 1) % 10;
                         _numminus = (_num - 1 + 10) % 10;
 
-                        _val = tflite->GetOutputValue(_num);
-                        _valplus = tflite->GetOutputValue(_numplus);
-                        _valminus = tflite->GetOutputValue(_numminus);
+                        _val = tflite->GetOutputValue(_num, slot);
+                        _valplus = tflite->GetOutputValue(_numplus, slot);
+                        _valminus = tflite->GetOutputValue(_numminus, slot);
 
                         float result = _num;
 
@@ -801,10 +936,7 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time)
                         int _num;
                         float _result_save_file;
                         
-                        tflite->LoadInputImageBasis(GENERAL[n]->ROI[roi]->image);        
-                        tflite->Invoke();
-    
-                        _num = tflite->GetOutClassification();
+                        _num = tflite->GetOutClassification(-1, -1, slot);
                         
                         if(GENERAL[n]->ROI[roi]->CCW)
                             GENERAL[n]->ROI[roi]->result_float = 10 - ((float)_num / 10.0);                              
@@ -840,8 +972,6 @@ bool ClassFlowCNNGeneral::doNeuralNetwork(string time)
         }
     }
 
-    delete tflite;
-
     return true;
 }
 
@@ -862,33 +992,14 @@ std::vector<HTMLInfo*> ClassFlowCNNGeneral::GetHTMLInfo()
     for (int _ana = 0; _ana < GENERAL.size(); ++_ana)
         for (int i = 0; i < GENERAL[_ana]->ROI.size(); ++i)
         {
-            ESP_LOGD(TAG, "Image: %d", (int) GENERAL[_ana]->ROI[i]->image);
-            if (GENERAL[_ana]->ROI[i]->image)
-            {
-                if (GENERAL[_ana]->name == "default")
-                    GENERAL[_ana]->ROI[i]->image->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
-                else
-                    GENERAL[_ana]->ROI[i]->image->SaveToFile(FormatFileName("/sdcard/img_tmp/" + GENERAL[_ana]->name + "_" + GENERAL[_ana]->ROI[i]->name + ".jpg"));
-            }
-
             HTMLInfo *zw = new HTMLInfo;
-            if (GENERAL[_ana]->name == "default")
-            {
-                zw->filename = GENERAL[_ana]->ROI[i]->name + ".jpg";
-                zw->filename_org = GENERAL[_ana]->ROI[i]->name + ".jpg";
-            }
-            else
-            {
-                zw->filename = GENERAL[_ana]->name + "_" + GENERAL[_ana]->ROI[i]->name + ".jpg";
-                zw->filename_org = GENERAL[_ana]->name + "_" + GENERAL[_ana]->ROI[i]->name + ".jpg";
-            }
+            zw->filename = ROIFileName(GENERAL[_ana], GENERAL[_ana]->ROI[i]);
+            zw->filename_org = zw->filename;
 
             if (CNNType == Digital)
                 zw->val = GENERAL[_ana]->ROI[i]->result_klasse;
             else
                 zw->val = GENERAL[_ana]->ROI[i]->result_float;
-            zw->image = GENERAL[_ana]->ROI[i]->image;
-            zw->image_org = GENERAL[_ana]->ROI[i]->image_org;
 
             result.push_back(zw);
         }
@@ -897,6 +1008,31 @@ std::vector<HTMLInfo*> ClassFlowCNNGeneral::GetHTMLInfo()
 }
 
 
+/* ROI image (image_org) of the last round for the web interface. _isROI: _fn is an ROI image of this flow.
+ * NULL if it was not rendered in the last round, the request makes the next round render the ROI images */
+std::shared_ptr<CachedJPG> ClassFlowCNNGeneral::GetROIJPG(std::string _fn, bool &_isROI)
+{
+    _isROI = false;
+
+    for (int _ana = 0; _ana < GENERAL.size() && !_isROI; ++_ana)
+        for (int i = 0; i < GENERAL[_ana]->ROI.size() && !_isROI; ++i)
+            _isROI = (ROIFileName(GENERAL[_ana], GENERAL[_ana]->ROI[i]) == _fn);
+
+    if (!_isROI)
+        return NULL;
+
+    xSemaphoreTake(roiJPGMutex, portMAX_DELAY);
+    roiJPGRequested = true;
+    std::shared_ptr<CachedJPG> jpg;
+    std::map<std::string, std::shared_ptr<CachedJPG>>::iterator it = roiJPG.find(_fn);
+    if (it != roiJPG.end())
+        jpg = it->second;
+    xSemaphoreGive(roiJPGMutex);
+
+    return jpg;
+}
+
+
 int ClassFlowCNNGeneral::getNumberGENERAL()
 {
     return GENERAL.size();
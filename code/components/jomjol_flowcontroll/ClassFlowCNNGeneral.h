@@ -5,7 +5,12 @@
 
 #include"ClassFlowDefineTypes.h"
 #include "ClassFlowAlignment.h"
+#include "FlowImageCache.h"
 
+#include <map>
+#include <memory>
+
+class CTfLiteClass;
 
 enum t_CNNType {
     AutoDetect,
@@ -25,6 +30,7 @@ protected:
     t_CNNType CNNType;
     std::vector<general*> GENERAL;
     float CNNGoodThreshold;
+    int arenaMargin;                    // bytes on top of the measured tensor arena usage
 
 	//moved to define.h
     //float Analog_error = 3.0;
@@ -36,6 +42,9 @@ protected:
     //float Digital_Transition_Area_Forward = 9.7; // Pre-run zero crossing only happens from approx. 9.7 onwards
 
     string cnnmodelfile;
+    CTfLiteClass *tflite;               // model and interpreter stay resident between the rounds
+    string tflitefileLoaded;            // file and mtime of the resident model, used to detect changes
+    time_t tflitefileMTime;
     int modelxsize, modelysize, modelchannel;
     bool isLogImageSelect;
     string LogImageSelect;
@@ -43,6 +52,10 @@ protected:
 
     bool SaveAllFiles;   
 
+    std::map<std::string, std::shared_ptr<CachedJPG>> roiJPG;     // ROI images of the last round for the web interface
+    bool roiJPGRequested;               // an ROI image was requested since the last round, roiJPG is rendered
+    SemaphoreHandle_t roiJPGMutex;
+
     int PointerEvalAnalogNew(float zahl, int numeral_preceder);
     int PointerEvalAnalogToDigitNew(float zahl, float numeral_preceder,  int eval_predecessors, float analogDigitalTransitionStart);
     int PointerEvalHybridNew(float zahl, float number_of_predecessors, int eval_predecessors, bool Analog_Predecessors = false, float analogDigitalTransitionStart=9.2);
@@ -51,11 +64,16 @@ protected:
 
     bool doNeuralNetwork(string time); 
     bool doAlignAndCut(string time);
+    AffineTransform GetROITransform(roi *_roi, int _width, int _height);
+    void CutROIImages(roi *_roi, bool _withImage);
+    string ROIFileName(general *_general, roi *_roi);
 
     bool getNetworkParameter();
+    bool loadNetwork();
 
 public:
     ClassFlowCNNGeneral(ClassFlowAlignment *_flowalign, t_CNNType _cnntype = AutoDetect);
+    ~ClassFlowCNNGeneral();
 
     bool ReadParameter(FILE* pfile, string& aktparamgraph);
     bool doFlow(string time);
@@ -68,6 +86,7 @@ public:
     void DrawROI(CImageBasis *_zw); 
 
    	std::vector<HTMLInfo*> GetHTMLInfo();   
+    std::shared_ptr<CachedJPG> GetROIJPG(std::string _fn, bool &_isROI);
 
     int getNumberGENERAL();
     general* GetGENERAL(int _analog);
@@ -4,6 +4,9 @@
 #include "read_wlanini.h"
 
 #include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_system.h"
 
 #include <sys/stat.h>
 
@@ -16,6 +19,7 @@ extern "C" {
 #endif
 
 #include "ClassLogFile.h"
+#include "ClassDataSeries.h"
 #include "time_sntp.h"
 #include "Helper.h"
 #include "server_ota.h"
@@ -25,6 +29,7 @@ extern "C" {
 #endif //ENABLE_MQTT
 
 #include "server_help.h"
+#include "FlowImageLogWriter.h"
 #include "../../include/defines.h"
 
 static const char* TAG = "CTRL";
@@ -265,6 +270,7 @@ ClassFlow* ClassFlowControll::CreateClassFlow(std::string _type)
 void ClassFlowControll::InitFlow(std::string config)
 {
     aktstatus = "Initialization";
+    imageCache.Invalidate();
     //#ifdef ENABLE_MQTT
         //MQTTPublish(mqttServer_getMainTopic() + "/" + "status", "Initialization", false); // Right now, not possible -> MQTT Service is going to be started later
     //#endif //ENABLE_MQTT
@@ -319,6 +325,7 @@ std::string* ClassFlowControll::getActStatus()
 void ClassFlowControll::setActStatus(std::string _aktstatus)
 {
     aktstatus = _aktstatus;
+    imageCache.Invalidate();
 }
 
 
@@ -332,6 +339,7 @@ void ClassFlowControll::doFlowMakeImageOnly(string time)
             zw_time = getCurrentTimeString("%H:%M:%S");
             std::string flowStatus = TranslateAktstatus(FlowControll[i]->name());
             aktstatus = flowStatus + " (" + zw_time + ")";
+            imageCache.Invalidate();
             #ifdef ENABLE_MQTT
                 MQTTPublish(mqttServer_getMainTopic() + "/" + "status", flowStatus, false);
             #endif //ENABLE_MQTT
@@ -342,11 +350,67 @@ void ClassFlowControll::doFlowMakeImageOnly(string time)
 }
 
 
+std::string ClassFlowControll::GetMetricsStepName(ClassFlow* _flow)
+{
+    if (_flow == flowdigit)
+        return "Digit";
+    if (_flow == flowanalog)
+        return "Analog";
+
+    std::string name = _flow->name();
+    if (name.find("ClassFlow") == 0)
+        name = name.substr(9);
+    return name;
+}
+
+
+/* Duration and heap metrics of the flow steps in Prometheus text format */
+string ClassFlowControll::getMetrics()
+{
+    std::string result = metrics.GetPrometheus();
+
+    result += "# HELP heap_free_bytes Free heap\n"
+              "# TYPE heap_free_bytes gauge\n";
+    result += "heap_free_bytes{type=\"internal\"} " + std::to_string(heap_caps_get_free_size(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL)) + "\n";
+    result += "heap_free_bytes{type=\"spiram\"} " + std::to_string(heap_caps_get_free_size(MALLOC_CAP_SPIRAM)) + "\n";
+    result += "# HELP heap_largest_free_block_bytes Largest free block of the heap\n"
+              "# TYPE heap_largest_free_block_bytes gauge\n";
+    result += "heap_largest_free_block_bytes{type=\"internal\"} " + std::to_string(heap_caps_get_largest_free_block(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL)) + "\n";
+    result += "heap_largest_free_block_bytes{type=\"spiram\"} " + std::to_string(heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM)) + "\n";
+    result += "# HELP heap_minimum_free_bytes Minimum free heap since start\n"
+              "# TYPE heap_minimum_free_bytes gauge\n";
+    result += "heap_minimum_free_bytes " + std::to_string(esp_get_minimum_free_heap_size()) + "\n";
+
+    result += "# HELP image_log_queue_depth Number of log images waiting for the writer task\n"
+              "# TYPE image_log_queue_depth gauge\n";
+    result += "image_log_queue_depth " + std::to_string(ImageLogWriter.GetQueueDepth()) + "\n";
+    result += "# HELP image_log_dropped_total Number of log images dropped because the writer queue was full\n"
+              "# TYPE image_log_dropped_total counter\n";
+    result += "image_log_dropped_total " + std::to_string(ImageLogWriter.GetDropped()) + "\n";
+    result += "# HELP image_log_direct_writes_total Number of log images written by the flow itself (no memory for the copy)\n"
+              "# TYPE image_log_direct_writes_total counter\n";
+    result += "image_log_direct_writes_total " + std::to_string(ImageLogWriter.GetDirectWrites()) + "\n";
+
+    #ifdef ENABLE_MQTT
+    result += "# HELP mqtt_queue_depth Number of messages waiting in the MQTT queue\n"
+              "# TYPE mqtt_queue_depth gauge\n";
+    result += "mqtt_queue_depth " + std::to_string(MQTTGetQueueDepth()) + "\n";
+    result += "# HELP mqtt_queue_dropped_total Number of messages lost because the MQTT queue was full\n"
+              "# TYPE mqtt_queue_dropped_total counter\n";
+    result += "mqtt_queue_dropped_total " + std::to_string(MQTTGetQueueDropped()) + "\n";
+    #endif //ENABLE_MQTT
+
+    return result;
+}
+
+
 bool ClassFlowControll::doFlow(string time)
 {
     bool result = true;
     std::string zw_time;
     int repeat = 0;
+    int64_t round_start = esp_timer_get_time();
+    size_t round_heap = esp_get_free_heap_size();
 
     #ifdef DEBUG_DETAIL_ON 
         LogFile.WriteHeapInfo("ClassFlowControll::doFlow - Start");
@@ -365,6 +429,7 @@ bool ClassFlowControll::doFlow(string time)
         zw_time = getCurrentTimeString("%H:%M:%S");
         std::string flowStatus = TranslateAktstatus(FlowControll[i]->name());
         aktstatus = flowStatus + " (" + zw_time + ")";
+        imageCache.Invalidate();        // the images change with every step
         //LogFile.WriteToFile(ESP_LOG_INFO, TAG, aktstatus);
         #ifdef ENABLE_MQTT
             MQTTPublish(mqttServer_getMainTopic() + "/" + "status", flowStatus, false);
@@ -375,7 +440,13 @@ bool ClassFlowControll::doFlow(string time)
             LogFile.WriteHeapInfo(zw);
         #endif
 
-        if (!FlowControll[i]->doFlow(time)){
+        int64_t step_start = esp_timer_get_time();
+        size_t step_heap = esp_get_free_heap_size();
+        bool step_ok = FlowControll[i]->doFlow(time);
+        metrics.AddMeasurement(GetMetricsStepName(FlowControll[i]), esp_timer_get_time() - step_start, 
+                                (int32_t) esp_get_free_heap_size() - (int32_t) step_heap, step_ok);
+
+        if (!step_ok){
             repeat++;
             LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Fehler im vorheriger Schritt - wird zum " + to_string(repeat) + ". Mal wiederholt");
             if (i) i -= 1;    // vPrevious step must be repeated (probably take pictures)
@@ -396,9 +467,12 @@ bool ClassFlowControll::doFlow(string time)
         #endif
     }
 
+    metrics.AddMeasurement("Round", esp_timer_get_time() - round_start, (int32_t) esp_get_free_heap_size() - (int32_t) round_heap, result);
+
     zw_time = getCurrentTimeString("%H:%M:%S");
     std::string flowStatus = "Flow finished";
     aktstatus = flowStatus + " (" + zw_time + ")";
+    imageCache.Invalidate();
     //LogFile.WriteToFile(ESP_LOG_INFO, TAG, aktstatus);
     #ifdef ENABLE_MQTT
         MQTTPublish(mqttServer_getMainTopic() + "/" + "status", flowStatus, false);
@@ -562,6 +636,16 @@ bool ClassFlowControll::ReadParameter(FILE* pfile, string& aktparamgraph)
             LogFile.SetDataLogRetention(std::stoi(splitted[1]));
         }
 
+        if ((toUpper(splitted[0]) == "DATALOGSYNCINTERVAL") && (splitted.size() > 1))
+        {
+            LogFile.SetDataLogSyncInterval(std::stoi(splitted[1]));
+        }
+
+        if ((toUpper(splitted[0]) == "DATASERIESRETENTIONINDAYS") && (splitted.size() > 1))
+        {
+            DataSeries.SetRetention(std::stoi(splitted[1]));
+        }
+
         if ((toUpper(splitted[0]) == "LOGFILE") && (splitted.size() > 1))
         {
             /* matches esp_log_level_t */
@@ -664,6 +748,18 @@ esp_err_t ClassFlowControll::SendRawJPG(httpd_req_t *req)
 }
 
 
+/* alg.jpg / alg_roi.jpg, rendered by the alignment once per round with ROIDirectSampling */
+static esp_err_t SendAlignedJPG(httpd_req_t *req, std::shared_ptr<CachedJPG> _jpg, std::string _fn)
+{
+    if (!_jpg) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "ClassFlowControll::GetJPGStream: " + _fn + " cannot be served (not rendered yet)");
+        return ESP_FAIL;
+    }
+
+    return httpd_resp_send(req, (const char *) _jpg->data, _jpg->size);
+}
+
+
 esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
 {
     ESP_LOGD(TAG, "ClassFlowControll::GetJPGStream %s", _fn.c_str());
@@ -676,7 +772,23 @@ esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
     esp_err_t result = ESP_FAIL;
     bool _sendDelete = false;
 
+    /* The images only change during a round, a browser polling them gets a 304 or the already encoded JPG */
+    std::string etag = imageCache.GetETag();
+    if (imageCache.CheckNotModified(req, etag))
+        return ESP_OK;
+
+    httpd_resp_set_hdr(req, "ETag", etag.c_str());
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    set_content_type_from_file(req, _fn.c_str());
+    if (imageCache.SendCached(_fn, req, result))
+        return result;
+
     if (_fn == "alg.jpg") {
+        if (flowalignment && flowalignment->ROIDirectSampling()) {
+            return SendAlignedJPG(req, flowalignment->GetAlignedJPG(false), _fn);
+        }
+
         if (flowalignment && flowalignment->ImageBasis->ImageOkay()) {
             _send = flowalignment->ImageBasis;
         }
@@ -778,6 +890,9 @@ esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
                     }
                 }
             }
+            else if (flowalignment && flowalignment->ROIDirectSampling()) {
+                return SendAlignedJPG(req, flowalignment->GetAlignedJPG(true), _fn);
+            }
             else {
                 if (flowalignment && flowalignment->AlgROI) {
                     httpd_resp_set_type(req, "image/jpeg");
@@ -801,6 +916,10 @@ esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
                 return ESP_FAIL;
             }
 
+            if (flowalignment->ROIDirectSampling()) {
+                return SendAlignedJPG(req, flowalignment->GetAlignedJPG(true), _fn);
+            }
+
             _send = new CImageBasis(flowalignment->ImageBasis);
 			
             if (_send->ImageOkay()) {
@@ -823,50 +942,23 @@ esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
         #endif
     }
     else {
-        std::vector<HTMLInfo*> htmlinfo;
-    
-        htmlinfo = GetAllDigital();
-        ESP_LOGD(TAG, "After getClassFlowControll::GetAllDigital");
-
-        for (int i = 0; i < htmlinfo.size(); ++i)
-        {
-            if (_fn == htmlinfo[i]->filename)
-            {
-                if (htmlinfo[i]->image)
-                    _send = htmlinfo[i]->image;
+        /* The ROI images are rendered by the flow, if one of them was requested since the last round */
+        bool isROI = false;
+        std::shared_ptr<CachedJPG> jpg;
+
+        if (flowdigit)
+            jpg = flowdigit->GetROIJPG(_fn, isROI);
+        if (!isROI && flowanalog)
+            jpg = flowanalog->GetROIJPG(_fn, isROI);
+
+        if (isROI) {
+            if (!jpg) {
+                httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "ROI image not rendered yet, available after the next round!");
+                return ESP_FAIL;
             }
 
-            if (_fn == htmlinfo[i]->filename_org)
-            {
-                if (htmlinfo[i]->image_org)
-                    _send = htmlinfo[i]->image_org;
-            }
-            delete htmlinfo[i];
+            return httpd_resp_send(req, (const char *) jpg->data, jpg->size);
         }
-        htmlinfo.clear();
-
-        if (!_send)
-        {
-	        htmlinfo = GetAllAnalog();
-	        ESP_LOGD(TAG, "After getClassFlowControll::GetAllAnalog");
-	        
-	        for (int i = 0; i < htmlinfo.size(); ++i)
-	        {
-	            if (_fn == htmlinfo[i]->filename)
-	            {
-	                if (htmlinfo[i]->image)
-	                    _send = htmlinfo[i]->image;
-	            }
-
-	            if (_fn == htmlinfo[i]->filename_org)
-	            {
-	                if (htmlinfo[i]->image_org)
-	                    _send = htmlinfo[i]->image_org;
-	            }
-	            delete htmlinfo[i];
-	        }
-	        htmlinfo.clear();
-    	}
     }
 
     #ifdef DEBUG_DETAIL_ON 
@@ -877,9 +969,7 @@ esp_err_t ClassFlowControll::GetJPGStream(std::string _fn, httpd_req_t *req)
     {
         ESP_LOGD(TAG, "Sending file: %s ...", _fn.c_str());
         set_content_type_from_file(req, _fn.c_str());
-        result = _send->SendJPGtoHTTP(req);
-        /* Respond with an empty chunk to signal HTTP response completion */
-        httpd_resp_send_chunk(req, NULL, 0);
+        result = imageCache.SendAndStore(_fn, _send, etag, req);
         ESP_LOGD(TAG, "File sending complete");
 
         if (_sendDelete)
@@ -18,6 +18,8 @@
 #endif //ENABLE_INFLUXDB
 #include "ClassFlowCNNGeneral.h"
 #include "ClassFlowWriteList.h"
+#include "FlowMetrics.h"
+#include "FlowImageCache.h"
 
 class ClassFlowControll :
     public ClassFlow
@@ -38,6 +40,9 @@ protected:
 	void SetInitialParameter(void);	
 	std::string aktstatus;
 	int aktRunNr;
+	FlowMetrics metrics;
+	FlowImageCache imageCache;
+	std::string GetMetricsStepName(ClassFlow* _flow);
 
 public:
 	void InitFlow(std::string config);
@@ -50,6 +55,7 @@ public:
 	string GetPrevalue(std::string _number = "");	
 	bool ReadParameter(FILE* pfile, string& aktparamgraph);	
 	string getJSON();
+	string getMetrics();
 	string getNumbersName();
 
 	string TranslateAktstatus(std::string _input);
@@ -14,6 +14,8 @@ extern "C" {
 #include "time_sntp.h"
 #include "ClassLogFile.h"
 #include "CImageBasis.h"
+#include "FlowImageLogWriter.h"
+#include "DirectoryIndex.h"
 #include "esp_log.h"
 #include "../../include/defines.h"
 
@@ -53,6 +55,10 @@ string ClassFlowImage::CreateLogFolder(string time) {
     if (!isLogImage) {
         LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't create log folder for analog images. Path " + logPath);
     }
+    else {
+        DirIndex.InvalidateFile(LogImageLocation + "/" + time.LOGFILE_TIME_FORMAT_DATE_EXTR);     // new folders in the file server
+        DirIndex.InvalidateFile(logPath);
+    }
 
 	return logPath;
 }
@@ -85,7 +91,7 @@ void ClassFlowImage::LogImage(string logPath, string name, float *resultFloat, i
 	string output = "/sdcard/img_tmp/" + name + ".jpg";
 	output = FormatFileName(output);
 	ESP_LOGD(logTag, "save to file: %s", nm.c_str());
-	_img->SaveToFile(nm);
+	ImageLogWriter.Enqueue(nm, _img);      // JPG encoding and SD write in the background
 //	CopyFile(output, nm);
 }
 
@@ -127,6 +133,7 @@ void ClassFlowImage::RemoveOldLogs()
 			//ESP_LOGD(TAG, "Compare %s to %s", entry->d_name, folderName.c_str());	
 			if ((strlen(entry->d_name) == folderName.length()) && (strcmp(entry->d_name, folderName.c_str()) < 0)) {
                 removeFolder(folderPath.c_str(), logTag);
+                DirIndex.InvalidateFile(folderPath);
                 deleted++;
 			} else {
                 notDeleted ++;
@@ -161,7 +161,18 @@ bool ClassFlowInfluxDB::doFlow(string zwtime)
 
             if (result.length() > 0 && resulttimestamp.length() > 0)   
                 InfluxDBPublish(namenumber, result, resulttimestamp);
+
+            NumberRollup* rollup = flowpostprocessing->GetRollup()->Get((*NUMBERS)[i]->name);
+            if ((rollup != NULL) && (resulttimestamp.length() > 0)) {
+                namenumber = (*NUMBERS)[i]->name;
+                namenumber = (namenumber == "default") ? "" : namenumber + "/";
+                InfluxDBPublish(namenumber + "consumption_hour", RundeOutput(rollup->current[RollupHour].consumption, (*NUMBERS)[i]->Nachkomma), resulttimestamp);
+                InfluxDBPublish(namenumber + "consumption_day", RundeOutput(rollup->current[RollupDay].consumption, (*NUMBERS)[i]->Nachkomma), resulttimestamp);
+                InfluxDBPublish(namenumber + "consumption_month", RundeOutput(rollup->current[RollupMonth].consumption, (*NUMBERS)[i]->Nachkomma), resulttimestamp);
+            }
         }
+
+        InfluxDBFlush();    // all values of the round with one POST
     }
    
     OldValue = result;
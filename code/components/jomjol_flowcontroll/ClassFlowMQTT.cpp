@@ -47,6 +47,9 @@ void ClassFlowMQTT::SetInitialParameter(void)
     ListFlowControll = NULL; 
     disabled = false;
     keepAlive = 25*60;
+    publishMaxAge = 0;
+    publishJSONOnly = false;
+    publishQueue = false;
 }       
 
 ClassFlowMQTT::ClassFlowMQTT()
@@ -120,6 +123,18 @@ bool ClassFlowMQTT::ReadParameter(FILE* pfile, string& aktparamgraph)
                 setMqtt_Server_Retain(SetRetainFlag);
             }
         }
+        if ((toUpper(splitted[0]) == "PUBLISHMAXAGE") && (splitted.size() > 1))
+        {
+            publishMaxAge = std::stoi(splitted[1]);
+        }
+        if ((toUpper(splitted[0]) == "PUBLISHJSONONLY") && (splitted.size() > 1))
+        {
+            publishJSONOnly = (toUpper(splitted[1]) == "TRUE");
+        }
+        if ((toUpper(splitted[0]) == "PUBLISHQUEUE") && (splitted.size() > 1))
+        {
+            publishQueue = (toUpper(splitted[1]) == "TRUE");
+        }
         if ((toUpper(splitted[0]) == "HOMEASSISTANTDISCOVERY") && (splitted.size() > 1))
         {
             if (toUpper(splitted[1]) == "TRUE")
@@ -195,6 +210,8 @@ bool ClassFlowMQTT::Start(float AutoIntervall)
     LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, stream.str());
 
     mqttServer_setParameter(flowpostprocessing->GetNumbers(), keepAlive, roundInterval);
+    MQTTsetPublishMaxAge(publishMaxAge);
+    mqttServer_setPublishJSONOnly(publishJSONOnly);
 
     bool MQTTConfigCheck = MQTT_Configure(uri, clientname, user, password, maintopic, LWT_TOPIC, LWT_CONNECTED,
                                      LWT_DISCONNECTED, keepAlive, SetRetainFlag, (void *)&GotConnected);
@@ -222,7 +239,7 @@ bool ClassFlowMQTT::doFlow(string zwtime)
 
     publishSystemData();
 
-    if (flowpostprocessing && getMQTTisConnected())
+    if (flowpostprocessing && (getMQTTisConnected() || publishQueue))
     {
         std::vector<NumberPost*>* NUMBERS = flowpostprocessing->GetNumbers();
 
@@ -245,14 +262,28 @@ bool ClassFlowMQTT::doFlow(string zwtime)
                 namenumber = maintopic + "/" + namenumber + "/";
 
 
+            std::string json = flowpostprocessing->getJsonFromNumber(i, "\n");
+            if (publishQueue) {     // the json topic contains the timestamp, so it is kept for a later publish
+                MQTTPublishQueued(namenumber + "json", json, SetRetainFlag);
+            }
+            else {
+                MQTTPublishCached(namenumber + "json", json, SetRetainFlag);
+            }
+
+            if (!getMQTTisConnected())
+                continue;
+
+            if (publishJSONOnly)    // all values of the number are bundled in the json topic
+                continue;
+
             if (result.length() > 0)   
-                MQTTPublish(namenumber + "value", result, SetRetainFlag);
+                MQTTPublishCached(namenumber + "value", result, SetRetainFlag);
 
             if (resulterror.length() > 0)  
-                MQTTPublish(namenumber + "error", resulterror, SetRetainFlag);
+                MQTTPublishCached(namenumber + "error", resulterror, SetRetainFlag);
 
             if (resultrate.length() > 0) {
-                MQTTPublish(namenumber + "rate", resultrate, SetRetainFlag);
+                MQTTPublishCached(namenumber + "rate", resultrate, SetRetainFlag);
                 
                 std::string resultRatePerTimeUnit;
                 if (getTimeUnit() == "h") { // Need conversion to be per hour
@@ -261,22 +292,26 @@ bool ClassFlowMQTT::doFlow(string zwtime)
                 else { // Keep per minute
                     resultRatePerTimeUnit = resultrate;
                 }
-                MQTTPublish(namenumber + "rate_per_time_unit", resultRatePerTimeUnit, SetRetainFlag);
+                MQTTPublishCached(namenumber + "rate_per_time_unit", resultRatePerTimeUnit, SetRetainFlag);
             }
 
             if (resultchangabs.length() > 0) {
-                MQTTPublish(namenumber + "changeabsolut", resultchangabs, SetRetainFlag); // Legacy API
-                MQTTPublish(namenumber + "rate_per_digitalization_round", resultchangabs, SetRetainFlag);
+                MQTTPublishCached(namenumber + "changeabsolut", resultchangabs, SetRetainFlag); // Legacy API
+                MQTTPublishCached(namenumber + "rate_per_digitalization_round", resultchangabs, SetRetainFlag);
             }
 
             if (resultraw.length() > 0)   
-                MQTTPublish(namenumber + "raw", resultraw, SetRetainFlag);
+                MQTTPublishCached(namenumber + "raw", resultraw, SetRetainFlag);
 
             if (resulttimestamp.length() > 0)
-                MQTTPublish(namenumber + "timestamp", resulttimestamp, SetRetainFlag);
+                MQTTPublishCached(namenumber + "timestamp", resulttimestamp, SetRetainFlag);
 
-            std::string json = flowpostprocessing->getJsonFromNumber(i, "\n");
-            MQTTPublish(namenumber + "json", json, SetRetainFlag);
+            NumberRollup* rollup = flowpostprocessing->GetRollup()->Get((*NUMBERS)[i]->name);
+            if (rollup != NULL) {
+                MQTTPublishCached(namenumber + "consumption_hour", RundeOutput(rollup->current[RollupHour].consumption, (*NUMBERS)[i]->Nachkomma), SetRetainFlag);
+                MQTTPublishCached(namenumber + "consumption_day", RundeOutput(rollup->current[RollupDay].consumption, (*NUMBERS)[i]->Nachkomma), SetRetainFlag);
+                MQTTPublishCached(namenumber + "consumption_month", RundeOutput(rollup->current[RollupMonth].consumption, (*NUMBERS)[i]->Nachkomma), SetRetainFlag);
+            }
         }
     }
     
@@ -20,6 +20,9 @@ protected:
 	ClassFlowPostProcessing* flowpostprocessing;  
     std::string user, password; 
     int SetRetainFlag;
+    int publishMaxAge; // Seconds, 0 = publish every round
+    bool publishJSONOnly;
+    bool publishQueue; // json topic is queued on the SD card while the broker is not reachable
     int keepAlive; // Seconds
     float roundInterval; // Minutes
 
@@ -2,6 +2,7 @@
 #include "Helper.h"
 #include "ClassFlowMakeImage.h"
 #include "ClassLogFile.h"
+#include "ClassDataSeries.h"
 
 #include <iomanip>
 #include <sstream>
@@ -69,7 +70,8 @@ string ClassFlowPostProcessing::getJsonFromNumber(int i, std::string _lineend) {
 	else
 		json += "    \"rate\": \"\"," + _lineend;
 
-	json += "    \"timestamp\": \"" + NUMBERS[i]->timeStamp + "\"" + _lineend;
+	json += "    \"timestamp\": \"" + NUMBERS[i]->timeStamp + "\"," + _lineend;
+	json += "    \"rollup\": " + rollup.GetJSON(NUMBERS[i]->name, NUMBERS[i]->Nachkomma, _lineend) + _lineend;
 	json += "  }" + _lineend;
 
 	return json;
@@ -111,6 +113,7 @@ void ClassFlowPostProcessing::SetPreValue(double zw, string _numbers, bool _exte
             {
                 time(&(NUMBERS[j]->lastvalue));
                 localtime(&(NUMBERS[j]->lastvalue));
+                rollup.ResetLastValue(NUMBERS[j]->name);
             }
 //            ESP_LOGD(TAG, "Found %d! - set to %f", j,  NUMBERS[j]->PreValue);
         }
@@ -918,6 +921,18 @@ bool ClassFlowPostProcessing::doFlow(string zwtime)
         WriteDataLog(j);
     }
 
+    LogFile.FlushDataLog();     // all numbers of the round in one block
+
+    // the data series is independent of DataLogActive (CSV data log)
+    for (int j = 0; j < NUMBERS.size(); ++j)
+        DataSeries.Add(NUMBERS[j]->lastvalue, NUMBERS[j]->name, NUMBERS[j]->Value, NUMBERS[j]->ReturnRawValue,
+                       NUMBERS[j]->FlowRateAct, NUMBERS[j]->ErrorMessageText != "no error");
+    DataSeries.Flush();
+
+    for (int j = 0; j < NUMBERS.size(); ++j)
+        rollup.Update(NUMBERS[j]->name, imagetime, NUMBERS[j]->Value, NUMBERS[j]->FlowRateAct, NUMBERS[j]->ErrorMessageText != "no error");
+    rollup.Save();
+
     SavePreValue();
     return true;
 }
@@ -7,6 +7,7 @@
 #include "ClassFlowMakeImage.h"
 #include "ClassFlowCNNGeneral.h"
 #include "ClassFlowDefineTypes.h"
+#include "FlowRollup.h"
 
 #include <string>
 
@@ -31,6 +32,8 @@ protected:
 
     ClassFlowMakeImage *flowMakeImage;
 
+    FlowRollup rollup;
+
     bool LoadPreValue(void);
     string ShiftDecimal(string in, int _decShift);
 
@@ -75,6 +78,7 @@ public:
     void UpdateNachkommaDecimalShift();
 
     std::vector<NumberPost*>* GetNumbers(){return &NUMBERS;};
+    FlowRollup* GetRollup(){return &rollup;};
 
     string name(){return "ClassFlowPostProcessing";};
 };
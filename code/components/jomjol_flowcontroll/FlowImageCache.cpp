@@ -0,0 +1,124 @@
+#include "FlowImageCache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "esp_system.h"
+
+static const char* TAG = "IMG CACHE";
+
+
+FlowImageCache::FlowImageCache()
+{
+    size = 0;
+    generation = 0;
+    bootId = esp_random();
+    mutex = xSemaphoreCreateMutex();
+}
+
+
+FlowImageCache::~FlowImageCache()
+{
+    Clear();
+    vSemaphoreDelete(mutex);
+}
+
+
+void FlowImageCache::Clear()
+{
+    entries.clear();            // JPGs which are still sent are freed by the last request
+    size = 0;
+}
+
+
+void FlowImageCache::Invalidate()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    Clear();
+    generation++;
+    xSemaphoreGive(mutex);
+}
+
+
+std::string FlowImageCache::FormatETag()
+{
+    char zw[24];
+    snprintf(zw, sizeof(zw), "\"%08x-%u\"", (unsigned int) bootId, (unsigned int) generation);
+    return std::string(zw);
+}
+
+
+std::string FlowImageCache::GetETag()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    std::string etag = FormatETag();
+    xSemaphoreGive(mutex);
+
+    return etag;
+}
+
+
+/* Answers with 304 if the browser already has the image of this generation */
+bool FlowImageCache::CheckNotModified(httpd_req_t *req, std::string _etag)
+{
+    char ifNoneMatch[32];
+
+    if ((httpd_req_get_hdr_value_str(req, "If-None-Match", ifNoneMatch, sizeof(ifNoneMatch)) != ESP_OK) || (_etag != ifNoneMatch))
+        return false;
+
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "ETag", _etag.c_str());
+    httpd_resp_send(req, NULL, 0);
+    return true;
+}
+
+
+bool FlowImageCache::SendCached(std::string _name, httpd_req_t *req, esp_err_t &_result)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    std::shared_ptr<CachedJPG> jpg;
+    std::map<std::string, std::shared_ptr<CachedJPG>>::iterator it = entries.find(_name);
+    if (it != entries.end())
+        jpg = it->second;
+
+    xSemaphoreGive(mutex);
+
+    if (!jpg)
+        return false;
+
+    ESP_LOGD(TAG, "Sending %s from cache", _name.c_str());
+    _result = httpd_resp_send(req, (const char *) jpg->data, jpg->size);      // without the mutex, the client may be slow
+    return true;
+}
+
+
+/* Encodes _image once, sends it and keeps the JPG as long as the ETag (generation) is still valid */
+esp_err_t FlowImageCache::SendAndStore(std::string _name, CImageBasis *_image, std::string _etag, httpd_req_t *req)
+{
+    esp_err_t result;
+    size_t jpgSize = 0;
+    uint8_t* jpg = _image->writeToBufferAsJPG(jpgSize);
+
+    if (!jpg)       // not enough memory for the whole JPG, send it in chunks as before
+    {
+        ESP_LOGW(TAG, "Not enough memory to cache %s", _name.c_str());
+        result = _image->SendJPGtoHTTP(req);
+        httpd_resp_send_chunk(req, NULL, 0);
+        return result;
+    }
+
+    std::shared_ptr<CachedJPG> entry(new CachedJPG(jpg, jpgSize));
+
+    // stored before sending, parallel requests of the same image are served from the cache
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if ((_etag == FormatETag()) && (size + jpgSize <= IMAGE_CACHE_MAX_SIZE) && (entries.find(_name) == entries.end()))
+    {
+        entries[_name] = entry;
+        size += jpgSize;
+    }
+    xSemaphoreGive(mutex);
+
+    return httpd_resp_send(req, (const char *) entry->data, entry->size);
+}
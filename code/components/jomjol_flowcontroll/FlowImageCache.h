@@ -0,0 +1,57 @@
+#pragma once
+
+#ifndef FLOWIMAGECACHE_H
+#define FLOWIMAGECACHE_H
+
+#include <string>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <esp_http_server.h>
+
+#include "CImageBasis.h"
+#include "../../include/defines.h"
+
+
+/* Encoded JPG, freed with the last reference. Shared with the requests sending it,
+ * so the cache can be emptied while a slow client is still being served */
+struct CachedJPG {
+    uint8_t* data;              // allocated in PSRAM
+    size_t size;
+
+    CachedJPG(uint8_t* _data, size_t _size) {data = _data; size = _size;};
+    ~CachedJPG() {free(data);};
+};
+
+
+/* Encoded JPGs of the virtual /img_tmp images. The cache is emptied and the ETag changes
+ * whenever the flow may have changed the images (every flow step, status change) */
+class FlowImageCache
+{
+    protected:
+        std::map<std::string, std::shared_ptr<CachedJPG>> entries;
+        size_t size;                // sum of all cached JPGs
+        uint32_t generation;
+        uint32_t bootId;            // prevents matching ETags of a previous boot
+        SemaphoreHandle_t mutex;
+
+        void Clear();
+        std::string FormatETag();
+
+    public:
+        FlowImageCache();
+        ~FlowImageCache();
+
+        void Invalidate();
+        std::string GetETag();
+
+        bool CheckNotModified(httpd_req_t *req, std::string _etag);
+        bool SendCached(std::string _name, httpd_req_t *req, esp_err_t &_result);
+        esp_err_t SendAndStore(std::string _name, CImageBasis *_image, std::string _etag, httpd_req_t *req);
+};
+
+#endif //FLOWIMAGECACHE_H
@@ -0,0 +1,242 @@
+#include "FlowImageLogWriter.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+
+#include "ClassLogFile.h"
+#include "DirectoryIndex.h"
+
+static const char* TAG = "IMG LOG";
+
+FlowImageLogWriter ImageLogWriter;
+
+
+FlowImageLogWriter::FlowImageLogWriter()
+{
+    queue = NULL;
+    mutex = NULL;
+    task = NULL;
+    startFailed = false;
+    poolSize = 0;
+    largeBuffer.data = NULL;
+    largeBuffer.size = 0;
+    pendingSize = 0;
+    dropped = 0;
+    directWrites = 0;
+}
+
+
+bool FlowImageLogWriter::Start()
+{
+    if (task != NULL) {
+        return true;
+    }
+    if (startFailed) {
+        return false;
+    }
+
+    queue = xQueueCreate(IMAGE_LOG_QUEUE_LENGTH, sizeof(ImageLogJob*));
+    mutex = xSemaphoreCreateMutex();
+
+    if ((queue == NULL) || (mutex == NULL) ||
+            (xTaskCreatePinnedToCore(&TaskWriter, "task_ImageLogWriter", IMAGE_LOG_TASK_STACK, this, tskIDLE_PRIORITY+1, &task, IMAGE_LOG_TASK_CORE) != pdPASS)) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't create the image log writer task, log images are written directly");
+        if (queue != NULL)
+            vQueueDelete(queue);
+        if (mutex != NULL)
+            vSemaphoreDelete(mutex);
+        queue = NULL;
+        mutex = NULL;
+        task = NULL;
+        startFailed = true;
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Image log writer task started (queue: %d images)", IMAGE_LOG_QUEUE_LENGTH);
+    return true;
+}
+
+
+/* Smallest free buffer of the pool which is large enough, otherwise a new one.
+ * The raw image does not fit into the pool, its buffer is kept separately, so a new one is only needed in the first round. */
+uint8_t* FlowImageLogWriter::GetBuffer(size_t _size, size_t &_capacity)
+{
+    uint8_t* tooSmall = NULL;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    if ((largeBuffer.data != NULL) && (_size > IMAGE_LOG_POOL_MAX_SIZE)) {
+        if (largeBuffer.size >= _size) {
+            uint8_t* data = largeBuffer.data;
+            _capacity = largeBuffer.size;
+            largeBuffer.data = NULL;
+            xSemaphoreGive(mutex);
+            return data;
+        }
+        tooSmall = largeBuffer.data;        // image size changed
+        largeBuffer.data = NULL;
+    }
+
+    int best = -1;
+    for (int i = 0; i < pool.size(); ++i) {
+        if ((pool[i].size >= _size) && ((best < 0) || (pool[i].size < pool[best].size)))
+            best = i;
+    }
+
+    if (best >= 0) {
+        uint8_t* data = pool[best].data;
+        _capacity = pool[best].size;
+        poolSize -= _capacity;
+        pool.erase(pool.begin() + best);
+        xSemaphoreGive(mutex);
+        return data;
+    }
+
+    xSemaphoreGive(mutex);
+
+    if (tooSmall != NULL) {
+        free(tooSmall);
+    }
+
+    if (heap_caps_get_free_size(MALLOC_CAP_SPIRAM) < _size + IMAGE_LOG_MIN_FREE_PSRAM) {
+        return NULL;
+    }
+
+    _capacity = _size;
+    return (uint8_t*) GET_MEMORY(_size);
+}
+
+
+void FlowImageLogWriter::ReleaseBuffer(uint8_t* _data, size_t _capacity)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    if ((_capacity > IMAGE_LOG_POOL_MAX_SIZE) && (largeBuffer.data == NULL)) {
+        largeBuffer.data = _data;
+        largeBuffer.size = _capacity;
+        _data = NULL;
+    }
+    else if (poolSize + _capacity <= IMAGE_LOG_POOL_MAX_SIZE) {     // the ROI images have the same size every round
+        ImageLogBuffer buffer = {_data, _capacity};
+        pool.push_back(buffer);
+        poolSize += _capacity;
+        _data = NULL;
+    }
+
+    xSemaphoreGive(mutex);
+
+    if (_data != NULL) {
+        free(_data);
+    }
+}
+
+
+void FlowImageLogWriter::Write(ImageLogJob* _job)
+{
+    {
+        CImageBasis image(_job->data, _job->channels, _job->width, _job->height, _job->bpp);   // external image, the buffer stays ours
+        image.SaveToFile(_job->filename);
+    }
+    DirIndex.InvalidateFile(_job->filename);        // new file in the folder of the file server
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    pendingSize -= (size_t) _job->width * _job->height * _job->channels;
+    xSemaphoreGive(mutex);
+
+    ReleaseBuffer(_job->data, _job->size);
+    delete _job;
+}
+
+
+void FlowImageLogWriter::TaskWriter(void *pvParameter)
+{
+    FlowImageLogWriter* writer = (FlowImageLogWriter*) pvParameter;
+    ImageLogJob* job;
+
+    while (true) {
+        if (xQueueReceive(writer->queue, &job, portMAX_DELAY) == pdTRUE) {
+            writer->Write(job);
+        }
+    }
+}
+
+
+/* Copies the image and returns at once. Returns false if the image was dropped because the queue is full. */
+bool FlowImageLogWriter::Enqueue(std::string _filename, CImageBasis *_img)
+{
+    if (!Start()) {
+        directWrites++;
+        _img->SaveToFile(_filename);
+        return true;
+    }
+
+    size_t size = (size_t) _img->width * _img->height * _img->channels;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool full = (uxQueueSpacesAvailable(queue) == 0) || (pendingSize + size > IMAGE_LOG_QUEUE_MAX_SIZE);
+    if (!full) {
+        pendingSize += size;
+    }
+    xSemaphoreGive(mutex);
+
+    if (full) {
+        dropped++;
+        ESP_LOGW(TAG, "Queue full, %s dropped (%u dropped so far)", _filename.c_str(), (unsigned int) dropped);
+        return false;
+    }
+
+    size_t capacity = 0;
+    uint8_t* data = GetBuffer(size, capacity);
+    uint8_t* pixels = (data != NULL) ? _img->RGBImageLock() : NULL;
+
+    if (pixels == NULL) {      // no memory for a copy: write it directly as before
+        if (data != NULL)
+            ReleaseBuffer(data, capacity);
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        pendingSize -= size;
+        xSemaphoreGive(mutex);
+
+        directWrites++;
+        ESP_LOGW(TAG, "No memory for the copy, %s written directly", _filename.c_str());
+        _img->SaveToFile(_filename);
+        return true;
+    }
+
+    memcpy(data, pixels, size);
+    _img->RGBImageRelease();
+
+    ImageLogJob* job = new ImageLogJob;
+    job->filename = _filename;
+    job->data = data;
+    job->size = capacity;
+    job->width = _img->width;
+    job->height = _img->height;
+    job->channels = _img->channels;
+    job->bpp = _img->bpp;
+
+    if (xQueueSend(queue, &job, 0) != pdTRUE) {
+        xSemaphoreTake(mutex, portMAX_DELAY);
+        pendingSize -= size;
+        xSemaphoreGive(mutex);
+        ReleaseBuffer(data, capacity);
+        delete job;
+
+        dropped++;
+        ESP_LOGW(TAG, "Queue full, %s dropped (%u dropped so far)", _filename.c_str(), (unsigned int) dropped);
+        return false;
+    }
+
+    return true;
+}
+
+
+int FlowImageLogWriter::GetQueueDepth()
+{
+    if (queue == NULL) {
+        return 0;
+    }
+    return uxQueueMessagesWaiting(queue);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#ifndef FLOWIMAGELOGWRITER_H
+#define FLOWIMAGELOGWRITER_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#include "CImageBasis.h"
+#include "../../include/defines.h"
+
+
+struct ImageLogJob {
+    std::string filename;
+    uint8_t* data;              // copy of the pixels, from the buffer pool
+    size_t size;                // capacity of data
+    int width, height, channels, bpp;
+};
+
+
+struct ImageLogBuffer {
+    uint8_t* data;              // PSRAM
+    size_t size;
+};
+
+
+/* Writes the log images (LogImageLocation) in a task on the other core: the flow only copies the
+ * pixels into a pooled buffer, the JPG encoding and the SD card write are done in the background.
+ * If the queue is full the image is dropped and counted. Without memory for the copy it is written directly. */
+class FlowImageLogWriter
+{
+    protected:
+        QueueHandle_t queue;            // ImageLogJob*
+        SemaphoreHandle_t mutex;        // pool, pendingSize
+        TaskHandle_t task;
+        bool startFailed;
+
+        std::vector<ImageLogBuffer> pool;
+        size_t poolSize;
+        ImageLogBuffer largeBuffer;     // larger than the pool (raw image), kept for the next round, data = NULL while in use
+        size_t pendingSize;             // pixels waiting in the queue
+        uint32_t dropped;
+        uint32_t directWrites;          // written by the flow itself (no task or no memory for the copy)
+
+        bool Start();
+        uint8_t* GetBuffer(size_t _size, size_t &_capacity);
+        void ReleaseBuffer(uint8_t* _data, size_t _capacity);
+        void Write(ImageLogJob* _job);
+
+        static void TaskWriter(void *pvParameter);
+
+    public:
+        FlowImageLogWriter();
+
+        bool Enqueue(std::string _filename, CImageBasis *_img);
+
+        int GetQueueDepth();
+        uint32_t GetDropped() {return dropped;};
+        uint32_t GetDirectWrites() {return directWrites;};
+};
+
+extern FlowImageLogWriter ImageLogWriter;
+
+#endif //FLOWIMAGELOGWRITER_H
@@ -0,0 +1,136 @@
+#include "FlowMetrics.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+
+FlowMetrics::FlowMetrics()
+{
+    mutex = xSemaphoreCreateMutex();
+}
+
+
+FlowMetrics::~FlowMetrics()
+{
+    for (int i = 0; i < steps.size(); ++i)
+        delete steps[i];
+    steps.clear();
+
+    vSemaphoreDelete(mutex);
+}
+
+
+StepMetrics* FlowMetrics::GetStep(std::string _name)
+{
+    for (int i = 0; i < steps.size(); ++i)
+        if (steps[i]->name == _name)
+            return steps[i];
+
+    StepMetrics* step = new StepMetrics();
+    step->name = _name;
+    step->anz = 0;
+    step->pos = 0;
+    step->runs = 0;
+    step->errors = 0;
+    step->duration_sum_us = 0;
+    step->heap_delta_sum = 0;
+    steps.push_back(step);
+
+    return step;
+}
+
+
+void FlowMetrics::AddMeasurement(std::string _step, int64_t _duration_us, int32_t _heap_delta, bool _ok)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    StepMetrics* step = GetStep(_step);
+    step->duration_us[step->pos] = _duration_us;
+    step->heap_delta[step->pos] = _heap_delta;
+    step->pos = (step->pos + 1) % FLOW_METRICS_RING_SIZE;
+    step->anz = std::min(step->anz + 1, FLOW_METRICS_RING_SIZE);
+    step->runs++;
+    step->duration_sum_us += _duration_us;
+    step->heap_delta_sum += _heap_delta;
+    if (!_ok)
+        step->errors++;
+
+    xSemaphoreGive(mutex);
+}
+
+
+/* Nearest rank quantile of sorted values, _percent 0 is the minimum, 100 the maximum */
+int64_t FlowMetrics::Quantile(const int64_t* _sorted, int _anz, int _percent)
+{
+    if (_anz <= 0)
+        return 0;
+
+    int index = (_anz * _percent + 99) / 100 - 1;
+    index = std::max(0, std::min(index, _anz - 1));
+    return _sorted[index];
+}
+
+
+static const int quantiles[] = {0, 50, 95, 100};
+static const char* quantileLabels[] = {"0", "0.5", "0.95", "1"};
+
+
+/* Values as Prometheus text format: one summary per step for the duration and the heap change */
+std::string FlowMetrics::GetPrometheus()
+{
+    std::string duration = "# HELP flow_step_duration_seconds Duration of the flow steps (quantiles over the last " + std::to_string(FLOW_METRICS_RING_SIZE) + " runs)\n"
+                           "# TYPE flow_step_duration_seconds summary\n";
+    std::string heap = "# HELP flow_step_heap_delta_bytes Change of the free heap during the flow steps (negative: memory is kept allocated)\n"
+                       "# TYPE flow_step_heap_delta_bytes summary\n";
+    std::string errors = "# HELP flow_step_errors_total Number of failed runs of the flow steps\n"
+                         "# TYPE flow_step_errors_total counter\n";
+    char zw[160];
+    int64_t sorted[FLOW_METRICS_RING_SIZE];
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    for (int i = 0; i < steps.size(); ++i)
+    {
+        StepMetrics* step = steps[i];
+        const char* name = step->name.c_str();
+
+        snprintf(zw, sizeof(zw), "flow_step_errors_total{step=\"%s\"} %u\n", name, step->errors);
+        errors += zw;
+
+        // durations
+        for (int j = 0; j < step->anz; ++j)
+            sorted[j] = step->duration_us[j];
+        std::sort(sorted, sorted + step->anz);
+
+        for (int q = 0; (q < sizeof(quantiles) / sizeof(quantiles[0])) && (step->anz > 0); ++q)
+        {
+            snprintf(zw, sizeof(zw), "flow_step_duration_seconds{step=\"%s\",quantile=\"%s\"} %.6f\n", name, quantileLabels[q],
+                        Quantile(sorted, step->anz, quantiles[q]) / 1e6);
+            duration += zw;
+        }
+        snprintf(zw, sizeof(zw), "flow_step_duration_seconds_sum{step=\"%s\"} %.6f\n", name, step->duration_sum_us / 1e6);
+        duration += zw;
+        snprintf(zw, sizeof(zw), "flow_step_duration_seconds_count{step=\"%s\"} %u\n", name, step->runs);
+        duration += zw;
+
+        // heap changes
+        for (int j = 0; j < step->anz; ++j)
+            sorted[j] = step->heap_delta[j];
+        std::sort(sorted, sorted + step->anz);
+
+        for (int q = 0; (q < sizeof(quantiles) / sizeof(quantiles[0])) && (step->anz > 0); ++q)
+        {
+            snprintf(zw, sizeof(zw), "flow_step_heap_delta_bytes{step=\"%s\",quantile=\"%s\"} %lld\n", name, quantileLabels[q],
+                        (long long) Quantile(sorted, step->anz, quantiles[q]));
+            heap += zw;
+        }
+        snprintf(zw, sizeof(zw), "flow_step_heap_delta_bytes_sum{step=\"%s\"} %lld\n", name, (long long) step->heap_delta_sum);
+        heap += zw;
+        snprintf(zw, sizeof(zw), "flow_step_heap_delta_bytes_count{step=\"%s\"} %u\n", name, step->runs);
+        heap += zw;
+    }
+
+    xSemaphoreGive(mutex);
+
+    return duration + heap + errors;
+}
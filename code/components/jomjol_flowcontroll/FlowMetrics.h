@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef FLOWMETRICS_H
+#define FLOWMETRICS_H
+
+#include <string>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "../../include/defines.h"
+
+
+struct StepMetrics {
+    std::string name;
+    int64_t duration_us[FLOW_METRICS_RING_SIZE];
+    int32_t heap_delta[FLOW_METRICS_RING_SIZE];
+    int anz;                    // number of valid entries in the ring
+    int pos;                    // next position to write
+    uint32_t runs, errors;
+    int64_t duration_sum_us;    // over all runs (summary _sum)
+    int64_t heap_delta_sum;
+};
+
+
+/* Durations and heap changes per flow step (always on, fixed size): the quantiles are taken over the last
+ * FLOW_METRICS_RING_SIZE runs, sum and count over all runs */
+class FlowMetrics
+{
+    protected:
+        std::vector<StepMetrics*> steps;
+        SemaphoreHandle_t mutex;
+
+        StepMetrics* GetStep(std::string _name);
+
+    public:
+        FlowMetrics();
+        ~FlowMetrics();
+
+        void AddMeasurement(std::string _step, int64_t _duration_us, int32_t _heap_delta, bool _ok = true);
+        std::string GetPrometheus();
+
+        static int64_t Quantile(const int64_t* _sorted, int _anz, int _percent);
+};
+
+#endif //FLOWMETRICS_H
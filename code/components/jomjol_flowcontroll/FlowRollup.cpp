@@ -0,0 +1,229 @@
+#include "FlowRollup.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "ClassLogFile.h"
+#include "Helper.h"
+
+static const char* TAG = "ROLLUP";
+
+#define ROLLUP_FILE_VERSION 1
+
+static const char* RollupPeriodNames[RollupPeriods] = {"hour", "day", "month"};
+
+
+FlowRollup::FlowRollup()
+{
+    loaded = false;
+    mutex = xSemaphoreCreateMutex();
+}
+
+
+void FlowRollup::Load()
+{
+    loaded = true;
+    rollups.clear();
+
+    FILE* pFile = fopen(ROLLUP_FILE, "rb");
+    if (pFile == NULL) {        // power loss in Save() between delete and rename
+        pFile = fopen(ROLLUP_FILE_TMP, "rb");
+    }
+    if (pFile == NULL) {
+        return;
+    }
+
+    uint32_t header[2];     // version, size of one record
+    if ((fread(header, sizeof(header), 1, pFile) != 1) || (header[0] != ROLLUP_FILE_VERSION) || (header[1] != sizeof(NumberRollup))) {
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Format of " + std::string(ROLLUP_FILE) + " unknown, aggregates restart");
+        fclose(pFile);
+        return;
+    }
+
+    NumberRollup rollup;
+    while (fread(&rollup, sizeof(NumberRollup), 1, pFile) == 1) {
+        rollup.name[ROLLUP_NAME_LENGTH - 1] = '\0';
+        rollups.push_back(rollup);
+    }
+    fclose(pFile);
+
+    ESP_LOGD(TAG, "Aggregates of %d numbers loaded", (int)rollups.size());
+}
+
+
+/* Written to a temporary file first, a power loss while writing must not destroy the aggregates.
+ * FAT can't rename onto an existing file, so ROLLUP_FILE is deleted before, Load() falls back to the temporary file. */
+void FlowRollup::Save()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    std::vector<NumberRollup> data = rollups;
+    xSemaphoreGive(mutex);
+
+    FILE* pFile = fopen(ROLLUP_FILE_TMP, "wb");
+    if (pFile == NULL) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't write " + std::string(ROLLUP_FILE_TMP));
+        return;
+    }
+
+    uint32_t header[2] = {ROLLUP_FILE_VERSION, sizeof(NumberRollup)};
+    bool ok = (fwrite(header, sizeof(header), 1, pFile) == 1);
+    if (ok && (data.size() > 0)) {
+        ok = (fwrite(data.data(), sizeof(NumberRollup), data.size(), pFile) == data.size());
+    }
+    ok = (fclose(pFile) == 0) && ok;
+
+    if (!ok) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't write " + std::string(ROLLUP_FILE_TMP));
+        return;
+    }
+
+    unlink(ROLLUP_FILE);
+    if (rename(ROLLUP_FILE_TMP, ROLLUP_FILE) != 0) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't rename " + std::string(ROLLUP_FILE_TMP));
+    }
+}
+
+
+/* Must be called with the mutex taken */
+NumberRollup* FlowRollup::Find(std::string _name, bool _create)
+{
+    if (!loaded) {
+        Load();
+    }
+
+    for (int i = 0; i < rollups.size(); ++i) {
+        if (strncmp(rollups[i].name, _name.c_str(), ROLLUP_NAME_LENGTH - 1) == 0) {
+            return &rollups[i];
+        }
+    }
+
+    if (!_create) {
+        return NULL;
+    }
+
+    NumberRollup rollup;
+    memset(&rollup, 0, sizeof(NumberRollup));
+    strncpy(rollup.name, _name.c_str(), ROLLUP_NAME_LENGTH - 1);
+    rollups.push_back(rollup);
+
+    return &rollups.back();
+}
+
+
+NumberRollup* FlowRollup::Get(std::string _name)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    NumberRollup* rollup = Find(_name, false);
+    xSemaphoreGive(mutex);
+
+    return rollup;
+}
+
+
+void FlowRollup::Update(std::string _name, time_t _time, double _value, double _rate, bool _error)
+{
+    struct tm timeinfo;
+    localtime_r(&_time, &timeinfo);
+    uint32_t month = (timeinfo.tm_year + 1900) * 100 + (timeinfo.tm_mon + 1);
+    uint32_t keys[RollupPeriods];
+    keys[RollupMonth] = month;
+    keys[RollupDay] = month * 100 + timeinfo.tm_mday;
+    keys[RollupHour] = keys[RollupDay] * 100 + timeinfo.tm_hour;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    NumberRollup* rollup = Find(_name, true);
+
+
+    double change = 0;
+    bool rateValid = false;
+
+    if (!_error) {
+        if (rollup->lastValueValid) {
+            change = _value - rollup->lastValue;
+            rateValid = true;
+        }
+        rollup->lastValue = _value;
+        rollup->lastValueValid = true;
+    }
+
+    for (int i = 0; i < RollupPeriods; ++i) {
+        RollupPeriod* period = &rollup->current[i];
+
+        if (period->key != keys[i]) {   // new hour / day / month
+            if (period->key != 0) {
+                rollup->previous[i] = *period;
+            }
+            memset(period, 0, sizeof(RollupPeriod));
+            period->key = keys[i];
+        }
+
+        period->readings++;
+        if (_error) {
+            period->errors++;
+            continue;
+        }
+
+        period->consumption += change;
+
+        if (rateValid) {
+            if ((period->rates == 0) || (_rate < period->rateMin)) {
+                period->rateMin = _rate;
+            }
+            if ((period->rates == 0) || (_rate > period->rateMax)) {
+                period->rateMax = _rate;
+            }
+            period->rates++;
+        }
+    }
+
+    xSemaphoreGive(mutex);
+}
+
+
+/* The value was set from outside (e.g. new PreValue), the jump must not count as consumption */
+void FlowRollup::ResetLastValue(std::string _name)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    NumberRollup* rollup = Find(_name, false);
+
+    if (rollup != NULL) {
+        rollup->lastValueValid = false;
+    }
+    xSemaphoreGive(mutex);
+}
+
+
+std::string FlowRollup::GetJSON(std::string _name, int _nachkomma, std::string _lineend)
+{
+    std::string json = "{" + _lineend;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    NumberRollup* rollup = Find(_name, false);
+
+    if (rollup != NULL) {
+        for (int i = 0; i < RollupPeriods; ++i) {
+            for (int prev = 0; prev < 2; ++prev) {
+                RollupPeriod* period = prev ? &rollup->previous[i] : &rollup->current[i];
+
+                json += "      \"" + std::string(prev ? "previous_" : "") + RollupPeriodNames[i] + "\": {";
+                json += "\"period\": \"" + std::to_string(period->key) + "\", ";
+                json += "\"consumption\": \"" + RundeOutput(period->consumption, _nachkomma) + "\", ";
+                json += "\"rate_min\": \"" + std::to_string(period->rateMin) + "\", ";
+                json += "\"rate_max\": \"" + std::to_string(period->rateMax) + "\", ";
+                json += "\"readings\": " + std::to_string(period->readings) + ", ";
+                json += "\"errors\": " + std::to_string(period->errors) + "}";
+
+                if ((i + 1 < RollupPeriods) || (prev == 0)) {
+                    json += ",";
+                }
+                json += _lineend;
+            }
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    json += "    }";
+    return json;
+}
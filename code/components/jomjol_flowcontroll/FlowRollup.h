@@ -0,0 +1,69 @@
+#pragma once
+
+#ifndef FLOWROLLUP_H
+#define FLOWROLLUP_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "../../include/defines.h"
+
+
+enum t_RollupPeriod {
+    RollupHour,
+    RollupDay,
+    RollupMonth,
+    RollupPeriods
+};
+
+
+struct RollupPeriod {
+    uint32_t key;               // local time as YYYYMMDDHH / YYYYMMDD / YYYYMM, 0 = no reading yet
+    double consumption;         // sum of the accepted changes within the period
+    float rateMin, rateMax;     // Unit / Minute
+    uint32_t rates;             // number of rates in rateMin / rateMax
+    uint32_t readings, errors;
+};
+
+
+/* Fixed size, it is stored as it is in ROLLUP_FILE */
+struct NumberRollup {
+    char name[ROLLUP_NAME_LENGTH];
+    double lastValue;           // last accepted value, base for the next change
+    uint32_t lastValueValid;
+    RollupPeriod current[RollupPeriods];
+    RollupPeriod previous[RollupPeriods];      // last period with readings before the current one
+};
+
+
+/* Hourly, daily and monthly consumption, min/max rate and error count per number, updated with O(1) per round */
+class FlowRollup
+{
+    protected:
+        std::vector<NumberRollup> rollups;
+        bool loaded;
+        SemaphoreHandle_t mutex;        // flow task vs. web server (json, PreValue)
+
+        void Load();
+        NumberRollup* Find(std::string _name, bool _create);
+
+    public:
+        FlowRollup();
+
+        /* Only new numbers move the data, they are only added by Update() on the flow task.
+         * So the pointer stays valid on the flow task. */
+        NumberRollup* Get(std::string _name);
+
+        void Update(std::string _name, time_t _time, double _value, double _rate, bool _error);
+        void ResetLastValue(std::string _name);
+        void Save();
+
+        std::string GetJSON(std::string _name, int _nachkomma, std::string _lineend = "\n");
+};
+
+#endif //FLOWROLLUP_H
@@ -511,6 +511,38 @@ string toLower(string in)
 }
 
 
+/* Content of a JSON string (without the quotes): quote, backslash and control characters are escaped, UTF-8 is kept */
+string EscapeJson(string in)
+{
+	string out;
+	char zw[8];
+
+	out.reserve(in.length());
+	for (int i = 0; i < in.length(); ++i)
+	{
+		unsigned char c = in[i];
+		switch (c)
+		{
+			case '"':  out += "\\\""; break;
+			case '\\': out += "\\\\"; break;
+			case '\n': out += "\\n"; break;
+			case '\r': out += "\\r"; break;
+			case '\t': out += "\\t"; break;
+			default:
+				if (c < 0x20)
+				{
+					snprintf(zw, sizeof(zw), "\\u%04x", c);
+					out += zw;
+				}
+				else
+					out += c;
+		}
+	}
+
+	return out;
+}
+
+
 // CPU Temp
 extern "C" uint8_t temprature_sens_read();
 float temperatureRead()
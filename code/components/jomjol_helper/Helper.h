@@ -38,6 +38,7 @@ int removeFolder(const char* folderPath, const char* logTag);
 
 string toLower(string in);
 string toUpper(string in);
+string EscapeJson(string in);
 
 float temperatureRead();
 
@@ -31,7 +31,8 @@ void CAlignAndCutImage::GetRefSize(int *ref_dx, int *ref_dy)
     ref_dy[1] = t1_dy;
 }
 
-bool CAlignAndCutImage::Align(RefInfo *_temp1, RefInfo *_temp2)
+/* Determines shift and rotation (in degree) of the image based on the two reference marks, the image itself is not changed */
+bool CAlignAndCutImage::FindAlignment(RefInfo *_temp1, RefInfo *_temp2, int &_dx, int &_dy, float &_angle)
 {
     int dx, dy;
     int r0_x, r0_y, r1_x, r1_y;
@@ -81,15 +82,48 @@ bool CAlignAndCutImage::Align(RefInfo *_temp1, RefInfo *_temp2)
     LogFile.WriteToDedicatedFile("/sdcard/alignment.txt", zw);
 #endif*/
 
-    CRotateImage rt(this, ImageTMP);
-    rt.Translate(dx, dy);
-    rt.Rotate(d_winkel, _temp1->target_x, _temp1->target_y);
     ESP_LOGD(TAG, "Alignment: dx %d - dy %d - rot %f", dx, dy, d_winkel);
 
+    _dx = dx;
+    _dy = dy;
+    _angle = d_winkel;
+
     return (isSimilar1 && isSimilar2);
 }
 
 
+bool CAlignAndCutImage::Align(RefInfo *_temp1, RefInfo *_temp2)
+{
+    int dx, dy;
+    float d_winkel;
+
+    bool isSimilar = FindAlignment(_temp1, _temp2, dx, dy, d_winkel);
+
+    // Translation and rotation in one pass: target -> rotate around reference 1 -> shift -> source
+    AffineTransform transform = CRotateImage::TranslateTransform(dx, dy).Compose(CRotateImage::RotateTransform(d_winkel, _temp1->target_x, _temp1->target_y));
+
+    if (!transform.isIdentity())
+    {
+        CRotateImage rt(this, ImageTMP);
+        if (ImageTMP)
+        {
+            rt.Warp(transform, false, ImageTMP);
+            memCopy(ImageTMP->rgb_image, rgb_image, width * height * channels);
+        }
+        else
+        {
+            CImageBasis tmp(width, height, channels);
+            if (!tmp.ImageOkay())
+                return false;
+            rt.Warp(transform, false, &tmp);
+            memCopy(tmp.rgb_image, rgb_image, width * height * channels);
+        }
+    }
+
+    return isSimilar;
+}
+
+
 
 
 
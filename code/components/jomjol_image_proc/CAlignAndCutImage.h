@@ -17,6 +17,7 @@ class CAlignAndCutImage : public CImageBasis
         CAlignAndCutImage(CImageBasis *_org, CImageBasis *_temp);
 
         bool Align(RefInfo *_temp1, RefInfo *_temp2);
+        bool FindAlignment(RefInfo *_temp1, RefInfo *_temp2, int &_dx, int &_dy, float &_angle);
 //        void Align(std::string _template1, int x1, int y1, std::string _template2, int x2, int y2, int deltax = 40, int deltay = 40, std::string imageROI = "");
         void CutAndSave(std::string _template1, int x1, int y1, int dx, int dy);
         CImageBasis* CutAndSave(int x1, int y1, int dx, int dy);
@@ -94,38 +94,31 @@ bool CFindTemplate::FindTemplate(RefInfo *_ref)
 //    ESP_LOGD(TAG, "FindTemplate 04");
 
 
-    double aktSAD;
-    double minSAD = pow(tpl_width * tpl_height * 255, 2);
-
     RGBImageLock();
 
 //    ESP_LOGD(TAG, "FindTemplate 05");
-    int xouter, youter, tpl_x, tpl_y, _ch;
     int _anzchannels = channels;
     if (_ref->alignment_algo == 0)  // 0 = "Default" (nur R-Kanal)
         _anzchannels = 1;
 
-    for (xouter = ow_start; xouter <= ow_stop; xouter++)
-        for (youter = oh_start; youter <= oh_stop; ++youter)
-        {
-            aktSAD = 0;
-            for (tpl_x = 0; tpl_x < tpl_width; tpl_x++)
-                for (tpl_y = 0; tpl_y < tpl_height; tpl_y++)
-                {
-                    stbi_uc* p_org = rgb_image + (channels * ((youter + tpl_y) * width + (xouter + tpl_x)));
-                    stbi_uc* p_tpl = rgb_template + (channels * (tpl_y * tpl_width + tpl_x));
-                    for (_ch = 0; _ch < _anzchannels; ++_ch)
-                    {
-                        aktSAD += pow(p_tpl[_ch] - p_org[_ch], 2);
-                    }
-                }
-            if (aktSAD < minSAD)
-            {
-                minSAD = aktSAD;
-                _ref->found_x = xouter;
-                _ref->found_y = youter;
-            }
-        }
+    // Number of pyramid levels: each level halves the resolution, the template has to keep a useful size at the coarsest level
+    int levels = 0;
+    while ((levels < FIND_TEMPLATE_MAX_PYRAMID_LEVEL) && 
+            ((tpl_width >> (levels + 1)) >= FIND_TEMPLATE_MIN_TEMPLATE_SIZE) && ((tpl_height >> (levels + 1)) >= FIND_TEMPLATE_MIN_TEMPLATE_SIZE))
+        levels++;
+
+    if ((long) ow * (long) oh < FIND_TEMPLATE_MIN_POSITIONS_PYRAMID)      // small search window -> brute force is faster
+        levels = 0;
+
+    bool found = false;
+    if ((ow > 0) && (oh > 0) && (levels > 0))
+        found = SearchPyramid(rgb_template, levels, ow_start, ow_stop, oh_start, oh_stop, _anzchannels, _ref->found_x, _ref->found_y);
+
+    if ((ow > 0) && (oh > 0) && !found)
+    {
+        uint64_t minSSD = UINT64_MAX;
+        SearchFullResolution(rgb_template, ow_start, ow_stop, oh_start, oh_stop, _anzchannels, minSSD, _ref->found_x, _ref->found_y);
+    }
 
 //    ESP_LOGD(TAG, "FindTemplate 06");
 
@@ -159,6 +152,245 @@ bool CFindTemplate::FindTemplate(RefInfo *_ref)
 }
 
 
+/* Integer sum of squared differences between the template and the image at position (_x, _y).
+ * The image is scanned row by row, the calculation stops as soon as _limit is reached. */
+uint64_t CFindTemplate::CalculateSSD(uint8_t* _rgb_tmpl, int _x, int _y, int _anzchannels, uint64_t _limit)
+{
+    uint64_t aktSSD = 0;
+    int dif;
+
+    for (int tpl_y = 0; tpl_y < tpl_height; ++tpl_y)
+    {
+        stbi_uc* p_org = rgb_image + (channels * ((_y + tpl_y) * width + _x));
+        stbi_uc* p_tpl = _rgb_tmpl + (channels * tpl_y * tpl_width);
+        uint32_t rowSSD = 0;
+
+        if (_anzchannels == channels)
+        {
+            int anz = tpl_width * channels;
+            for (int i = 0; i < anz; ++i)
+            {
+                dif = p_tpl[i] - p_org[i];
+                rowSSD += dif * dif;
+            }
+        }
+        else
+        {
+            for (int tpl_x = 0; tpl_x < tpl_width; ++tpl_x, p_org += channels, p_tpl += channels)
+                for (int _ch = 0; _ch < _anzchannels; ++_ch)
+                {
+                    dif = p_tpl[_ch] - p_org[_ch];
+                    rowSSD += dif * dif;
+                }
+        }
+
+        aktSSD += rowSSD;
+        if (aktSSD >= _limit)
+            break;
+    }
+
+    return aktSSD;
+}
+
+
+void CFindTemplate::SearchFullResolution(uint8_t* _rgb_tmpl, int _x_start, int _x_stop, int _y_start, int _y_stop, int _anzchannels, uint64_t &_minSSD, int &_found_x, int &_found_y)
+{
+    uint64_t aktSSD;
+
+    for (int youter = _y_start; youter <= _y_stop; ++youter)
+        for (int xouter = _x_start; xouter <= _x_stop; ++xouter)
+        {
+            aktSSD = CalculateSSD(_rgb_tmpl, xouter, youter, _anzchannels, _minSSD);
+            if (aktSSD < _minSSD)
+            {
+                _minSSD = aktSSD;
+                _found_x = xouter;
+                _found_y = youter;
+            }
+        }
+}
+
+
+/* Single channel plane of a part of an RGB image (mean of the used channels) */
+static uint8_t* CreatePlane(uint8_t* _rgb, int _rgb_width, int _channels, int _anzchannels, int _x0, int _y0, int _dx, int _dy)
+{
+    uint8_t* plane = (uint8_t*) GET_MEMORY(_dx * _dy);
+    if (plane == NULL)
+        return NULL;
+
+    uint8_t* p_out = plane;
+    for (int y = 0; y < _dy; ++y)
+    {
+        stbi_uc* p_in = _rgb + (_channels * ((_y0 + y) * _rgb_width + _x0));
+        for (int x = 0; x < _dx; ++x, p_in += _channels)
+        {
+            int sum = 0;
+            for (int _ch = 0; _ch < _anzchannels; ++_ch)
+                sum += p_in[_ch];
+            *p_out++ = sum / _anzchannels;
+        }
+    }
+
+    return plane;
+}
+
+
+/* Next pyramid level: 2x2 box filter */
+static uint8_t* HalvePlane(uint8_t* _plane, int _width, int _height, int &_new_width, int &_new_height)
+{
+    _new_width = _width / 2;
+    _new_height = _height / 2;
+
+    uint8_t* plane = (uint8_t*) GET_MEMORY(_new_width * _new_height);
+    if (plane == NULL)
+        return NULL;
+
+    uint8_t* p_out = plane;
+    for (int y = 0; y < _new_height; ++y)
+    {
+        uint8_t* p_row0 = _plane + (2 * y * _width);
+        uint8_t* p_row1 = p_row0 + _width;
+        for (int x = 0; x < _new_width; ++x)
+            *p_out++ = (p_row0[2*x] + p_row0[2*x + 1] + p_row1[2*x] + p_row1[2*x + 1] + 2) >> 2;
+    }
+
+    return plane;
+}
+
+
+static uint32_t PlaneSSD(uint8_t* _img, int _img_width, uint8_t* _tpl, int _tpl_width, int _tpl_height, int _x, int _y, uint32_t _limit)
+{
+    uint32_t aktSSD = 0;
+    int dif;
+
+    for (int tpl_y = 0; tpl_y < _tpl_height; ++tpl_y)
+    {
+        uint8_t* p_org = _img + ((_y + tpl_y) * _img_width + _x);
+        uint8_t* p_tpl = _tpl + (tpl_y * _tpl_width);
+        for (int tpl_x = 0; tpl_x < _tpl_width; ++tpl_x)
+        {
+            dif = p_tpl[tpl_x] - p_org[tpl_x];
+            aktSSD += dif * dif;
+        }
+        if (aktSSD >= _limit)
+            break;
+    }
+
+    return aktSSD;
+}
+
+
+/* Coarse to fine search: exhaustive search on the coarsest pyramid level, the best candidates are 
+ * refined level by level in a small neighbourhood. Only the last step uses the full resolution image. */
+bool CFindTemplate::SearchPyramid(uint8_t* _rgb_tmpl, int _levels, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop, int _anzchannels, int &_found_x, int &_found_y)
+{
+    uint8_t* img[FIND_TEMPLATE_MAX_PYRAMID_LEVEL + 1] = {};
+    uint8_t* tpl[FIND_TEMPLATE_MAX_PYRAMID_LEVEL + 1] = {};
+    int img_w[FIND_TEMPLATE_MAX_PYRAMID_LEVEL + 1], img_h[FIND_TEMPLATE_MAX_PYRAMID_LEVEL + 1];
+    int tpl_w[FIND_TEMPLATE_MAX_PYRAMID_LEVEL + 1], tpl_h[FIND_TEMPLATE_MAX_PYRAMID_LEVEL + 1];
+    uint32_t* scores = NULL;
+    bool result = false;
+
+    // Level 0 only covers the search window, not the whole image
+    img_w[0] = _ow_stop - _ow_start + tpl_width;
+    img_h[0] = _oh_stop - _oh_start + tpl_height;
+    tpl_w[0] = tpl_width;
+    tpl_h[0] = tpl_height;
+    img[0] = CreatePlane(rgb_image, width, channels, _anzchannels, _ow_start, _oh_start, img_w[0], img_h[0]);
+    tpl[0] = CreatePlane(_rgb_tmpl, tpl_width, channels, _anzchannels, 0, 0, tpl_width, tpl_height);
+
+    for (int l = 1; l <= _levels; ++l)
+    {
+        if ((img[l-1] == NULL) || (tpl[l-1] == NULL))
+            break;
+        img[l] = HalvePlane(img[l-1], img_w[l-1], img_h[l-1], img_w[l], img_h[l]);
+        tpl[l] = HalvePlane(tpl[l-1], tpl_w[l-1], tpl_h[l-1], tpl_w[l], tpl_h[l]);
+    }
+
+    if ((img[_levels] == NULL) || (tpl[_levels] == NULL))
+    {
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "FindTemplate: Not enough memory for the image pyramid, using full resolution search");
+    }
+    else
+    {
+        int top_w = img_w[_levels] - tpl_w[_levels] + 1;
+        int top_h = img_h[_levels] - tpl_h[_levels] + 1;
+        if ((top_w > 0) && (top_h > 0))
+            scores = (uint32_t*) GET_MEMORY(top_w * top_h * sizeof(uint32_t));
+
+        if (scores != NULL)
+        {
+            // Exhaustive search on the coarsest level
+            for (int y = 0; y < top_h; ++y)
+                for (int x = 0; x < top_w; ++x)
+                    scores[y * top_w + x] = PlaneSSD(img[_levels], img_w[_levels], tpl[_levels], tpl_w[_levels], tpl_h[_levels], x, y, UINT32_MAX);
+
+            uint64_t minSSD = UINT64_MAX;
+
+            for (int candidate = 0; candidate < FIND_TEMPLATE_COARSE_CANDIDATES; ++candidate)
+            {
+                // Best remaining local minimum, its neighbourhood gets suppressed for the next candidates
+                int cx = -1, cy = -1;
+                uint32_t cmin = UINT32_MAX;
+                for (int i = 0; i < top_w * top_h; ++i)
+                    if (scores[i] < cmin)
+                    {
+                        cmin = scores[i];
+                        cx = i % top_w;
+                        cy = i / top_w;
+                    }
+
+                if (cx < 0)
+                    break;
+
+                for (int y = std::max(cy - 2, 0); y <= std::min(cy + 2, top_h - 1); ++y)
+                    for (int x = std::max(cx - 2, 0); x <= std::min(cx + 2, top_w - 1); ++x)
+                        scores[y * top_w + x] = UINT32_MAX;
+
+                // Refine on the intermediate levels
+                for (int l = _levels - 1; l >= 1; --l)
+                {
+                    int max_x = img_w[l] - tpl_w[l];
+                    int max_y = img_h[l] - tpl_h[l];
+                    int bx = std::min(2 * cx, max_x);
+                    int by = std::min(2 * cy, max_y);
+                    uint32_t bmin = UINT32_MAX;
+
+                    for (int y = std::max(2 * cy - 2, 0); y <= std::min(2 * cy + 2, max_y); ++y)
+                        for (int x = std::max(2 * cx - 2, 0); x <= std::min(2 * cx + 2, max_x); ++x)
+                        {
+                            uint32_t aktSSD = PlaneSSD(img[l], img_w[l], tpl[l], tpl_w[l], tpl_h[l], x, y, bmin);
+                            if (aktSSD < bmin)
+                            {
+                                bmin = aktSSD;
+                                bx = x;
+                                by = y;
+                            }
+                        }
+                    cx = bx;
+                    cy = by;
+                }
+
+                // Final step on the full resolution RGB image
+                SearchFullResolution(_rgb_tmpl, std::max(_ow_start + 2 * cx - 2, _ow_start), std::min(_ow_start + 2 * cx + 2, _ow_stop),
+                                                std::max(_oh_start + 2 * cy - 2, _oh_start), std::min(_oh_start + 2 * cy + 2, _oh_stop),
+                                                _anzchannels, minSSD, _found_x, _found_y);
+            }
+
+            result = (minSSD < UINT64_MAX);
+        }
+    }
+
+    free(scores);
+    for (int l = 0; l <= _levels; ++l)
+    {
+        free(img[l]);
+        free(tpl[l]);
+    }
+
+    return result;
+}
+
 
 bool CFindTemplate::CalculateSimularities(uint8_t* _rgb_tmpl, int _startx, int _starty, int _sizex, int _sizey, int &min, float &avg, int &max, float &SAD, float _SADold, float _SADcrit)
 {
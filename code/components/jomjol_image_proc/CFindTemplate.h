@@ -36,6 +36,10 @@ class CFindTemplate : public CImageBasis
 
         bool FindTemplate(RefInfo *_ref);
 
+        uint64_t CalculateSSD(uint8_t* _rgb_tmpl, int _x, int _y, int _anzchannels, uint64_t _limit);
+        void SearchFullResolution(uint8_t* _rgb_tmpl, int _x_start, int _x_stop, int _y_start, int _y_stop, int _anzchannels, uint64_t &_minSSD, int &_found_x, int &_found_y);
+        bool SearchPyramid(uint8_t* _rgb_tmpl, int _levels, int _ow_start, int _ow_stop, int _oh_start, int _oh_stop, int _anzchannels, int &_found_x, int &_found_y);
+
         bool CalculateSimularities(uint8_t* _rgb_tmpl, int _startx, int _starty, int _sizex, int _sizey, int &min, float &avg, int &max, float &SAD, float _SADold, float _SADcrit);
 };
 
@@ -114,6 +114,63 @@ void CImageBasis::writeToMemoryAsJPG(ImageData* i, const int quality)
 }
 
 
+struct JPGBuffer
+{
+    uint8_t* data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    bool failed = false;
+};
+
+
+static void writejpgbufferhelp(void *context, void *data, int size)
+{
+    JPGBuffer* _buf = (JPGBuffer*) context;
+    if (_buf->failed)
+        return;
+
+    if (_buf->size + size > _buf->capacity)
+    {
+        size_t capacity = std::max(2 * _buf->capacity, _buf->size + size);
+        uint8_t* zw = (uint8_t*) heap_caps_realloc(_buf->data, capacity, MALLOC_CAP_SPIRAM);
+        if (!zw)
+        {
+            _buf->failed = true;
+            return;
+        }
+        _buf->data = zw;
+        _buf->capacity = capacity;
+    }
+
+    std::memcpy(_buf->data + _buf->size, data, size);
+    _buf->size += size;
+}
+
+
+/* JPG in a buffer which grows as needed (no MAX_JPG_SIZE limit), the caller has to free it. NULL if there is not enough memory */
+uint8_t* CImageBasis::writeToBufferAsJPG(size_t &_size, const int quality)
+{
+    JPGBuffer buf;
+    buf.capacity = 16 * 1024;
+    buf.data = (uint8_t*) GET_MEMORY(buf.capacity);
+    if (!buf.data)
+        return NULL;
+
+    RGBImageLock();
+    stbi_write_jpg_to_func(writejpgbufferhelp, &buf, width, height, channels, rgb_image, quality);
+    RGBImageRelease();
+
+    if (buf.failed)
+    {
+        free(buf.data);
+        return NULL;
+    }
+
+    _size = buf.size;
+    return buf.data;
+}
+
+
 struct SendJPGHTTP
 {
     httpd_req_t *req;
@@ -77,6 +77,7 @@ class CImageBasis
 
         ImageData* writeToMemoryAsJPG(const int quality = 90);
         void writeToMemoryAsJPG(ImageData* ii, const int quality = 90);
+        uint8_t* writeToBufferAsJPG(size_t &_size, const int quality = 90);
 
         esp_err_t SendJPGtoHTTP(httpd_req_t *req, const int quality = 90);   
 
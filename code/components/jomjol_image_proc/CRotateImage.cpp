@@ -1,5 +1,11 @@
 #include "CRotateImage.h"
 
+#include <math.h>
+#include <algorithm>
+#include <esp_log.h>
+
+static const char *TAG = "c_rotate_image";
+
 
 CRotateImage::CRotateImage(CImageBasis *_org, CImageBasis *_temp, bool _flip)
 {
@@ -347,3 +353,249 @@ void CRotateImage::Translate(int _dx, int _dy)
 
 }
 
+
+bool AffineTransform::isIdentity()
+{
+    return (m[0][0] == 1) && (m[0][1] == 0) && (m[0][2] == 0) && (m[1][0] == 0) && (m[1][1] == 1) && (m[1][2] == 0);
+}
+
+
+AffineTransform AffineTransform::Compose(AffineTransform _inner)
+{
+    AffineTransform result;
+
+    for (int i = 0; i < 2; ++i)
+    {
+        result.m[i][0] = m[i][0] * _inner.m[0][0] + m[i][1] * _inner.m[1][0];
+        result.m[i][1] = m[i][0] * _inner.m[0][1] + m[i][1] * _inner.m[1][1];
+        result.m[i][2] = m[i][0] * _inner.m[0][2] + m[i][1] * _inner.m[1][2] + m[i][2];
+    }
+
+    return result;
+}
+
+
+AffineTransform CRotateImage::MirrorTransform(int _width)
+{
+    AffineTransform t;
+    t.m[0][0] = -1;
+    t.m[0][2] = _width - 1;
+    return t;
+}
+
+
+/* Maps a target image of size (_width / _scale_x, _height / _scale_y) onto the rectangle at (_x, _y) with size (_width, _height) of the source (pixel centers are aligned) */
+AffineTransform CRotateImage::CropTransform(int _x, int _y, float _scale_x, float _scale_y)
+{
+    AffineTransform t;
+    t.m[0][0] = _scale_x;
+    t.m[0][2] = _x + (_scale_x - 1) / 2;
+    t.m[1][1] = _scale_y;
+    t.m[1][2] = _y + (_scale_y - 1) / 2;
+    return t;
+}
+
+
+AffineTransform CRotateImage::TranslateTransform(int _dx, int _dy)
+{
+    AffineTransform t;
+    t.m[0][2] = -_dx;
+    t.m[1][2] = -_dy;
+    return t;
+}
+
+
+/* Same matrix as used in Rotate(), with _flip the width and height of the target image are swapped */
+AffineTransform CRotateImage::RotateTransform(float _angle, int _centerx, int _centery, bool _flip, int _org_width, int _org_height)
+{
+    AffineTransform t;
+    float x_center = _centerx;
+    float y_center = _centery;
+    _angle = _angle / 180 * M_PI;
+
+    if (_flip)
+    {
+        x_center =  x_center - (_org_width/2) + (_org_height/2);
+        y_center =  y_center + (_org_width/2) - (_org_height/2);
+    }
+
+    t.m[0][0] = cos(_angle);
+    t.m[0][1] = sin(_angle);
+    t.m[0][2] = (1 - t.m[0][0]) * x_center - t.m[0][1] * y_center;
+
+    t.m[1][0] = -t.m[0][1];
+    t.m[1][1] = t.m[0][0];
+    t.m[1][2] = t.m[0][1] * x_center + (1 - t.m[0][0]) * y_center;
+
+    if (_flip)
+    {
+        t.m[0][2] = t.m[0][2] + (_org_width/2) - (_org_height/2);
+        t.m[1][2] = t.m[1][2] - (_org_width/2) + (_org_height/2);
+    }
+
+    return t;
+}
+
+
+/* Renders this image with the given transformation into _target in a single pass (row by row).
+ * The size of _target defines the size of the result, pixels outside of the source image are white. */
+void CRotateImage::Warp(AffineTransform _transform, bool _antialiasing, CImageBasis *_target)
+{
+    if (_target->channels != channels)
+    {
+        ESP_LOGE(TAG, "Warp - channels of target image do not fit!");
+        return;
+    }
+
+    float (&m)[2][3] = _transform.m;
+    int target_width = _target->width;
+    int target_height = _target->height;
+
+    uint8_t* odata = _target->RGBImageLock();
+    RGBImageLock();
+
+    stbi_uc* p_target = odata;
+
+    float size_x, size_y;
+    bool area = _antialiasing && GetSampleArea(_transform, size_x, size_y);
+
+    for (int y = 0; y < target_height; ++y)
+    {
+        float x_source = m[0][1] * y + m[0][2];
+        float y_source = m[1][1] * y + m[1][2];
+
+        for (int x = 0; x < target_width; ++x, x_source += m[0][0], y_source += m[1][0], p_target += channels)
+        {
+            if (area ? SampleArea(x_source, y_source, size_x, size_y, p_target) : SamplePixel(x_source, y_source, _antialiasing, p_target))
+                continue;
+
+            for (int _channels = 0; _channels < channels; ++_channels)
+                p_target[_channels] = 255;
+        }
+    }
+
+    RGBImageRelease();
+    _target->RGBImageRelease();
+}
+
+
+/* Reads the pixel at the (not integer) source position into _target (all channels),
+ * returns false if the position is outside of the image (the interpolation needs the neighbour pixels as well).
+ * The image has to be locked by the caller. */
+bool CRotateImage::SamplePixel(float x_source, float y_source, bool _antialiasing, uint8_t *_target)
+{
+    if (_antialiasing)
+    {
+        float x_floor = floorf(x_source);
+        float y_floor = floorf(y_source);
+        int x_source_1 = (int) x_floor;
+        int y_source_1 = (int) y_floor;
+
+        if ((x_source_1 < 0) || (x_source_1 + 1 >= width) || (y_source_1 < 0) || (y_source_1 + 1 >= height))
+            return false;
+
+        // bilinear interpolation with 8 bit fixed point weights
+        int fx = (int) ((x_source - x_floor) * 256);
+        int fy = (int) ((y_source - y_floor) * 256);
+        int w_ul = (256 - fx) * (256 - fy);
+        int w_ur = fx * (256 - fy);
+        int w_ol = (256 - fx) * fy;
+        int w_or = fx * fy;
+
+        stbi_uc* p_source_ul = rgb_image + (channels * (y_source_1 * width + x_source_1));
+        stbi_uc* p_source_ol = p_source_ul + (channels * width);
+        for (int _channels = 0; _channels < channels; ++_channels)
+            _target[_channels] = (p_source_ul[_channels] * w_ul + p_source_ul[_channels + channels] * w_ur
+                                    + p_source_ol[_channels] * w_ol + p_source_ol[_channels + channels] * w_or + 32768) >> 16;
+        return true;
+    }
+
+    int x_source_1 = (int) floorf(x_source + 0.5f);
+    int y_source_1 = (int) floorf(y_source + 0.5f);
+
+    if ((x_source_1 < 0) || (x_source_1 >= width) || (y_source_1 < 0) || (y_source_1 >= height))
+        return false;
+
+    stbi_uc* p_source = rgb_image + (channels * (y_source_1 * width + x_source_1));
+    for (int _channels = 0; _channels < channels; ++_channels)
+        _target[_channels] = p_source[_channels];
+    return true;
+}
+
+
+/* Part of the source pixel _i (covers _i .. _i + 1) inside _a0 .. _a1, 8 bit fixed point */
+static inline int Coverage(int _i, float _a0, float _a1)
+{
+    float covered = std::min(_a1, (float) (_i + 1)) - std::max(_a0, (float) _i);
+    return (covered > 0) ? (int) (covered * 256 + 0.5f) : 0;
+}
+
+
+/* Mean of the source area _size_x * _size_y centered at the (not integer) source position (box filter), each pixel
+ * weighted with its covered part. Used for downscaling instead of SamplePixel, which would skip source pixels (aliasing).
+ * Returns false if the area is completely outside of the image. The image has to be locked by the caller. */
+bool CRotateImage::SampleArea(float x_source, float y_source, float _size_x, float _size_y, uint8_t *_target)
+{
+    float x0 = x_source + 0.5f - _size_x / 2;      // pixel centers are at integer positions
+    float x1 = x0 + _size_x;
+    float y0 = y_source + 0.5f - _size_y / 2;
+    float y1 = y0 + _size_y;
+
+    int x_start = std::max((int) floorf(x0), 0);
+    int x_end = std::min((int) ceilf(x1), width);
+    int y_start = std::max((int) floorf(y0), 0);
+    int y_end = std::min((int) ceilf(y1), height);
+
+    if ((x_start >= x_end) || (y_start >= y_end))
+        return false;
+
+    // only the first and last column are covered partially
+    int w_first = Coverage(x_start, x0, x1);
+    int w_last = Coverage(x_end - 1, x0, x1);
+
+    uint32_t sum[4] = {0, 0, 0, 0};
+    uint32_t w_sum = 0;
+
+    for (int y = y_start; y < y_end; ++y)
+    {
+        int w_y = Coverage(y, y0, y1);
+        if (w_y == 0)
+            continue;
+
+        stbi_uc* p_source = rgb_image + (channels * (y * width + x_start));
+        for (int x = x_start; x < x_end; ++x, p_source += channels)
+        {
+            int w_x = (x == x_start) ? w_first : ((x == x_end - 1) ? w_last : 256);
+            int w = (w_y * w_x) >> 8;
+
+            w_sum += w;
+            for (int _channels = 0; _channels < channels; ++_channels)
+                sum[_channels] += p_source[_channels] * w;
+        }
+    }
+
+    if (w_sum == 0)
+        return false;
+
+    for (int _channels = 0; _channels < channels; ++_channels)
+        _target[_channels] = (sum[_channels] + w_sum / 2) / w_sum;
+    return true;
+}
+
+
+/* Size of the source area of one target pixel (bounding box), returns false if the transformation does not downscale
+ * (rotation only or enlarging), then the bilinear interpolation of SamplePixel is sufficient */
+bool CRotateImage::GetSampleArea(AffineTransform _transform, float &_size_x, float &_size_y)
+{
+    float (&m)[2][3] = _transform.m;
+
+    float scale_x = sqrtf(m[0][0] * m[0][0] + m[1][0] * m[1][0]);
+    float scale_y = sqrtf(m[0][1] * m[0][1] + m[1][1] * m[1][1]);
+
+    if ((scale_x <= 1.01f) && (scale_y <= 1.01f))      // tolerance for the rounding of sin / cos
+        return false;
+
+    _size_x = std::max(fabsf(m[0][0]) + fabsf(m[0][1]), 1.0f);
+    _size_y = std::max(fabsf(m[1][0]) + fabsf(m[1][1]), 1.0f);
+    return true;
+}
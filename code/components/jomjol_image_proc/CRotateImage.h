@@ -6,6 +6,18 @@
 #include "CImageBasis.h"
 
 
+/* Affine mapping from a target pixel to its source pixel:
+ * x_source = m[0][0] * x + m[0][1] * y + m[0][2]
+ * y_source = m[1][0] * x + m[1][1] * y + m[1][2] */
+struct AffineTransform
+{
+    float m[2][3] = {{1, 0, 0}, {0, 1, 0}};
+
+    bool isIdentity();
+    AffineTransform Compose(AffineTransform _inner);        // result(p) = this(_inner(p))
+};
+
+
 class CRotateImage: public CImageBasis
 {
     public:
@@ -23,6 +35,17 @@ class CRotateImage: public CImageBasis
 
         void Translate(int _dx, int _dy);
         void Mirror();
+
+        void Warp(AffineTransform _transform, bool _antialiasing, CImageBasis *_target);
+        bool SamplePixel(float x_source, float y_source, bool _antialiasing, uint8_t *_target);
+        bool SampleArea(float x_source, float y_source, float _size_x, float _size_y, uint8_t *_target);
+
+        static bool GetSampleArea(AffineTransform _transform, float &_size_x, float &_size_y);
+
+        static AffineTransform MirrorTransform(int _width);
+        static AffineTransform CropTransform(int _x, int _y, float _scale_x = 1, float _scale_y = 1);
+        static AffineTransform TranslateTransform(int _dx, int _dy);
+        static AffineTransform RotateTransform(float _angle, int _centerx, int _centery, bool _flip = false, int _org_width = 0, int _org_height = 0);
 };
 
 #endif //CROTATEIMAGE_H
\ No newline at end of file
@@ -3,7 +3,10 @@
 
 #include "esp_log.h"
 #include <time.h>
+#include <sys/stat.h>
+#include <algorithm>
 #include "ClassLogFile.h"
+#include "Helper.h"
 #include "esp_http_client.h"
 #include "../../include/defines.h"
 
@@ -46,22 +49,150 @@ static esp_err_t http_event_handler(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
-void InfluxDBPublish(std::string _key, std::string _content, std::string _timestamp) {
-    char response_buffer[MAX_HTTP_OUTPUT_BUFFER] = {0};
-    esp_http_client_config_t http_config = {
-       .user_agent = "ESP32 Meter reader",
-       .method = HTTP_METHOD_POST,
-       .event_handler = http_event_handler,
-       .buffer_size = MAX_HTTP_OUTPUT_BUFFER,
-       .user_data = response_buffer
-    };
-
-    if (_influxDBUser.length() && _influxDBPassword.length()){
-       http_config.username = _influxDBUser.c_str();
-       http_config.password = _influxDBPassword.c_str();
-       http_config.auth_type = HTTP_AUTH_TYPE_BASIC;
+static esp_http_client_handle_t http_client = NULL;    // kept open between the rounds (keep-alive)
+static std::string influxBatch = "";                    // lines of the current round
+static time_t nextTry = 0;                              // back-off after a failed POST
+static int backoff = 0;
+static long spoolOffset = 0;                            // already replayed part of the spool file
+
+
+static void InfluxDBCloseClient() {
+    if (http_client != NULL) {
+        esp_http_client_cleanup(http_client);
+        http_client = NULL;
+    }
+}
+
+
+static bool InfluxDBPost(const char* _payload, int _len) {
+    if (http_client == NULL) {
+        esp_http_client_config_t http_config = {
+           .user_agent = "ESP32 Meter reader",
+           .method = HTTP_METHOD_POST,
+           .timeout_ms = INFLUXDB_TIMEOUT_MS,
+           .event_handler = http_event_handler,
+           .buffer_size = MAX_HTTP_OUTPUT_BUFFER,
+           .keep_alive_enable = true
+        };
+
+        if (_influxDBUser.length() && _influxDBPassword.length()){
+           http_config.username = _influxDBUser.c_str();
+           http_config.password = _influxDBPassword.c_str();
+           http_config.auth_type = HTTP_AUTH_TYPE_BASIC;
+        }
+
+        // use the default retention policy of the database
+        std::string apiURI = _influxDBURI + "/api/v2/write?bucket=" + _influxDBDatabase + "/";
+        http_config.url = apiURI.c_str();
+
+        LogFile.WriteToFile(ESP_LOG_INFO, TAG, "API URI: " + apiURI);
+
+        http_client = esp_http_client_init(&http_config);
+        if (http_client == NULL) {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "HTTP client can't be initialized");
+            return false;
+        }
+        esp_http_client_set_header(http_client, "Content-Type", "text/plain");
+        LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "client is initialized");
+    }
+
+    esp_http_client_set_post_field(http_client, _payload, _len);
+
+    esp_err_t err = ESP_ERROR_CHECK_WITHOUT_ABORT(esp_http_client_perform(http_client));
+
+    if (err != ESP_OK) {
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "HTTP request failed (" + std::string(esp_err_to_name(err)) + ")");
+        InfluxDBCloseClient();     // connect again with the next request
+        return false;
+    }
+
+    int status_code = esp_http_client_get_status_code(http_client);
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "HTTP status code " + std::to_string(status_code));
+
+    if ((status_code >= 500) || (status_code == 429)) {   // server side problem, try again later
+        return false;
+    }
+    if (status_code >= 300) {     // the data is rejected, sending it again will not help
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Data rejected by the server (HTTP status code " + std::to_string(status_code) + ")");
+    }
+
+    return true;
+}
+
+
+static void InfluxDBSpool(const std::string &_lines) {
+    struct stat file_stat;
+    if ((stat(INFLUXDB_SPOOL_FILE, &file_stat) == 0) && (file_stat.st_size + _lines.length() > INFLUXDB_SPOOL_MAX_SIZE)) {
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Spool file full, data of this round is lost");
+        return;
+    }
+
+    FILE* pFile = fopen(INFLUXDB_SPOOL_FILE, "a");
+    if (pFile == NULL) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't open " + std::string(INFLUXDB_SPOOL_FILE));
+        return;
+    }
+    fwrite(_lines.c_str(), 1, _lines.length(), pFile);
+    fclose(pFile);
+
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Data spooled for a later transmission");
+}
+
+
+/* Sends the spooled lines in chunks, stops at the first failure */
+static bool InfluxDBReplaySpool() {
+    FILE* pFile = fopen(INFLUXDB_SPOOL_FILE, "r");
+    if (pFile == NULL) {
+        spoolOffset = 0;
+        return true;    // nothing spooled
+    }
+
+    char* buffer = (char*) malloc(INFLUXDB_REPLAY_CHUNK);
+    if (buffer == NULL) {
+        fclose(pFile);
+        return false;
+    }
+
+    LogFile.WriteToFile(ESP_LOG_INFO, TAG, "Replaying spooled data");
+    bool ok = true;
+
+    while (true) {
+        fseek(pFile, spoolOffset, SEEK_SET);
+        int len = fread(buffer, 1, INFLUXDB_REPLAY_CHUNK, pFile);
+        if (len <= 0) {
+            break;
+        }
+
+        if (len == INFLUXDB_REPLAY_CHUNK) {      // only send complete lines
+            while ((len > 0) && (buffer[len - 1] != '\n')) {
+                len--;
+            }
+            if (len == 0) {     // line longer than the chunk, can't be sent
+                len = INFLUXDB_REPLAY_CHUNK;
+            }
+        }
+
+        if (!InfluxDBPost(buffer, len)) {
+            ok = false;
+            break;
+        }
+        spoolOffset += len;
+    }
+
+    free(buffer);
+    fclose(pFile);
+
+    if (ok) {
+        DeleteFile(INFLUXDB_SPOOL_FILE);
+        spoolOffset = 0;
+        LogFile.WriteToFile(ESP_LOG_INFO, TAG, "Spooled data sent");
     }
 
+    return ok;
+}
+
+
+void InfluxDBPublish(std::string _key, std::string _content, std::string _timestamp) {
     LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "InfluxDBPublish - Key: " + _key + ", Content: " + _content + ", Timestamp: " + _timestamp);
 
     // Format:     #define PREVALUE_TIME_FORMAT_OUTPUT "%Y-%m-%dT%H:%M:%S%z"
@@ -73,50 +204,46 @@ void InfluxDBPublish(std::string _key, std::string _content, std::string _timest
     ptm = gmtime ( &t );
     time_t utc = mktime(ptm);
 
-//    time_t now;
-//    time(&now);
     char nowTimestamp[21];
     // pad with zeroes to get nanoseconds
-//    sprintf(nowTimestamp,"%ld000000000", (long) now);
-//    sprintf(nowTimestamp,"%ld000000000", (long) t);           // Localtime
     sprintf(nowTimestamp,"%ld000000000", (long) utc);           // UTC
-    
-
-//    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Test Time Conversion - t: " + std::to_string(t) + ", utc: " + std::to_string(utc));
-//    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Test Time Conversion - now: " + std::to_string(now) + ", timestamp: " + std::to_string(t)  + "(correct time not used yet)");
-
-    std::string payload = _influxDBMeasurement + " " + _key + "=" + _content + " " + nowTimestamp;
-    payload.shrink_to_fit();
-
-    LogFile.WriteToFile(ESP_LOG_INFO, TAG, "sending line to influxdb:" + payload);
 
+    // Only collected here, all lines of the round are sent with InfluxDBFlush()
+    influxBatch += _influxDBMeasurement + " " + _key + "=" + _content + " " + nowTimestamp + "\n";
+}
 
-    // use the default retention policy of the database
-    std::string apiURI = _influxDBURI + "/api/v2/write?bucket=" + _influxDBDatabase + "/";
-    apiURI.shrink_to_fit();
-    http_config.url = apiURI.c_str();
-
-    LogFile.WriteToFile(ESP_LOG_INFO, TAG, "API URI: " + apiURI);
 
-    esp_http_client_handle_t http_client = esp_http_client_init(&http_config);
-    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "client is initialized");
+void InfluxDBFlush() {
+    if (influxBatch.length() == 0) {
+        return;
+    }
 
-    esp_http_client_set_header(http_client, "Content-Type", "text/plain");
-    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "header is set");
+    LogFile.WriteToFile(ESP_LOG_INFO, TAG, "sending lines to influxdb:\n" + influxBatch);
 
-    ESP_ERROR_CHECK(esp_http_client_set_post_field(http_client, payload.c_str(), payload.length()));
-    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "post payload is set");
+    time_t now;
+    time(&now);
 
-    esp_err_t err = ESP_ERROR_CHECK_WITHOUT_ABORT(esp_http_client_perform(http_client));
+    if (now < nextTry) {     // server was not reachable, don't wait for the timeout in every round
+        InfluxDBSpool(influxBatch);
+    }
+    else {
+        bool sent = InfluxDBPost(influxBatch.c_str(), influxBatch.length());
+        if (!sent) {
+            InfluxDBSpool(influxBatch);
+        }
 
-    if( err == ESP_OK ) {
-      LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "HTTP request was performed");
-      int status_code = esp_http_client_get_status_code(http_client);
-      LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "HTTP status code" + std::to_string(status_code));
-    } else {
-      LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "HTTP request failed");
+        if (sent && InfluxDBReplaySpool()) {
+            backoff = 0;
+            nextTry = 0;
+        }
+        else {
+            backoff = (backoff == 0) ? INFLUXDB_BACKOFF_MIN_S : std::min(2 * backoff, INFLUXDB_BACKOFF_MAX_S);
+            nextTry = now + backoff;
+            LogFile.WriteToFile(ESP_LOG_WARN, TAG, "InfluxDB not reachable, next try in " + std::to_string(backoff) + "s");
+        }
     }
-    esp_http_client_cleanup(http_client);
+
+    influxBatch = "";
 }
 
 
@@ -126,10 +253,14 @@ void InfluxDBInit(std::string _uri, std::string _database, std::string _measurem
     _influxDBMeasurement = _measurement;
     _influxDBUser = _user;
     _influxDBPassword = _password;
- 
+
+    InfluxDBCloseClient();     // URI or credentials may have changed
+    nextTry = 0;
+    backoff = 0;
 }
 
 void InfluxDBdestroy() {
+    InfluxDBCloseClient();
 }
 
 #endif //ENABLE_INFLUXDB
@@ -12,6 +12,7 @@ void InfluxDBInit(std::string _influxDBURI, std::string _database, std::string _
 void InfluxDBdestroy();
 
 void InfluxDBPublish(std::string _key, std::string _content, std::string _timestamp);
+void InfluxDBFlush();
 
 #endif //INTERFACE_INFLUXDB_H
 #endif //ENABLE_INFLUXDB
\ No newline at end of file
@@ -0,0 +1,370 @@
+#include "ClassDataSeries.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <dirent.h>
+#ifdef __cplusplus
+}
+#endif
+
+#include "esp_log.h"
+
+#include "Helper.h"
+#include "../../include/defines.h"
+
+static const char *TAG = "DATASERIES";
+
+ClassDataSeries DataSeries(DATASERIES_ROOT, DATASERIES_FILE);
+
+
+std::string ClassDataSeries::GetNumbersFileName()
+{
+    return seriesroot + "/" + DATASERIES_NUMBERS_FILE;
+}
+
+
+void ClassDataSeries::LoadNumbers()
+{
+    numbers.clear();
+    numbersLoaded = true;
+
+    FILE* pFile = fopen(GetNumbersFileName().c_str(), "r");
+    if (pFile == NULL) {
+        return;
+    }
+
+    char zw[256];
+    while (fgets(zw, sizeof(zw), pFile) != NULL) {
+        numbers.push_back(trim(std::string(zw), "\r\n"));
+    }
+    fclose(pFile);
+}
+
+
+int ClassDataSeries::GetNumberId(std::string _name, bool _create)
+{
+    if (!numbersLoaded) {
+        LoadNumbers();
+    }
+
+    for (int i = 0; i < numbers.size(); ++i) {
+        if (numbers[i] == _name) {
+            return i;
+        }
+    }
+
+    if (!_create) {
+        return -1;
+    }
+
+    // The ids must stay stable, so new numbers are only appended
+    FILE* pFile = fopen(GetNumbersFileName().c_str(), "a");
+    if (pFile == NULL) {
+        ESP_LOGE(TAG, "Can't open %s", GetNumbersFileName().c_str());
+        return -1;
+    }
+    fputs((_name + "\n").c_str(), pFile);
+    fclose(pFile);
+
+    numbers.push_back(_name);
+    return numbers.size() - 1;
+}
+
+
+std::string ClassDataSeries::GetFileName(time_t _time)
+{
+    char buffer[60];
+    struct tm* timeinfo = localtime(&_time);
+    strftime(buffer, sizeof(buffer), seriesfile.c_str(), timeinfo);
+
+    return seriesroot + "/" + buffer;
+}
+
+
+uint32_t ClassDataSeries::GetLastTimestamp(std::string _filename)
+{
+    DataSeriesRecord record;
+    uint32_t timestamp = 0;
+
+    FILE* pFile = fopen(_filename.c_str(), "rb");
+    if (pFile == NULL) {
+        return 0;
+    }
+
+    if ((fseek(pFile, -(long) sizeof(DataSeriesRecord), SEEK_END) == 0) && (fread(&record, sizeof(DataSeriesRecord), 1, pFile) == 1)) {
+        timestamp = record.timestamp;
+    }
+    fclose(pFile);
+
+    return timestamp;
+}
+
+
+void ClassDataSeries::SetRetention(unsigned short _retentionInDays)
+{
+    retentionInDays = _retentionInDays;
+}
+
+
+void ClassDataSeries::Add(time_t _time, std::string _name, double _value, std::string _raw, double _rate, bool _error)
+{
+    DataSeriesRecord record;
+    memset(&record, 0, sizeof(record));
+
+    record.timestamp = (uint32_t) _time;
+    record.value = isfinite(_value) ? _value : 0;
+    record.rate = isfinite(_rate) ? (float) _rate : 0;
+
+    char* end = NULL;
+    record.raw = strtod(_raw.c_str(), &end);
+    if (_raw.empty() || (end == NULL) || (*end != '\0') || !isfinite(record.raw)) {
+        record.raw = 0;
+        record.flags |= DATASERIES_FLAG_RAW_INVALID;
+    }
+
+    if (_error) {
+        record.flags |= DATASERIES_FLAG_ERROR;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int id = GetNumberId(_name, true);
+    xSemaphoreGive(mutex);
+
+    if (id < 0) {
+        return;
+    }
+    record.number = id;
+
+    pending.push_back(record);
+}
+
+
+void ClassDataSeries::Flush()
+{
+    if (pending.empty()) {
+        return;
+    }
+
+    // Usually all records of a round go to the same file, so they are written with one fwrite
+    int start = 0;
+    while (start < pending.size()) {
+        std::string filename = GetFileName(pending[start].timestamp);
+        int end = start + 1;
+        while ((end < pending.size()) && (GetFileName(pending[end].timestamp) == filename)) {
+            end++;
+        }
+
+        // FindFirstRecord() needs the records of a file in time order, older ones (clock set back) are dropped
+        if (filename != lastFile) {
+            lastTimestamp = GetLastTimestamp(filename);
+            lastFile = filename;
+        }
+
+        int count = 0;
+        for (int i = start; i < end; ++i) {
+            if (pending[i].timestamp < lastTimestamp) {
+                continue;
+            }
+            lastTimestamp = pending[i].timestamp;
+            pending[start + count++] = pending[i];
+        }
+
+        if (count < end - start) {
+            ESP_LOGW(TAG, "%d record(s) older than the last one in %s dropped", end - start - count, filename.c_str());
+        }
+
+        if (count > 0) {
+            FILE* pFile = fopen(filename.c_str(), "ab");
+            if (pFile == NULL) {
+                ESP_LOGE(TAG, "Can't open %s", filename.c_str());
+                break;
+            }
+            fwrite(&pending[start], sizeof(DataSeriesRecord), count, pFile);
+            fclose(pFile);
+        }
+
+        start = end;
+    }
+
+    pending.clear();
+}
+
+
+long ClassDataSeries::FindFirstRecord(FILE* _file, long _count, uint32_t _from)
+{
+    DataSeriesRecord record;
+    long lo = 0;
+    long hi = _count;
+
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if ((fseek(_file, mid * sizeof(DataSeriesRecord), SEEK_SET) != 0) ||
+                (fread(&record, sizeof(DataSeriesRecord), 1, _file) != 1)) {
+            return _count;
+        }
+
+        if (record.timestamp < _from) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+
+/* Calls _callback for all records of the number _name between _from and _to (both inclusive).
+ * With _points > 0 the range is split into _points intervals of equal length and only the last record
+ * of each interval is returned. */
+bool ClassDataSeries::Query(std::string _name, time_t _from, time_t _to, int _points, std::function<void(const DataSeriesRecord&)> _callback)
+{
+    if (_to < _from) {
+        return false;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int id = GetNumberId(_name, false);
+    xSemaphoreGive(mutex);
+
+    if (id < 0) {
+        return false;
+    }
+
+    double intervalLength = 0;
+    if (_points > 0) {
+        intervalLength = (double)(_to - _from + 1) / _points;
+    }
+
+    DataSeriesRecord* records = (DataSeriesRecord*) malloc(DATASERIES_READ_CHUNK * sizeof(DataSeriesRecord));
+    if (records == NULL) {
+        ESP_LOGE(TAG, "Can't allocate the read buffer");
+        return false;
+    }
+
+    DataSeriesRecord last;
+    bool lastValid = false;
+    long lastInterval = -1;
+    bool done = false;
+
+    std::string lastFilename = GetFileName(_to);
+    std::string filename = "";
+    time_t day = _from;
+
+    for (int i = 0; (i < DATASERIES_MAX_QUERY_DAYS) && !done; ++i, day = addDays(day, 1)) {
+        filename = GetFileName(day);
+        done = (filename >= lastFilename);
+
+        FILE* pFile = fopen(filename.c_str(), "rb");
+        if (pFile == NULL) {
+            continue;   // no readings on this day
+        }
+
+        fseek(pFile, 0, SEEK_END);
+        long count = ftell(pFile) / sizeof(DataSeriesRecord);
+        long pos = FindFirstRecord(pFile, count, (uint32_t) _from);
+        fseek(pFile, pos * sizeof(DataSeriesRecord), SEEK_SET);
+
+        bool endReached = false;
+        while ((pos < count) && !endReached) {
+            int anz = fread(records, sizeof(DataSeriesRecord), DATASERIES_READ_CHUNK, pFile);
+            if (anz <= 0) {
+                break;
+            }
+            pos += anz;
+
+            for (int j = 0; j < anz; ++j) {
+                if (records[j].timestamp > (uint32_t) _to) {
+                    endReached = true;
+                    break;
+                }
+                if ((records[j].number != id) || (records[j].timestamp < (uint32_t) _from)) {
+                    continue;
+                }
+
+                if (intervalLength == 0) {
+                    _callback(records[j]);
+                    continue;
+                }
+
+                long interval = (long)((records[j].timestamp - _from) / intervalLength);
+                if (lastValid && (interval != lastInterval)) {
+                    _callback(last);
+                }
+                last = records[j];
+                lastValid = true;
+                lastInterval = interval;
+            }
+        }
+        fclose(pFile);
+
+        if (endReached) {
+            done = true;
+        }
+    }
+
+    if (lastValid) {
+        _callback(last);
+    }
+
+    free(records);
+    return true;
+}
+
+
+void ClassDataSeries::RemoveOldFiles()
+{
+    if (retentionInDays == 0) {
+        return;
+    }
+
+    time_t rawtime;
+    struct tm* timeinfo;
+    char cmpfilename[30];
+
+    time(&rawtime);
+    rawtime = addDays(rawtime, -retentionInDays + 1);
+    timeinfo = localtime(&rawtime);
+    strftime(cmpfilename, 30, seriesfile.c_str(), timeinfo);
+
+    DIR *dir = opendir(seriesroot.c_str());
+    if (!dir) {
+        ESP_LOGE(TAG, "Failed to stat dir: %s", seriesroot.c_str());
+        return;
+    }
+
+    struct dirent *entry;
+    int deleted = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if ((entry->d_type == DT_REG) && (strlen(entry->d_name) == strlen(cmpfilename)) && (strcmp(entry->d_name, cmpfilename) < 0)) {
+            std::string filepath = seriesroot + "/" + entry->d_name;
+            if (unlink(filepath.c_str()) == 0) {
+                deleted ++;
+            } else {
+                ESP_LOGE(TAG, "can't delete file: %s", entry->d_name);
+            }
+        }
+    }
+
+    ESP_LOGD(TAG, "data series files deleted: %d", deleted);
+    closedir(dir);
+}
+
+
+ClassDataSeries::ClassDataSeries(std::string _seriesroot, std::string _seriesfile)
+{
+    seriesroot = _seriesroot;
+    seriesfile = _seriesfile;
+    numbersLoaded = false;
+    retentionInDays = 90;
+    lastTimestamp = 0;
+    mutex = xSemaphoreCreateMutex();
+}
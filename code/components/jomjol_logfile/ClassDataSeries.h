@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef CLASSDATASERIES_H
+#define CLASSDATASERIES_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+
+#define DATASERIES_FLAG_ERROR       0x01    // value was not accepted (error message != "no error")
+#define DATASERIES_FLAG_RAW_INVALID 0x02    // raw value is not a number (e.g. contains "N")
+
+
+/* Fixed size record (32 bytes) of the binary time series store.
+ * The records of one day are appended in time order, so a time range can be found by a binary search. */
+struct DataSeriesRecord {
+    uint32_t timestamp;         // unix time of the image
+    uint16_t number;            // number id, line index in DATASERIES_NUMBERS_FILE of the series root
+    uint16_t flags;             // DATASERIES_FLAG_*
+    double value;
+    double raw;
+    float rate;
+    uint32_t reserved;
+};
+
+
+class ClassDataSeries
+{
+private:
+    std::string seriesroot;
+    std::string seriesfile;
+    std::vector<std::string> numbers;
+    bool numbersLoaded;
+    SemaphoreHandle_t mutex;        // protects the number ids (flow task vs. web server)
+    std::vector<DataSeriesRecord> pending;
+    unsigned short retentionInDays;
+    std::string lastFile;           // file of the last written record
+    uint32_t lastTimestamp;         // its timestamp, records of a file must be in time order
+
+    std::string GetNumbersFileName();
+    void LoadNumbers();
+    int GetNumberId(std::string _name, bool _create);
+    std::string GetFileName(time_t _time);
+    uint32_t GetLastTimestamp(std::string _filename);
+    long FindFirstRecord(FILE* _file, long _count, uint32_t _from);
+
+public:
+    ClassDataSeries(std::string _seriesroot, std::string _seriesfile);
+
+    void SetRetention(unsigned short _retentionInDays);
+
+    void Add(time_t _time, std::string _name, double _value, std::string _raw, double _rate, bool _error);
+    void Flush();
+    void RemoveOldFiles();
+
+    bool Query(std::string _name, time_t _from, time_t _to, int _points, std::function<void(const DataSeriesRecord&)> _callback);
+};
+
+extern ClassDataSeries DataSeries;
+
+#endif //CLASSDATASERIES_H
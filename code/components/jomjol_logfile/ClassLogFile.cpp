@@ -6,6 +6,12 @@
 #include <sys/stat.h>
 #include <algorithm>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -31,50 +37,71 @@ void ClassLogFile::WriteHeapInfo(std::string _id)
 }
 
 
+static SemaphoreHandle_t dataFileMutex = NULL;     // FlushDataLog (flow task) vs. CloseDataLogAppendHandle (web server)
+
+
 void ClassLogFile::WriteToData(std::string _timestamp, std::string _name, std::string  _ReturnRawValue, std::string  _ReturnValue, std::string  _ReturnPreValue, std::string  _ReturnRateValue, std::string  _ReturnChangeAbsolute, std::string  _ErrorMessageText, std::string  _digital, std::string  _analog)
 {
-    ESP_LOGD(TAG, "Start WriteToData");
-    time_t rawtime;
-    struct tm* timeinfo;
-    char buffer[30];
+    // Only collect the line, all lines of a round are written with FlushDataLog()
+    dataBlock += _timestamp + "," + _name + "," + _ReturnRawValue + "," + _ReturnValue + "," + _ReturnPreValue + "," + 
+            _ReturnRateValue + "," + _ReturnChangeAbsolute + "," + _ErrorMessageText + _digital + _analog + "\n";
+}
 
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
 
-    strftime(buffer, 30, datafile.c_str(), timeinfo);
-    std::string logpath = dataroot + "/" + buffer; 
-    
-    FILE* pFile;
-    std::string zwtime;
-
-    ESP_LOGD(TAG, "Datalogfile: %s", logpath.c_str());
-    pFile = fopen(logpath.c_str(), "a+");
-
-    if (pFile!=NULL) {
-        fputs(_timestamp.c_str(), pFile);
-        fputs(",", pFile);
-        fputs(_name.c_str(), pFile);
-        fputs(",", pFile);
-        fputs(_ReturnRawValue.c_str(), pFile);
-        fputs(",", pFile);
-        fputs(_ReturnValue.c_str(), pFile);
-        fputs(",", pFile);
-        fputs(_ReturnPreValue.c_str(), pFile);
-        fputs(",", pFile);
-        fputs(_ReturnRateValue.c_str(), pFile);
-        fputs(",", pFile);
-        fputs(_ReturnChangeAbsolute.c_str(), pFile);
-        fputs(",", pFile);
-        fputs(_ErrorMessageText.c_str(), pFile);
-        fputs(_digital.c_str(), pFile);
-        fputs(_analog.c_str(), pFile);
-        fputs("\n", pFile);
-
-        fclose(pFile);    
-    } else {
-        ESP_LOGE(TAG, "Can't open data file %s", logpath.c_str());
+void ClassLogFile::FlushDataLog()
+{
+    if (dataBlock.empty()) {
+        return;
+    }
+
+    std::string logpath = GetCurrentFileNameData();
+
+    xSemaphoreTake(dataFileMutex, portMAX_DELAY);
+
+    if ((dataFileHandle != NULL) && (logpath != dataFileName)) { // New day -> new file
+        fclose(dataFileHandle);
+        dataFileHandle = NULL;
+    }
+
+    if (dataFileHandle == NULL) {
+        ESP_LOGD(TAG, "Datalogfile: %s", logpath.c_str());
+        dataFileHandle = fopen(logpath.c_str(), "a+");
+        if (dataFileHandle == NULL) {
+            ESP_LOGE(TAG, "Can't open data file %s", logpath.c_str());
+            dataBlock = "";
+            xSemaphoreGive(dataFileMutex);
+            return;
+        }
+        dataFileName = logpath;
+        dataLogRoundsSinceSync = 0;
     }
 
+    if (fwrite(dataBlock.c_str(), 1, dataBlock.length(), dataFileHandle) != dataBlock.length()) {
+        ESP_LOGE(TAG, "Can't write data file %s", logpath.c_str());
+    }
+    dataBlock = "";
+    fflush(dataFileHandle);
+
+    dataLogRoundsSinceSync++;
+    if ((dataLogSyncInterval > 0) && (dataLogRoundsSinceSync >= dataLogSyncInterval)) {
+        fsync(fileno(dataFileHandle));
+        dataLogRoundsSinceSync = 0;
+    }
+
+    xSemaphoreGive(dataFileMutex);
+}
+
+
+void ClassLogFile::CloseDataLogAppendHandle()
+{
+    xSemaphoreTake(dataFileMutex, portMAX_DELAY);
+    if (dataFileHandle != NULL) {
+        fclose(dataFileHandle);
+        dataFileHandle = NULL;
+        dataFileName = "";
+        dataLogRoundsSinceSync = 0;
+    }
+    xSemaphoreGive(dataFileMutex);
 }
 
 
@@ -132,24 +159,182 @@ bool ClassLogFile::GetDataLogToSD(){
 }
 
 
+void ClassLogFile::SetDataLogSyncInterval(unsigned short _DataLogSyncInterval){
+    dataLogSyncInterval = _DataLogSyncInterval;
+}
+
+
 static FILE* logFileAppendHandle = NULL;
 std::string fileNameDate;
 
-void ClassLogFile::WriteToFile(esp_log_level_t level, std::string tag, std::string message, bool _time)
+/* The log lines are collected in one of two buffers (PSRAM) and written to the SD card by a low priority task
+ * in large blocks. The producers only copy their line into the active buffer, the writer task swaps the buffers
+ * and writes the filled one. Until the writer task is started (or if the buffers can't be allocated), the lines
+ * are written directly to the file as before. */
+static char* logBuffer[2] = {NULL, NULL};
+static int logBufferActive = 0;
+static int logBufferLen = 0;
+static int logBufferDropped = 0;
+static volatile unsigned int logFlushCount = 0;
+static SemaphoreHandle_t logBufferMutex = NULL;     // Protects the active buffer, held only for a memcpy
+static SemaphoreHandle_t logFileMutex = NULL;       // Serializes the SD writes (writer task, flush, close)
+static TaskHandle_t xHandleTaskLogFileWriter = NULL;
+
+
+static void task_LogFileWriter(void *pvParameter)
 {
-    time_t rawtime;
-    struct tm* timeinfo;
-    std::string fileNameDateNew;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LOGFILE_FLUSH_INTERVAL_MS));
+        LogFile.FlushLogBuffer();
+    }
+}
 
-    std::string zwtime;
-    std::string ntpTime = "";
 
+static void LogFileShutdownHandler()
+{
+    // Called by esp_restart: Let the writer task write the remaining lines (it has the stack for the file system)
+    if ((xHandleTaskLogFileWriter == NULL) || (xTaskGetCurrentTaskHandle() == xHandleTaskLogFileWriter)) {
+        return;
+    }
+
+    unsigned int flushCount = logFlushCount;
+    xTaskNotifyGive(xHandleTaskLogFileWriter);
+
+    for (int i = 0; (i < LOGFILE_SHUTDOWN_TIMEOUT_MS / 10) && (flushCount == logFlushCount); i++) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
+
+
+bool ClassLogFile::StartLogFileWriter()
+{
+    if (xHandleTaskLogFileWriter != NULL) {
+        return true;
+    }
+
+    logBuffer[0] = (char*) GET_MEMORY(LOGFILE_BUFFER_SIZE);
+    logBuffer[1] = (char*) GET_MEMORY(LOGFILE_BUFFER_SIZE);
+    logBufferMutex = xSemaphoreCreateMutex();
+    logFileMutex = xSemaphoreCreateMutex();
+
+    if ((logBuffer[0] == NULL) || (logBuffer[1] == NULL) || (logBufferMutex == NULL) || (logFileMutex == NULL)) {
+        ESP_LOGE(TAG, "Can't allocate the log buffers, log lines are written directly");
+        // Nothing has been buffered yet, so everything can be released again
+        heap_caps_free(logBuffer[0]);
+        heap_caps_free(logBuffer[1]);
+        logBuffer[0] = logBuffer[1] = NULL;
+        if (logBufferMutex != NULL) {
+            vSemaphoreDelete(logBufferMutex);
+            logBufferMutex = NULL;
+        }
+        if (logFileMutex != NULL) {
+            vSemaphoreDelete(logFileMutex);
+            logFileMutex = NULL;
+        }
+        return false;
+    }
+
+    BaseType_t xReturned = xTaskCreate(&task_LogFileWriter, "task_LogFileWriter", 4 * 1024, NULL, tskIDLE_PRIORITY+1, &xHandleTaskLogFileWriter);
+    if (xReturned != pdPASS) {
+        ESP_LOGE(TAG, "Can't create the log writer task, log lines are written directly");
+        xHandleTaskLogFileWriter = NULL;
+        return false;
+    }
+
+    esp_register_shutdown_handler(&LogFileShutdownHandler);
+
+    ESP_LOGI(TAG, "Log writer task started (buffer: 2 x %d bytes)", LOGFILE_BUFFER_SIZE);
+    return true;
+}
+
+
+void ClassLogFile::FlushLogBuffer()
+{
+    if (xHandleTaskLogFileWriter == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(logFileMutex, portMAX_DELAY);
+
+    xSemaphoreTake(logBufferMutex, portMAX_DELAY);
+    char* data = logBuffer[logBufferActive];
+    int len = logBufferLen;
+    int dropped = logBufferDropped;
+    logBufferActive = 1 - logBufferActive;
+    logBufferLen = 0;
+    logBufferDropped = 0;
+    xSemaphoreGive(logBufferMutex);
+
+    if (len > 0) {
+        WriteLogLinesToFile(data, len);
+    }
+
+    if (dropped > 0) {
+        std::string zw = "[" + getFormatedUptime(true) + "] \t<WRN>\t[" + std::string(TAG) + "] " + 
+                std::to_string(dropped) + " log lines dropped, log buffer was full\n";
+        WriteLogLinesToFile(zw.c_str(), zw.length());
+    }
+
+    logFlushCount++;
+    xSemaphoreGive(logFileMutex);
+}
+
+
+void ClassLogFile::WriteLogLinesToFile(const char *_data, int _len)
+{
+    time_t rawtime;
+    struct tm* timeinfo;
+    char buf[30];
 
     time(&rawtime);
     timeinfo = localtime(&rawtime);
-    char buf[30];
     strftime(buf, sizeof(buf), logfile.c_str(), timeinfo);
-    fileNameDateNew = std::string(buf);
+    std::string fileNameDateNew = std::string(buf);
+
+#ifdef KEEP_LOGFILE_OPEN_FOR_APPENDING
+    if (fileNameDateNew != fileNameDate) { // Filename changed
+        // Make sure each day gets its own logfile
+        // Also we need to re-open it in case it needed to get closed for reading
+        if (logFileAppendHandle != NULL) {
+            fclose(logFileAppendHandle);
+            logFileAppendHandle = NULL;
+        }
+
+        std::string logpath = logroot + "/" + fileNameDateNew; 
+
+        ESP_LOGI(TAG, "Opening logfile %s for appending", logpath.c_str());
+        logFileAppendHandle = fopen(logpath.c_str(), "a+");
+        if (logFileAppendHandle==NULL) {
+            ESP_LOGE(TAG, "Can't open log file %s", logpath.c_str());
+            return;
+        }
+
+        fileNameDate = fileNameDateNew;
+    }
+#else
+    std::string logpath = logroot + "/" + fileNameDateNew; 
+    logFileAppendHandle = fopen(logpath.c_str(), "a+");
+    if (logFileAppendHandle==NULL) {
+        ESP_LOGE(TAG, "Can't open log file %s", logpath.c_str());
+        return;
+    }
+#endif
+
+    fwrite(_data, 1, _len, logFileAppendHandle);
+    
+#ifdef KEEP_LOGFILE_OPEN_FOR_APPENDING
+    fflush(logFileAppendHandle);
+    fsync(fileno(logFileAppendHandle));
+#else
+    fclose(logFileAppendHandle);
+    logFileAppendHandle = NULL;
+#endif
+}
+
+
+void ClassLogFile::WriteToFile(esp_log_level_t level, std::string tag, std::string message, bool _time)
+{
+    std::string ntpTime = "";
 
     std::replace(message.begin(), message.end(), '\n', ' '); // Replace all newline characters
 
@@ -169,6 +354,12 @@ void ClassLogFile::WriteToFile(esp_log_level_t level, std::string tag, std::stri
 
     if (_time)
     {
+        time_t rawtime;
+        struct tm* timeinfo;
+
+        time(&rawtime);
+        timeinfo = localtime(&rawtime);
+
         char logLineDate[30];
         strftime(logLineDate, sizeof(logLineDate), "%Y-%m-%dT%H:%M:%S", timeinfo);
         ntpTime = std::string(logLineDate);
@@ -202,46 +393,43 @@ void ClassLogFile::WriteToFile(esp_log_level_t level, std::string tag, std::stri
     std::string fullmessage = "[" + formatedUptime + "] "  + ntpTime + "\t<" + loglevelString + ">\t" + message + "\n";
 
 
-#ifdef KEEP_LOGFILE_OPEN_FOR_APPENDING
-    if (fileNameDateNew != fileNameDate) { // Filename changed
-        // Make sure each day gets its own logfile
-        // Also we need to re-open it in case it needed to get closed for reading
-        std::string logpath = logroot + "/" + fileNameDateNew; 
-
-        ESP_LOGI(TAG, "Opening logfile %s for appending", logpath.c_str());
-        logFileAppendHandle = fopen(logpath.c_str(), "a+");
-        if (logFileAppendHandle==NULL) {
-            ESP_LOGE(TAG, "Can't open log file %s", logpath.c_str());
-            return;
-        }
+    if (xHandleTaskLogFileWriter == NULL) { // Writer task not (yet) running
+        WriteLogLinesToFile(fullmessage.c_str(), fullmessage.length());
+        return;
+    }
 
-        fileNameDate = fileNameDateNew;
+    xSemaphoreTake(logBufferMutex, portMAX_DELAY);
+    if (logBufferLen + (int)fullmessage.length() <= LOGFILE_BUFFER_SIZE) {
+        memcpy(logBuffer[logBufferActive] + logBufferLen, fullmessage.c_str(), fullmessage.length());
+        logBufferLen += fullmessage.length();
     }
-#else
-    std::string logpath = logroot + "/" + fileNameDateNew; 
-    logFileAppendHandle = fopen(logpath.c_str(), "a+");
-    if (logFileAppendHandle==NULL) {
-        ESP_LOGE(TAG, "Can't open log file %s", logpath.c_str());
-        return;
+    else {
+        logBufferDropped++;
     }
-  #endif
+    bool wakeWriter = (logBufferLen >= LOGFILE_FLUSH_THRESHOLD) || (level == ESP_LOG_ERROR);
+    xSemaphoreGive(logBufferMutex);
 
-    fputs(fullmessage.c_str(), logFileAppendHandle);
-    
-#ifdef KEEP_LOGFILE_OPEN_FOR_APPENDING
-    fflush(logFileAppendHandle);
-    fsync(fileno(logFileAppendHandle));
-#else
-    CloseLogFileAppendHandle();
-#endif
+    if (wakeWriter) { // Errors are written soon, so they are on the card if the device crashes afterwards
+        xTaskNotifyGive(xHandleTaskLogFileWriter);
+    }
 }
 
 
 void ClassLogFile::CloseLogFileAppendHandle() {
+    FlushLogBuffer();
+
+    if (logFileMutex != NULL) {
+        xSemaphoreTake(logFileMutex, portMAX_DELAY);
+    }
+
     if (logFileAppendHandle != NULL) {
         fclose(logFileAppendHandle);
         logFileAppendHandle = NULL;
-        fileNameDate = "";
+    }
+    fileNameDate = "";
+
+    if (logFileMutex != NULL) {
+        xSemaphoreGive(logFileMutex);
     }
 }
 
@@ -390,6 +578,7 @@ void ClassLogFile::CreateLogDirectories()
 {
     MakeDir("/sdcard/log");
     MakeDir("/sdcard/log/data");
+    MakeDir("/sdcard/log/series");
     MakeDir("/sdcard/log/analog");
     MakeDir("/sdcard/log/digit");
     MakeDir("/sdcard/log/message");
@@ -406,5 +595,9 @@ ClassLogFile::ClassLogFile(std::string _logroot, std::string _logfile, std::stri
     logFileRetentionInDays = 3;
     dataLogRetentionInDays = 3;
     doDataLogToSD = true;
+    dataLogSyncInterval = 1;
+    dataLogRoundsSinceSync = 0;
+    dataFileHandle = NULL;
+    dataFileMutex = xSemaphoreCreateMutex();
     loglevel = ESP_LOG_INFO;
 }
@@ -18,7 +18,14 @@ private:
     unsigned short logFileRetentionInDays;
     unsigned short dataLogRetentionInDays;
     bool doDataLogToSD;
+    unsigned short dataLogSyncInterval;
+    int dataLogRoundsSinceSync;
+    std::string dataBlock;
+    std::string dataFileName;
+    FILE* dataFileHandle;
     esp_log_level_t loglevel;
+
+    void WriteLogLinesToFile(const char *_data, int _len);
 public:
     ClassLogFile(std::string _logpath, std::string _logfile, std::string _logdatapath, std::string _datafile);
 
@@ -29,12 +36,16 @@ public:
     void SetDataLogRetention(unsigned short _DataLogRetentionInDays);
     void SetDataLogToSD(bool _doDataLogToSD);
     bool GetDataLogToSD();
+    void SetDataLogSyncInterval(unsigned short _DataLogSyncInterval);
 
     void WriteToFile(esp_log_level_t level, std::string tag, std::string message, bool _time);
     void WriteToFile(esp_log_level_t level, std::string tag, std::string message);
 
     void CloseLogFileAppendHandle();
 
+    bool StartLogFileWriter();
+    void FlushLogBuffer();
+
     void CreateLogDirectories();
     void RemoveOldLogFile();
     void RemoveOldDataLog();
@@ -43,6 +54,9 @@ public:
     void WriteToData(std::string _timestamp, std::string _name, std::string  _ReturnRawValue, std::string  _ReturnValue, std::string  _ReturnPreValue, std::string  _ReturnRateValue, std::string  _ReturnChangeAbsolute, std::string  _ErrorMessageText, std::string  _digital, std::string  _analog);
 
 
+    void FlushDataLog();
+    void CloseDataLogAppendHandle();
+
     std::string GetCurrentFileName();
     std::string GetCurrentFileNameData();
 };
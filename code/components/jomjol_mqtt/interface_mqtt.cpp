@@ -2,10 +2,18 @@
 #include "interface_mqtt.h"
 
 #include "esp_log.h"
+#include <time.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
 #include "connect_wlan.h"
 #include "mqtt_client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "ClassLogFile.h"
 #include "server_tflite.h"
+#include "Helper.h"
 #include "../../include/defines.h"
 
 static const char *TAG = "MQTT IF";
@@ -14,6 +22,21 @@ std::map<std::string, std::function<void()>>* connectFunktionMap = NULL;
 std::map<std::string, std::function<bool(std::string, char*, int)>>* subscribeFunktionMap = NULL;
 
 int failedOnRound = -1;
+
+struct MQTTPublishCacheEntry {
+    size_t hash;                // hash of the last published content
+    time_t published;
+};
+
+std::map<std::string, MQTTPublishCacheEntry> publishCache;
+static SemaphoreHandle_t publishCacheMutex = NULL;     // flow task vs. MQTT event task (GotConnected)
+int publishMaxAge = 0;                          // Seconds, 0 = every publish is sent
+volatile bool publishCacheInvalid = false;      // set on (re-)connect, everything gets published again
+
+static SemaphoreHandle_t queueMutex = NULL;    // MQTT_QUEUE_FILE, queueOffset, queueDepth (flow task vs. /metrics)
+long queueOffset = 0;                           // position of the first not yet published message in MQTT_QUEUE_FILE
+int queueDepth = -1;                            // number of queued messages, -1 = not counted yet
+uint32_t queueDropped = 0;                      // messages lost because the queue was full
  
 esp_mqtt_event_id_t esp_mqtt_ID = MQTT_EVENT_ANY;
 // ESP_EVENT_ANY_ID
@@ -29,7 +52,7 @@ int keepalive, SetRetainFlag;
 void (*callbackOnConnected)(std::string, int) = NULL;
 
 
-bool MQTTPublish(std::string _key, std::string _content, int retained_flag) 
+bool MQTTPublish(std::string _key, std::string _content, int retained_flag, int _qos) 
 {
     if (!mqtt_enabled) {                            // MQTT sevice not started / configured (MQTT_Init not called before)      
         return false;
@@ -49,7 +72,7 @@ bool MQTTPublish(std::string _key, std::string _content, int retained_flag)
         #ifdef DEBUG_DETAIL_ON 
             long long int starttime = esp_timer_get_time();
         #endif
-        int msg_id = esp_mqtt_client_publish(client, _key.c_str(), _content.c_str(), 0, 1, retained_flag);
+        int msg_id = esp_mqtt_client_publish(client, _key.c_str(), _content.c_str(), 0, _qos, retained_flag);
         #ifdef DEBUG_DETAIL_ON 
             ESP_LOGD(TAG, "Publish msg_id %d in %lld ms", msg_id, (esp_timer_get_time() - starttime)/1000);
         #endif
@@ -58,7 +81,7 @@ bool MQTTPublish(std::string _key, std::string _content, int retained_flag)
             #ifdef DEBUG_DETAIL_ON 
                 starttime = esp_timer_get_time();
             #endif
-            msg_id = esp_mqtt_client_publish(client, _key.c_str(), _content.c_str(), 0, 1, retained_flag);
+            msg_id = esp_mqtt_client_publish(client, _key.c_str(), _content.c_str(), 0, _qos, retained_flag);
             #ifdef DEBUG_DETAIL_ON 
                 ESP_LOGD(TAG, "Publish msg_id %d in %lld ms", msg_id, (esp_timer_get_time() - starttime)/1000);
             #endif
@@ -84,6 +107,318 @@ bool MQTTPublish(std::string _key, std::string _content, int retained_flag)
 }
 
 
+/* Format of MQTT_QUEUE_FILE per message: "<retain> <qos> <length> <topic>\n<content>\n" */
+static bool MQTTReadQueueEntry(FILE* _file, std::string &_topic, std::string &_content, int &_retain, int &_qos)
+{
+    char header[300];
+    int len = 0;
+    int pos = 0;
+
+    if ((fgets(header, sizeof(header), _file) == NULL) ||
+            (sscanf(header, "%d %d %d %n", &_retain, &_qos, &len, &pos) != 3) || (pos == 0) ||
+            (len < 0) || (len > MQTT_QUEUE_MAX_SIZE)) {
+        return false;
+    }
+
+    _topic = trim(std::string(header + pos), "\r\n");
+    _content.resize(len);
+    if ((len > 0) && (fread(&_content[0], 1, len, _file) != len)) {
+        return false;
+    }
+    fgetc(_file);   // '\n' after the content
+
+    return true;
+}
+
+
+/* Cuts the queue at an entry which can't be read, the entries behind it can't be found anymore */
+static void MQTTTruncateQueue(long _offset)
+{
+    LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Invalid entry in " + std::string(MQTT_QUEUE_FILE) + " at offset " +
+                        std::to_string(_offset) + ", the queue is truncated there");
+
+    if ((_offset == 0) || (truncate(MQTT_QUEUE_FILE, _offset) != 0)) {
+        DeleteFile(MQTT_QUEUE_FILE);
+        queueOffset = 0;
+    }
+}
+
+
+/* Reads the next entry at the current position. Returns false at the end of the queue, an invalid
+ * entry ends the queue as well, its offset is returned in _invalidOffset (otherwise -1). */
+static bool MQTTReadNextQueueEntry(FILE* _file, std::string &_topic, std::string &_content, int &_retain, int &_qos, long &_invalidOffset)
+{
+    long offset = ftell(_file);
+    _invalidOffset = -1;
+
+    if (MQTTReadQueueEntry(_file, _topic, _content, _retain, _qos)) {
+        return true;
+    }
+
+    struct stat file_stat;
+    if ((stat(MQTT_QUEUE_FILE, &file_stat) == 0) && (offset < file_stat.st_size)) {
+        _invalidOffset = offset;
+    }
+    return false;
+}
+
+
+/* The MQTT_QUEUE_FILE functions below expect queueMutex to be taken */
+static void MQTTCountQueue()
+{
+    std::string topic, content;
+    int retain, qos;
+
+    queueDepth = 0;
+
+    FILE* pFile = fopen(MQTT_QUEUE_FILE, "r");
+    if (pFile == NULL) {
+        return;
+    }
+
+    long invalidOffset;
+
+    fseek(pFile, queueOffset, SEEK_SET);
+    while (MQTTReadNextQueueEntry(pFile, topic, content, retain, qos, invalidOffset)) {
+        queueDepth++;
+    }
+    fclose(pFile);
+
+    if (invalidOffset >= 0) {   // otherwise new messages would be appended behind it and never be found
+        MQTTTruncateQueue(invalidOffset);
+    }
+}
+
+
+static bool MQTTQueueMessage(std::string &_key, std::string &_content, int _retain, int _qos)
+{
+    if (queueDepth < 0) {
+        MQTTCountQueue();
+    }
+
+    struct stat file_stat;
+    if ((stat(MQTT_QUEUE_FILE, &file_stat) == 0) && (file_stat.st_size + _key.length() + _content.length() + 20 > MQTT_QUEUE_MAX_SIZE)) {
+        queueDropped++;
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Queue full, message lost (topic: " + _key + ")");
+        return false;
+    }
+
+    FILE* pFile = fopen(MQTT_QUEUE_FILE, "a");
+    if (pFile == NULL) {
+        queueDropped++;
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't open " + std::string(MQTT_QUEUE_FILE));
+        return false;
+    }
+    fprintf(pFile, "%d %d %d %s\n", _retain, _qos, (int)_content.length(), _key.c_str());
+    fwrite(_content.c_str(), 1, _content.length(), pFile);
+    fputc('\n', pFile);
+    fclose(pFile);
+
+    queueDepth++;
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Message queued for a later publish (topic: " + _key + ", queue depth: " + std::to_string(queueDepth) + ")");
+    return true;
+}
+
+
+/* Publishes up to MQTT_QUEUE_REPLAY_MAX queued messages (MQTT_QUEUE_REPLAY_MAX_BYTES of content) in their original order.
+ * The replay pauses as long as more than MQTT_QUEUE_REPLAY_MAX_OUTBOX bytes wait for the acknowledge of the broker.
+ * Returns true if the queue is empty afterwards.
+ * The replay position is only kept in RAM, after a reboot in the middle of a replay some messages are sent twice (QoS 1 semantics) */
+static bool MQTTReplayQueueLocked()
+{
+    if (queueDepth < 0) {
+        MQTTCountQueue();
+    }
+
+    if (queueDepth == 0) {
+        return true;
+    }
+
+    if (!mqtt_initialized || !mqtt_connected || (failedOnRound == getCountFlowRounds())) {
+        return false;
+    }
+
+    FILE* pFile = fopen(MQTT_QUEUE_FILE, "r");
+    if (pFile == NULL) {
+        queueDepth = 0;
+        queueOffset = 0;
+        return true;
+    }
+
+    LogFile.WriteToFile(ESP_LOG_INFO, TAG, "Publishing " + std::to_string(queueDepth) + " queued messages");
+
+    std::string topic, content;
+    int retain, qos;
+    int sent = 0;
+    size_t sentBytes = 0;
+    long invalidOffset = -1;
+    bool done = false;
+
+    fseek(pFile, queueOffset, SEEK_SET);
+    while ((sent < MQTT_QUEUE_REPLAY_MAX) && (sentBytes < MQTT_QUEUE_REPLAY_MAX_BYTES)) {
+        if (esp_mqtt_client_get_outbox_size(client) > MQTT_QUEUE_REPLAY_MAX_OUTBOX) {
+            LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Outbox full, replay continued in the next round");
+            break;
+        }
+
+        if (!MQTTReadNextQueueEntry(pFile, topic, content, retain, qos, invalidOffset)) {
+            done = true;
+            break;
+        }
+
+        if (esp_mqtt_client_publish(client, topic.c_str(), content.c_str(), content.length(), qos, retain) == -1) {
+            LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Failed to publish queued topic '" + topic + "', retry in the next round");
+            failedOnRound = getCountFlowRounds();
+            break;
+        }
+
+        queueOffset = ftell(pFile);
+        queueDepth--;
+        sent++;
+        sentBytes += topic.length() + content.length();
+    }
+    fclose(pFile);
+
+    if (invalidOffset >= 0) {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Invalid entry in " + std::string(MQTT_QUEUE_FILE) + " at offset " +
+                            std::to_string(invalidOffset) + ", the remaining messages are dropped");
+    }
+
+    if (done) {
+        DeleteFile(MQTT_QUEUE_FILE);
+        queueOffset = 0;
+        queueDepth = 0;
+        LogFile.WriteToFile(ESP_LOG_INFO, TAG, "All queued messages published");
+    }
+
+    return done;
+}
+
+
+bool MQTTReplayQueue()
+{
+    if (queueMutex == NULL) {       // not configured yet
+        return true;
+    }
+
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+    bool result = MQTTReplayQueueLocked();
+    xSemaphoreGive(queueMutex);
+
+    return result;
+}
+
+
+/* Like MQTTPublish, but a message with _qos > 0 which can't be published is stored in MQTT_QUEUE_FILE.
+ * As long as the queue is not empty, new messages are queued behind it to keep the order. */
+bool MQTTPublishQueued(std::string _key, std::string _content, int retained_flag, int _qos)
+{
+    if (!mqtt_enabled) {
+        return false;
+    }
+
+    MQTT_Init(); // Re-Init client if not initialized yet/anymore
+
+    // Held from the replay until the message is sent or queued, so no count in between can change the order
+    xSemaphoreTake(queueMutex, portMAX_DELAY);
+
+    bool result;
+    if (MQTTReplayQueueLocked() && (failedOnRound != getCountFlowRounds()) && MQTTPublish(_key, _content, retained_flag, _qos)) {
+        result = true;
+    }
+    else if (_qos == 0) {
+        LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Publish skipped, QoS 0 messages are not queued (topic: " + _key + ")");
+        result = false;
+    }
+    else {
+        result = MQTTQueueMessage(_key, _content, retained_flag, _qos);
+    }
+
+    xSemaphoreGive(queueMutex);
+    return result;
+}
+
+
+/* Called by /metrics: does not wait for a running replay (publishing may block), the last known depth is returned then */
+int MQTTGetQueueDepth()
+{
+    if (queueMutex == NULL) {       // not configured yet
+        return 0;
+    }
+
+    if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(MQTT_QUEUE_LOCK_TIMEOUT_MS)) != pdTRUE) {
+        return std::max(queueDepth, 0);
+    }
+
+    if (queueDepth < 0) {
+        MQTTCountQueue();
+    }
+    int depth = queueDepth;
+    xSemaphoreGive(queueMutex);
+
+    return depth;
+}
+
+
+uint32_t MQTTGetQueueDropped()
+{
+    return queueDropped;
+}
+
+
+/* Retained topics are only published if the content changed or the last publish is older than publishMaxAge.
+ * With _heartbeatOnly the topic is only published after publishMaxAge, even if it changed (e.g. uptime) */
+bool MQTTPublishCached(std::string _key, std::string _content, int retained_flag, bool _heartbeatOnly)
+{
+    if ((publishMaxAge <= 0) || !retained_flag || (publishCacheMutex == NULL)) {
+        return MQTTPublish(_key, _content, retained_flag);
+    }
+
+    time_t now;
+    time(&now);
+    size_t hash = std::hash<std::string>{}(_content);
+
+    xSemaphoreTake(publishCacheMutex, portMAX_DELAY);
+
+    if (publishCacheInvalid) {
+        publishCache.clear();
+        publishCacheInvalid = false;
+    }
+
+    std::map<std::string, MQTTPublishCacheEntry>::iterator it = publishCache.find(_key);
+    if (it != publishCache.end()) {
+        bool expired = (now - it->second.published) >= publishMaxAge;
+        bool changed = (it->second.hash != hash);
+        if (!expired && (!changed || _heartbeatOnly)) {
+            xSemaphoreGive(publishCacheMutex);
+            LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Publish skipped, topic unchanged: " + _key);
+            return true;
+        }
+    }
+
+    xSemaphoreGive(publishCacheMutex);      // not held while publishing, the publish may block
+
+    if ((failedOnRound == getCountFlowRounds()) || !MQTTPublish(_key, _content, retained_flag)) {
+        return false;
+    }
+
+    xSemaphoreTake(publishCacheMutex, portMAX_DELAY);
+    publishCache[_key] = {hash, now};
+    xSemaphoreGive(publishCacheMutex);
+    return true;
+}
+
+
+void MQTTsetPublishMaxAge(int _maxAge)
+{
+    if (publishCacheMutex == NULL) {    // called by the flow before the client gets started
+        publishCacheMutex = xSemaphoreCreateMutex();
+    }
+    publishMaxAge = _maxAge;
+    publishCacheInvalid = true;
+}
+
+
 static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event) {
     std::string topic = "";
     switch (event->event_id) {
@@ -183,6 +518,10 @@ bool MQTT_Configure(std::string _mqttURI, std::string _clientid, std::string _us
                             + maintopic + ", last-will-topic: " + lwt_topic + ", keepAlive: " + std::to_string(keepalive)  + ", RetainFlag: " + std::to_string(SetRetainFlag)); 
      #endif
 
+    if (queueMutex == NULL) {
+        queueMutex = xSemaphoreCreateMutex();
+    }
+
     mqtt_configOK = true;
     return true;
 }
@@ -312,6 +651,7 @@ bool mqtt_handler_flow_start(std::string _topic, char* _data, int _data_len) {
 void MQTTconnected(){
     if (mqtt_connected) {
         LogFile.WriteToFile(ESP_LOG_INFO, TAG, "Connected to broker");
+        publishCacheInvalid = true;                                         // Broker may have lost the retained topics
         MQTTPublish(lwt_topic, lwt_connected, true);                        // Publish "connected" to maintopic/connection
 
         if (connectFunktionMap != NULL) {
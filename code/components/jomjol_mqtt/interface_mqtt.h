@@ -6,6 +6,7 @@
 #define INTERFACE_MQTT_H
 
 #include <string>
+#include <stdint.h>
 #include <map>
 #include <functional>
 
@@ -15,7 +16,13 @@ bool MQTT_Configure(std::string _mqttURI, std::string _clientid, std::string _us
 int MQTT_Init();
 void MQTTdestroy_client(bool _disable);
 
-bool MQTTPublish(std::string _key, std::string _content, int retained_flag = 1);            // retained Flag as Standart
+bool MQTTPublish(std::string _key, std::string _content, int retained_flag = 1, int _qos = 1);   // retained Flag as Standart
+bool MQTTPublishQueued(std::string _key, std::string _content, int retained_flag = 1, int _qos = 1);
+bool MQTTReplayQueue();
+int MQTTGetQueueDepth();
+uint32_t MQTTGetQueueDropped();
+bool MQTTPublishCached(std::string _key, std::string _content, int retained_flag = 1, bool _heartbeatOnly = false);
+void MQTTsetPublishMaxAge(int _maxAge);
 
 bool getMQTTisEnabled();
 bool getMQTTisConnected();
@@ -30,6 +30,7 @@ std::string rateUnit = "Unit/Minute";
 float roundInterval; // Minutes
 int keepAlive = 0; // Seconds
 int retainFlag;
+bool publishJSONOnly = false;
 static std::string maintopic;
 
 
@@ -46,8 +47,15 @@ void mqttServer_setMeterType(std::string _meterType, std::string _valueUnit, std
     rateUnit = _rateUnit;
 }
 
+void mqttServer_setPublishJSONOnly(bool _publishJSONOnly) {
+    publishJSONOnly = _publishJSONOnly;
+}
+
+/* With PublishJSONOnly the sensors with a jsonField read their state from the json topic of the number,
+ * jsonField is the path of the value in it */
 void sendHomeAssistantDiscoveryTopic(std::string group, std::string field,
-    std::string name, std::string icon, std::string unit, std::string deviceClass, std::string stateClass, std::string entityCategory) {
+    std::string name, std::string icon, std::string unit, std::string deviceClass, std::string stateClass, std::string entityCategory,
+    std::string jsonField = "") {
     std::string version = std::string(libfive_git_version());
 
     if (version == "") {
@@ -80,7 +88,16 @@ void sendHomeAssistantDiscoveryTopic(std::string group, std::string field,
         "\"name\": \"" + name + "\","  +
         "\"icon\": \"mdi:" + icon + "\",";        
 
-    if (group != "") {
+    if (publishJSONOnly && (jsonField != "")) {
+        payload += "\"state_topic\": \"~/" + (group != "" ? group + "/" : "") + "json\",";
+        if (field == "problem") { // Special binary sensor which is based on the error
+            payload += "\"value_template\": \"{{ 'OFF' if 'no error' in value_json." + jsonField + " else 'ON'}}\",";
+        }
+        else {
+            payload += "\"value_template\": \"{{ value_json." + jsonField + " }}\",";
+        }
+    }
+    else if (group != "") {
         if (field == "problem") { // Special binary sensor which is based on error topic
             payload += "\"state_topic\": \"~/" + group + "/error\",";
             payload += "\"value_template\": \"{{ 'OFF' if 'no error' in value else 'ON'}}\",";
@@ -133,6 +150,17 @@ void sendHomeAssistantDiscoveryTopic(std::string group, std::string field,
     MQTTPublish(topicFull, payload, true);
 }
 
+/* An empty retained config removes the sensor in Home Assistant */
+void removeHomeAssistantDiscoveryTopic(std::string group, std::string field) {
+    std::string configTopic = field;
+
+    if (group != "" && (*NUMBERS).size() > 1) {
+        configTopic = group + "_" + field;
+    }
+
+    MQTTPublish("homeassistant/sensor/" + maintopic + "/" + configTopic + "/config", "", true);
+}
+
 void MQTThomeassistantDiscovery() {  
     if (!getMQTTisConnected()) 
         return;
@@ -158,17 +186,26 @@ void MQTThomeassistantDiscovery() {
             group = "";
         }
 
-    //                                  Group | Field                 | User Friendly Name                | Icon                   | Unit     | Device Class | State Class       | Entity Category
-        sendHomeAssistantDiscoveryTopic(group,   "value",              "Value",                            "gauge",                 valueUnit, meterType,     "total_increasing", "");
-        sendHomeAssistantDiscoveryTopic(group,   "raw",                "Raw Value",                        "raw",                   valueUnit, "",            "total_increasing", "diagnostic");
-        sendHomeAssistantDiscoveryTopic(group,   "error",              "Error",                            "alert-circle-outline",  "",        "",            "",                 "diagnostic");
+    //                                  Group | Field                 | User Friendly Name                | Icon                   | Unit     | Device Class | State Class       | Entity Category | Field in the json topic (PublishJSONOnly)
+        sendHomeAssistantDiscoveryTopic(group,   "value",              "Value",                            "gauge",                 valueUnit, meterType,     "total_increasing", "",             "value");
+        sendHomeAssistantDiscoveryTopic(group,   "raw",                "Raw Value",                        "raw",                   valueUnit, "",            "total_increasing", "diagnostic",   "raw");
+        sendHomeAssistantDiscoveryTopic(group,   "error",              "Error",                            "alert-circle-outline",  "",        "",            "",                 "diagnostic",   "error");
         /* Not announcing "rate" as it is better to use rate_per_time_unit resp. rate_per_digitalization_round */
         // sendHomeAssistantDiscoveryTopic(group,   "rate",               "Rate (Unit/Minute)",               "swap-vertical",         "",        "",            "",                 ""); // Legacy, always Unit per Minute
-        sendHomeAssistantDiscoveryTopic(group,   "rate_per_time_unit", "Rate (" + rateUnit + ")",          "swap-vertical",         rateUnit,  "",            "",                 "");        
-        sendHomeAssistantDiscoveryTopic(group,   "rate_per_digitalization_round",  "Change since last digitalization round", "arrow-expand-vertical", valueUnit, "",            "measurement",      ""); // correctly the Unit is Uint/Interval!
-        sendHomeAssistantDiscoveryTopic(group,   "timestamp",          "Timestamp",                  "clock-time-eight-outline", "",        "timestamp",   "",                "diagnostic");
+        if (publishJSONOnly) { // Not contained in the json topic
+            removeHomeAssistantDiscoveryTopic(group, "rate_per_time_unit");
+            removeHomeAssistantDiscoveryTopic(group, "rate_per_digitalization_round");
+        }
+        else {
+            sendHomeAssistantDiscoveryTopic(group,   "rate_per_time_unit", "Rate (" + rateUnit + ")",          "swap-vertical",         rateUnit,  "",            "",                 "");        
+            sendHomeAssistantDiscoveryTopic(group,   "rate_per_digitalization_round",  "Change since last digitalization round", "arrow-expand-vertical", valueUnit, "",            "measurement",      ""); // correctly the Unit is Uint/Interval!
+        }
+        sendHomeAssistantDiscoveryTopic(group,   "consumption_hour",   "Consumption this hour",      "chart-bar",                valueUnit, meterType,     "total_increasing", "",             "rollup.hour.consumption");
+        sendHomeAssistantDiscoveryTopic(group,   "consumption_day",    "Consumption today",          "chart-bar",                valueUnit, meterType,     "total_increasing", "",             "rollup.day.consumption");
+        sendHomeAssistantDiscoveryTopic(group,   "consumption_month",  "Consumption this month",     "chart-bar",                valueUnit, meterType,     "total_increasing", "",             "rollup.month.consumption");
+        sendHomeAssistantDiscoveryTopic(group,   "timestamp",          "Timestamp",                  "clock-time-eight-outline", "",        "timestamp",   "",                "diagnostic",   "timestamp");
         sendHomeAssistantDiscoveryTopic(group,   "json",               "JSON",                       "code-json",                "",        "",            "",                 "diagnostic");
-        sendHomeAssistantDiscoveryTopic(group,   "problem",            "Problem",                    "alert-outline",            "",        "problem",            "",                 ""); // Special binary sensor which is based on error topic
+        sendHomeAssistantDiscoveryTopic(group,   "problem",            "Problem",                    "alert-outline",            "",        "problem",            "",                 "",             "error"); // Special binary sensor which is based on error topic
     }
 }
 
@@ -180,17 +217,18 @@ void publishSystemData() {
 
     LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Publishing system MQTT topics...");
 
+    // These values change in every round, with a publish max age they are only sent as heartbeat
     sprintf(tmp_char, "%ld", (long)getUpTime());
-    MQTTPublish(maintopic + "/" + "uptime", std::string(tmp_char), retainFlag);
+    MQTTPublishCached(maintopic + "/" + "uptime", std::string(tmp_char), retainFlag, true);
     
     sprintf(tmp_char, "%lu", (long) getESPHeapSize());
-    MQTTPublish(maintopic + "/" + "freeMem", std::string(tmp_char), retainFlag);
+    MQTTPublishCached(maintopic + "/" + "freeMem", std::string(tmp_char), retainFlag, true);
 
     sprintf(tmp_char, "%d", get_WIFI_RSSI());
-    MQTTPublish(maintopic + "/" + "wifiRSSI", std::string(tmp_char), retainFlag);
+    MQTTPublishCached(maintopic + "/" + "wifiRSSI", std::string(tmp_char), retainFlag, true);
 
     sprintf(tmp_char, "%d", (int)temperatureRead());
-    MQTTPublish(maintopic + "/" + "CPUtemp", std::string(tmp_char), retainFlag);
+    MQTTPublishCached(maintopic + "/" + "CPUtemp", std::string(tmp_char), retainFlag, true);
 }
 
 
@@ -10,6 +10,7 @@
 void SetHomeassistantDiscoveryEnabled(bool enabled);
 void mqttServer_setParameter(std::vector<NumberPost*>* _NUMBERS, int interval, float roundInterval);
 void mqttServer_setMeterType(std::string meterType, std::string valueUnit, std::string timeUnit,std::string rateUnit);
+void mqttServer_setPublishJSONOnly(bool publishJSONOnly);
 void setMqtt_Server_Retain(int SetRetainFlag);
 void mqttServer_setMainTopic( std::string maintopic);
 std::string mqttServer_getMainTopic();
@@ -5,13 +5,16 @@
 #include "../../include/defines.h"
 
 #include <sys/stat.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
 
 // #define DEBUG_DETAIL_ON
 
 
 static const char *TAG = "TFLITE";
 
-float CTfLiteClass::GetOutputValue(int nr)
+float CTfLiteClass::GetOutputValue(int nr, int _batch)
 {
     TfLiteTensor* output2 = this->interpreter->output(0);
 
@@ -19,22 +22,39 @@ float CTfLiteClass::GetOutputValue(int nr)
     if ((nr+1) > numeroutput)
       return -1000;
 
-    return output2->data.f[nr];
+    nr = nr + _batch * numeroutput;
+
+    if (output2->type == kTfLiteFloat32)
+      return output2->data.f[nr];
+
+    // quantized output -> dequantize
+    return (GetOutputRaw(output2, nr) - output2->params.zero_point) * output2->params.scale;
 }
 
 
-int CTfLiteClass::GetClassFromImageBasis(CImageBasis *rs)
+/* Integer value of a quantized output (int8 or uint8), only used where the order of the values is sufficient */
+int CTfLiteClass::GetOutputRaw(TfLiteTensor *_output, int _index)
 {
-    if (!LoadInputImageBasis(rs))
-      return -1000;
+    if (_output->type == kTfLiteInt8)
+      return _output->data.int8[_index];
+
+    return _output->data.uint8[_index];
+}
 
-    Invoke();
 
-    return GetOutClassification();
+/* Number of images which are processed with one Invoke() (first dimension of the input tensor) */
+int CTfLiteClass::GetBatchSize()
+{
+    TfLiteTensor* input2 = interpreter->input(0);
+
+    if (input2->dims->size < 4)
+      return 1;
+
+    return std::max(input2->dims->data[0], 1);
 }
 
 
-int CTfLiteClass::GetOutClassification(int _von, int _bis)
+int CTfLiteClass::GetOutClassification(int _von, int _bis, int _batch)
 {
   TfLiteTensor* output2 = interpreter->output(0);
 
@@ -60,15 +80,34 @@ int CTfLiteClass::GetOutClassification(int _von, int _bis)
     return -1;
   }
 
-  zw_max = output2->data.f[_von];
+  int offset = _batch * numeroutput;
+
   zw_class = _von;
-  for (int i = _von + 1; i <= _bis; ++i)
+  if (output2->type == kTfLiteFloat32)
   {
-    zw = output2->data.f[i];
-    if (zw > zw_max)
+    zw_max = output2->data.f[offset + _von];
+    for (int i = _von + 1; i <= _bis; ++i)
     {
-        zw_max = zw;
-        zw_class = i;
+      zw = output2->data.f[offset + i];
+      if (zw > zw_max)
+      {
+          zw_max = zw;
+          zw_class = i;
+      }
+    }
+  }
+  else
+  {
+    // the dequantization does not change the order (scale > 0) -> compare the quantized values directly
+    int zw_max_raw = GetOutputRaw(output2, offset + _von);
+    for (int i = _von + 1; i <= _bis; ++i)
+    {
+      int zw_raw = GetOutputRaw(output2, offset + i);
+      if (zw_raw > zw_max_raw)
+      {
+          zw_max_raw = zw_raw;
+          zw_class = i;
+      }
     }
   }
   return (zw_class - _von);
@@ -128,7 +167,7 @@ int CTfLiteClass::GetAnzOutPut(bool silent)
   int numeroutput = output2->dims->data[1];
   for (int i = 0; i < numeroutput; ++i)
   {
-   fo = output2->data.f[i];
+   fo = GetOutputValue(i);
     if (!silent) ESP_LOGD(TAG, "Result %d: %f", i, fo);
   }
   return numeroutput;
@@ -142,77 +181,321 @@ void CTfLiteClass::Invoke()
 }
 
 
-bool CTfLiteClass::LoadInputImageBasis(CImageBasis *rs)
+/* Samples the input tensor directly from _source: _transform maps the tensor pixel (x, y) onto the source image,
+ * so cutting, resizing and converting of a ROI are done in one pass without intermediate images.
+ * A downscaled ROI is averaged over the source area of each tensor pixel (box filter, as the former resize). */
+bool CTfLiteClass::LoadInputImageBasis(CImageBasis *_source, AffineTransform _transform, int _batch)
 {
-    #ifdef DEBUG_DETAIL_ON 
-        LogFile.WriteHeapInfo("CTfLiteClass::LoadInputImageBasis - Start");
-    #endif
+    TfLiteTensor* input2 = interpreter->input(0);
+
+    int w = input2->dims->data[2];
+    int h = input2->dims->data[1];
+    int ch = input2->dims->data[3];
+
+    if ((ch != _source->channels) || (ch > 4))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "LoadInputImageBasis: Channels of image (" + std::to_string(_source->channels) + 
+                                                ") and model (" + std::to_string(ch) + ") do not fit");
+        return false;
+    }
 
-    unsigned int w = rs->width;
-    unsigned int h = rs->height;
-    unsigned char red, green, blue;
-//    ESP_LOGD(TAG, "Image: %s size: %d x %d\n", _fn.c_str(), w, h);
+    if (_batch >= GetBatchSize())
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "LoadInputImageBasis: Batch index " + std::to_string(_batch) + " exceeds batch size of model");
+        return false;
+    }
+
+    float (&m)[2][3] = _transform.m;
+    int index = _batch * w * h * ch;        // images of a batch are stored one after the other
+    uint8_t pixel[4];
+    CRotateImage rt(_source, NULL);
 
-    input_i = 0;
-    float* input_data_ptr = (interpreter->input(0))->data.f;
+    float size_x, size_y;
+    bool area = CRotateImage::GetSampleArea(_transform, size_x, size_y);
+
+    rt.RGBImageLock();
 
     for (int y = 0; y < h; ++y)
-        for (int x = 0; x < w; ++x)
-            {
-                red = rs->GetPixelColor(x, y, 0);
-                green = rs->GetPixelColor(x, y, 1);
-                blue = rs->GetPixelColor(x, y, 2);
-                *(input_data_ptr) = (float) red;
-                input_data_ptr++;
-                *(input_data_ptr) = (float) green;
-                input_data_ptr++;
-                *(input_data_ptr) = (float) blue;
-                input_data_ptr++;
-            }
+    {
+        float x_source = m[0][1] * y + m[0][2];
+        float y_source = m[1][1] * y + m[1][2];
 
-    #ifdef DEBUG_DETAIL_ON 
-        LogFile.WriteHeapInfo("CTfLiteClass::LoadInputImageBasis - done");
-    #endif
+        for (int x = 0; x < w; ++x, x_source += m[0][0], y_source += m[1][0])
+        {
+            bool inside = area ? rt.SampleArea(x_source, y_source, size_x, size_y, pixel) : rt.SamplePixel(x_source, y_source, true, pixel);
+            if (!inside)
+                pixel[0] = pixel[1] = pixel[2] = pixel[3] = 255;
+
+            for (int _channels = 0; _channels < ch; ++_channels)
+                SetInputValue(input2, index++, pixel[_channels]);
+        }
+    }
+
+    rt.RGBImageRelease();
 
     return true;
 }
 
 
-bool CTfLiteClass::MakeAllocate()
+/* Writes a pixel value (0 .. 255) into the input tensor, quantized models are fed natively */
+void CTfLiteClass::SetInputValue(TfLiteTensor *_input, int _index, uint8_t _value)
 {
-    static tflite::AllOpsResolver resolver;
+    if (_input->type == kTfLiteFloat32)
+        _input->data.f[_index] = _value;
+    else if (_input->type == kTfLiteInt8)
+        _input->data.int8[_index] = (int8_t) input_lut[_value];
+    else
+        _input->data.uint8[_index] = input_lut[_value];
+}
 
-    #ifdef DEBUG_DETAIL_ON 
-        LogFile.WriteHeapInfo("CTLiteClass::Alloc start");
-    #endif
 
-    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "CTfLiteClass::MakeAllocate");
-    this->interpreter = new tflite::MicroInterpreter(this->model, resolver, this->tensor_arena, this->kTensorArenaSize, this->error_reporter);
+/* Checks the types of the input and output tensor and prepares the lookup table for quantized input */
+bool CTfLiteClass::PrepareQuantization()
+{
+    TfLiteTensor* input2 = interpreter->input(0);
+    TfLiteTensor* output2 = interpreter->output(0);
 
-    if (this->interpreter) 
+    if ((input2->type != kTfLiteFloat32) && (input2->type != kTfLiteInt8) && (input2->type != kTfLiteUInt8))
     {
-        TfLiteStatus allocate_status = this->interpreter->AllocateTensors();
-        if (allocate_status != kTfLiteOk) {
-            TF_LITE_REPORT_ERROR(error_reporter, "AllocateTensors() failed");
-            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "AllocateTensors() failed");
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Input tensor type " + std::to_string(input2->type) + " not supported");
+        return false;
+    }
 
-            this->GetInputDimension();   
+    if ((output2->type != kTfLiteFloat32) && (output2->type != kTfLiteInt8) && (output2->type != kTfLiteUInt8))
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Output tensor type " + std::to_string(output2->type) + " not supported");
+        return false;
+    }
+
+    if (input2->type != kTfLiteFloat32)
+    {
+        float scale = input2->params.scale;
+        int zero_point = input2->params.zero_point;
+        int q_min = (input2->type == kTfLiteInt8) ? -128 : 0;
+        int q_max = (input2->type == kTfLiteInt8) ? 127 : 255;
+
+        if (scale <= 0)
+        {
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Invalid quantization scale of input tensor");
             return false;
         }
+
+        for (int i = 0; i < 256; ++i)
+        {
+            int q = (int) lroundf(i / scale) + zero_point;
+            q = std::min(std::max(q, q_min), q_max);
+            input_lut[i] = (uint8_t) q;
+        }
     }
-    else 
+
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "Tensor types: input " + std::to_string(input2->type) + ", output " + std::to_string(output2->type));
+
+    return true;
+}
+
+
+/* Creates the interpreter on a new tensor arena of the given size (a previous interpreter and arena are released before) */
+bool CTfLiteClass::CreateInterpreter(int _arenasize)
+{
+    delete this->interpreter;
+    this->interpreter = nullptr;
+    free(this->tensor_arena);
+
+    this->kTensorArenaSize = _arenasize;
+    this->tensor_arena = (uint8_t*)GET_MEMORY(kTensorArenaSize);
+
+    if (!this->tensor_arena)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Can't allocate tensor arena: " + std::to_string(kTensorArenaSize));
+        LogFile.WriteHeapInfo("CTfLiteClass::CreateInterpreter");
+        return false;
+    }
+
+    this->interpreter = new tflite::MicroInterpreter(this->model, resolver, this->tensor_arena, this->kTensorArenaSize, this->error_reporter);
+
+    if (!this->interpreter) 
     {
         LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "new tflite::MicroInterpreter failed");
         LogFile.WriteHeapInfo("CTfLiteClass::MakeAllocate-new tflite::MicroInterpreter failed");
         return false;
     }
 
+    TfLiteStatus allocate_status = this->interpreter->AllocateTensors();
+    if (allocate_status != kTfLiteOk) {
+        TF_LITE_REPORT_ERROR(error_reporter, "AllocateTensors() failed");
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "AllocateTensors() failed (tensor arena: " + std::to_string(kTensorArenaSize) + ")");
+        delete this->interpreter;
+        this->interpreter = nullptr;
+        return false;
+    }
+
+    return true;
+}
+
+
+/* Registers the operators used by the model (instead of all operators of TFLite Micro),
+ * an operator which is not supported by the firmware is named in the log */
+bool CTfLiteClass::PrepareResolver()
+{
+    auto* opcodes = model->operator_codes();
+    if (!opcodes)
+    {
+        LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Model contains no operators");
+        return false;
+    }
+
+    for (int i = 0; i < opcodes->size(); ++i)
+    {
+        const tflite::OperatorCode* opcode = opcodes->Get(i);
+        tflite::BuiltinOperator op = tflite::GetBuiltinCode(opcode);
+
+        if (resolver.FindOp(op))        // already registered
+            continue;
+
+        TfLiteStatus status = kTfLiteError;
+        switch (op)
+        {
+            case tflite::BuiltinOperator_ADD:               status = resolver.AddAdd(); break;
+            case tflite::BuiltinOperator_AVERAGE_POOL_2D:   status = resolver.AddAveragePool2D(); break;
+            case tflite::BuiltinOperator_CONCATENATION:     status = resolver.AddConcatenation(); break;
+            case tflite::BuiltinOperator_CONV_2D:           status = resolver.AddConv2D(); break;
+            case tflite::BuiltinOperator_DEPTHWISE_CONV_2D: status = resolver.AddDepthwiseConv2D(); break;
+            case tflite::BuiltinOperator_DEQUANTIZE:        status = resolver.AddDequantize(); break;
+            case tflite::BuiltinOperator_FULLY_CONNECTED:   status = resolver.AddFullyConnected(); break;
+            case tflite::BuiltinOperator_HARD_SWISH:        status = resolver.AddHardSwish(); break;
+            case tflite::BuiltinOperator_LEAKY_RELU:        status = resolver.AddLeakyRelu(); break;
+            case tflite::BuiltinOperator_LOGISTIC:          status = resolver.AddLogistic(); break;
+            case tflite::BuiltinOperator_MAX_POOL_2D:       status = resolver.AddMaxPool2D(); break;
+            case tflite::BuiltinOperator_MEAN:              status = resolver.AddMean(); break;
+            case tflite::BuiltinOperator_MUL:               status = resolver.AddMul(); break;
+            case tflite::BuiltinOperator_PAD:               status = resolver.AddPad(); break;
+            case tflite::BuiltinOperator_QUANTIZE:          status = resolver.AddQuantize(); break;
+            case tflite::BuiltinOperator_RELU:              status = resolver.AddRelu(); break;
+            case tflite::BuiltinOperator_RELU6:             status = resolver.AddRelu6(); break;
+            case tflite::BuiltinOperator_RESHAPE:           status = resolver.AddReshape(); break;
+            case tflite::BuiltinOperator_SOFTMAX:           status = resolver.AddSoftmax(); break;
+            case tflite::BuiltinOperator_SUB:               status = resolver.AddSub(); break;
+            case tflite::BuiltinOperator_TANH:              status = resolver.AddTanh(); break;
+            default: break;
+        }
+
+        if (status != kTfLiteOk)
+        {
+            std::string name = tflite::EnumNameBuiltinOperator(op);
+            if ((op == tflite::BuiltinOperator_CUSTOM) && opcode->custom_code())
+                name = name + " (" + opcode->custom_code()->c_str() + ")";
+            LogFile.WriteToFile(ESP_LOG_ERROR, TAG, "Operator " + name + " of the model is not supported by the firmware");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/* The tensor arena is sized by the measured usage of the model: an unknown model is allocated once in a
+ * probe arena, afterwards the arena is reduced to the used size + _arenaMargin (bytes). The usage is stored per
+ * model hash, so on later starts the arena gets the right size directly. */
+bool CTfLiteClass::MakeAllocate(int _arenaMargin)
+{
+    #ifdef DEBUG_DETAIL_ON 
+        LogFile.WriteHeapInfo("CTLiteClass::Alloc start");
+    #endif
+
+    LogFile.WriteToFile(ESP_LOG_DEBUG, TAG, "CTfLiteClass::MakeAllocate");
+
+    if (!PrepareResolver())
+        return false;
+
+    int used = ReadArenaUsage();
+    if (used > 0)
+    {
+        if (CreateInterpreter(used + _arenaMargin))
+            return PrepareQuantization();
+
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Stored tensor arena size does not fit -> measure again");
+    }
+
+    if (!CreateInterpreter(TFLITE_ARENA_PROBE_SIZE))
+        return false;
+
+    used = this->interpreter->arena_used_bytes();
+    int arenasize = used + _arenaMargin;
+    LogFile.WriteToFile(ESP_LOG_INFO, TAG, "Tensor arena: used " + std::to_string(used) + 
+                                            " bytes, allocated " + std::to_string(arenasize) + " bytes");
+
+    if (arenasize < TFLITE_ARENA_PROBE_SIZE)
+    {
+        if (!CreateInterpreter(arenasize))
+        {
+            LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Measured tensor arena does not fit -> use probe size");
+            if (!CreateInterpreter(TFLITE_ARENA_PROBE_SIZE))
+                return false;
+            used = TFLITE_ARENA_PROBE_SIZE - _arenaMargin;
+        }
+    }
+
+    WriteArenaUsage(used);
 
     #ifdef DEBUG_DETAIL_ON 
         LogFile.WriteHeapInfo("CTLiteClass::Alloc done");
     #endif
 
-    return true;
+    return PrepareQuantization();
+}
+
+
+/* Stored arena usage of the loaded model (without margin), 0 if unknown. File format: one line per model "<hash> <bytes>" */
+int CTfLiteClass::ReadArenaUsage()
+{
+    FILE* pFile = fopen(TFLITE_ARENA_SIZE_FILE, "r");
+    if (!pFile)
+        return 0;
+
+    unsigned int hash;
+    int size;
+    int result = 0;
+
+    while (fscanf(pFile, "%x %d", &hash, &size) == 2)
+    {
+        if (hash == modelhash)
+            result = size;
+    }
+
+    fclose(pFile);
+    return result;
+}
+
+
+void CTfLiteClass::WriteArenaUsage(int _used)
+{
+    std::vector<std::pair<unsigned int, int>> entries;
+    unsigned int hash;
+    int size;
+
+    FILE* pFile = fopen(TFLITE_ARENA_SIZE_FILE, "r");
+    if (pFile)
+    {
+        while (fscanf(pFile, "%x %d", &hash, &size) == 2)
+        {
+            if (hash != modelhash)
+                entries.push_back(std::make_pair(hash, size));
+        }
+        fclose(pFile);
+    }
+    entries.push_back(std::make_pair((unsigned int) modelhash, _used));
+
+    pFile = fopen(TFLITE_ARENA_SIZE_FILE, "w");
+    if (!pFile)
+    {
+        LogFile.WriteToFile(ESP_LOG_WARN, TAG, "Can't write " + std::string(TFLITE_ARENA_SIZE_FILE));
+        return;
+    }
+
+    for (int i = 0; i < entries.size(); ++i)
+        fprintf(pFile, "%08x %d\n", entries[i].first, entries[i].second);
+
+    fclose(pFile);
 }
 
 
@@ -257,6 +540,7 @@ bool CTfLiteClass::ReadFileToModel(std::string _fn)
         FILE* f = fopen(_fn.c_str(), "rb");     // previously only "r
         fread(modelfile, 1, size, f);
         fclose(f);        
+        modelfilesize = size;
 
         #ifdef DEBUG_DETAIL_ON 
             LogFile.WriteHeapInfo("CTLiteClass::Alloc modelfile successful");
@@ -290,6 +574,11 @@ bool CTfLiteClass::LoadModel(std::string _fn)
 
     model = tflite::GetModel(modelfile);
 
+    // FNV-1a hash of the model file, used as key for the stored tensor arena size
+    modelhash = 2166136261u;
+    for (long i = 0; i < modelfilesize; ++i)
+        modelhash = (modelhash ^ modelfile[i]) * 16777619u;
+
     if(model == nullptr)     
       return false;
     
@@ -301,11 +590,14 @@ CTfLiteClass::CTfLiteClass()
 {
     this->model = nullptr;
     this->modelfile = NULL;
+    this->modelfilesize = 0;
+    this->modelhash = 0;
+    this->error_reporter = nullptr;
     this->interpreter = nullptr;
     this->input = nullptr;
     this->output = nullptr;  
-    this->kTensorArenaSize = 800 * 1024;   /// according to testfile: 108000 - so far 600;; 2021-09-11: 200 * 1024
-    this->tensor_arena = (uint8_t*)GET_MEMORY(kTensorArenaSize);
+    this->kTensorArenaSize = 0;             // sized in MakeAllocate() by the measured usage of the model
+    this->tensor_arena = NULL;
 }
 
 
@@ -313,8 +605,8 @@ CTfLiteClass::~CTfLiteClass()
 {
   free(modelfile);
 
-  free(this->tensor_arena);
   delete this->interpreter;
+  free(this->tensor_arena);
   delete this->error_reporter;
 }        
 
@@ -3,15 +3,18 @@
 #ifndef CTFLITECLASS_H
 #define CTFLITECLASS_H
 
-#include "tensorflow/lite/micro/all_ops_resolver.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
 #include "tensorflow/lite/micro/micro_error_reporter.h"
 #include "tensorflow/lite/micro/micro_interpreter.h"
 #include "tensorflow/lite/schema/schema_generated.h"
+#include "tensorflow/lite/schema/schema_utils.h"
 #include "tensorflow/lite/micro/kernels/micro_ops.h"
 #include "esp_err.h"
 #include "esp_log.h"
 
 #include "CImageBasis.h"
+#include "CRotateImage.h"
+#include "../../include/defines.h"
 
 #ifdef SUPRESS_TFLITE_ERRORS
 #include "tensorflow/lite/core/api/error_reporter.h"
@@ -34,36 +37,45 @@ class CTfLiteClass
         const tflite::Model* model;
         tflite::MicroInterpreter* interpreter;
         TfLiteTensor* output = nullptr;     
-        static tflite::AllOpsResolver resolver;
+        tflite::MicroMutableOpResolver<TFLITE_RESOLVER_MAX_OPS> resolver;     // only the operators used by the model
 
         int kTensorArenaSize;
         uint8_t *tensor_arena;
 
         unsigned char *modelfile = NULL;
+        long modelfilesize;
+        uint32_t modelhash;
 
 
         float* input;
-        int input_i;
+        uint8_t input_lut[256];         // pixel value -> quantized input value (int8 is stored as its bit pattern)
         int im_height, im_width, im_channel;
 
         long GetFileSize(std::string filename);
+        bool PrepareQuantization();
+        bool PrepareResolver();
+        bool CreateInterpreter(int _arenasize);
+        int ReadArenaUsage();
+        void WriteArenaUsage(int _used);
+        void SetInputValue(TfLiteTensor *_input, int _index, uint8_t _value);
+        int GetOutputRaw(TfLiteTensor *_output, int _index);
         bool ReadFileToModel(std::string _fn);
 
     public:
         CTfLiteClass();
         ~CTfLiteClass();        
         bool LoadModel(std::string _fn);
-        bool MakeAllocate();
+        bool MakeAllocate(int _arenaMargin = TFLITE_ARENA_MARGIN);
         void GetInputTensorSize();
-        bool LoadInputImageBasis(CImageBasis *rs);
+        bool LoadInputImageBasis(CImageBasis *_source, AffineTransform _transform, int _batch = 0);
         void Invoke();
         int GetAnzOutPut(bool silent = true);        
-        int GetOutClassification(int _von = -1, int _bis = -1);
+        int GetOutClassification(int _von = -1, int _bis = -1, int _batch = 0);
 
-        int GetClassFromImageBasis(CImageBasis *rs);
         std::string GetStatusFlow();
 
-        float GetOutputValue(int nr);
+        float GetOutputValue(int nr, int _batch = 0);
+        int GetBatchSize();
         void GetInputDimension(bool silent);
         int ReadInputDimenstion(int _dim);
 };
@@ -18,6 +18,7 @@
 #include "ClassFlowControll.h"
 
 #include "ClassLogFile.h"
+#include "ClassDataSeries.h"
 #include "server_GPIO.h"
 
 #include "server_file.h"
@@ -133,6 +134,26 @@ bool doflow(void)
 }
 
 
+esp_err_t handler_metrics(httpd_req_t *req)
+{
+    #ifdef DEBUG_DETAIL_ON      
+        LogFile.WriteHeapInfo("handler_metrics - Start");       
+    #endif
+
+    std::string zw = tfliteflow.getMetrics();
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    httpd_resp_send(req, zw.c_str(), zw.length());
+
+    #ifdef DEBUG_DETAIL_ON      
+        LogFile.WriteHeapInfo("handler_metrics - Done");       
+    #endif
+
+    return ESP_OK;
+}
+
+
 esp_err_t handler_get_heap(httpd_req_t *req)
 {
     #ifdef DEBUG_DETAIL_ON      
@@ -860,6 +881,7 @@ void task_autodoFlow(void *pvParameter)
             #endif
             LogFile.RemoveOldLogFile();
             LogFile.RemoveOldDataLog();
+            DataSeries.RemoveOldFiles();
         }
         
         //CPU Temp -> Logfile
@@ -1006,4 +1028,9 @@ void register_server_tflite_uri(httpd_handle_t server)
     camuri.handler   = handler_get_heap;
     camuri.user_ctx  = (void*) "Heap"; 
     httpd_register_uri_handler(server, &camuri);
+
+    camuri.uri       = "/metrics";
+    camuri.handler   = handler_metrics;
+    camuri.user_ctx  = (void*) "Metrics"; 
+    httpd_register_uri_handler(server, &camuri);
 }
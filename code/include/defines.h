@@ -67,6 +67,13 @@
 
     //ClassControllCamera
     #define USE_PWM_LEDFLASH // if __LEDGLOBAL is defined, a global variable is used for LED control, otherwise locally and each time a new
+
+    //ClassControllCamera + server_camera
+    #define CAMERA_STREAM_PORT 81                               // own server, a running stream does not block the web interface
+    #define CAMERA_STREAM_CTRL_PORT 32769
+    #define CAMERA_STREAM_FPS_DEFAULT 5
+    #define CAMERA_STREAM_FPS_MAX 15
+    #define CAMERA_STREAM_BOUNDARY "123456789000000000000987654321"
     
     //server_GPIO
     #define __LEDGLOBAL
@@ -96,10 +103,24 @@
     #define SERVER_FILER_SCRATCH_BUFSIZE  4096 
     #define SERVER_HELPER_SCRATCH_BUFSIZE  8192
     #define SERVER_OTA_SCRATCH_BUFSIZE  1024 
+    #define UNZIP_WRITE_BUFFER_SIZE (16*1024)   // inflated data is written in blocks of this size, the file is never completely in RAM
 
     //server_file + server_help
     #define IS_FILE_EXT(filename, ext) \
     (strcasecmp(&filename[strlen(filename) - sizeof(ext) + 1], ext) == 0)
+    #define GZIP_MIN_FILE_SIZE 1024                             // smaller files are not precompressed (<file>.gz)
+    #define FILE_TRANSFER_BUFFER_SIZE (16*1024)                 // SD card and network work in parallel on buffers of this size
+    #define FILE_TRANSFER_BUFFERS 2
+    #define FILE_TRANSFER_MIN_FREE_INTERNAL (64*1024)           // buffers only go to the (DMA capable) internal RAM if this much is still free
+    #define FILE_TRANSFER_TASK_STACK 4096
+    #define HTTP_RANGE_HEADER_MAX 64                            // longest accepted "Range" request header
+    #define DIRECTORY_INDEX_MAX_DIRS 4                          // number of directories kept in the directory index
+    #define DIRECTORY_INDEX_MAX_AGE 60                          // s, FAT does not update the mtime of a directory if files are added
+    #define DIRECTORY_INDEX_LARGE_ENTRIES 256                   // directories with more entries are updated by the writers (InvalidateFile)
+    #define DIRECTORY_INDEX_LARGE_MAX_AGE 3600                  // s, and only read again after this time
+    #define DIRECTORY_INDEX_INITIAL_ENTRIES 64
+    #define DIRECTORY_PAGE_SIZE_DEFAULT 200                     // entries per page of the file server / of /dirlist
+    #define DIRECTORY_PAGE_SIZE_MAX 1000
 
     //server_ota
     #define HASH_LEN 32 // SHA-256 digest length
@@ -110,6 +131,19 @@
     #define LOGFILE_TIME_FORMAT_DATE_EXTR substr(0, 8)
     #define LOGFILE_TIME_FORMAT_HOUR_EXTR substr(9, 2)
 
+    //ClassLogFile
+    #define LOGFILE_BUFFER_SIZE (16*1024)           // Size of each of the two log buffers (PSRAM)
+    #define LOGFILE_FLUSH_THRESHOLD (8*1024)        // Buffer fill level which wakes up the log writer task
+    #define LOGFILE_FLUSH_INTERVAL_MS 5000          // Buffered log lines are written at least this often
+    #define LOGFILE_SHUTDOWN_TIMEOUT_MS 1000        // Max. time to wait for the last flush on esp_restart
+
+    //ClassDataSeries + server_file
+    #define DATASERIES_ROOT "/sdcard/log/series"
+    #define DATASERIES_FILE "series_%Y-%m-%d.bin"   // one file per day, fixed size records sorted by time
+    #define DATASERIES_NUMBERS_FILE "numbers.txt"      // in DATASERIES_ROOT, number name per line, line index = number id
+    #define DATASERIES_READ_CHUNK 64                // records read at once during a query
+    #define DATASERIES_MAX_QUERY_DAYS 400           // limits the number of day files of one query
+
     //ClassFlowControll
     #define READOUT_TYPE_VALUE 0
     #define READOUT_TYPE_PREVALUE 1
@@ -119,11 +153,38 @@
     //ClassFlowControll: Serve alg_roi.jpg from memory as JPG
     #define ALGROI_LOAD_FROM_MEM_AS_JPG // Load ALG_ROI.JPG as rendered JPG from RAM
 
+    //FlowMetrics
+    #define FLOW_METRICS_RING_SIZE 32                   // number of rounds used for the quantiles (min/median/p95/max) per flow step
+
+    //FlowImageCache
+    #define IMAGE_CACHE_MAX_SIZE (256*1024)     // encoded JPGs of the virtual /img_tmp images
+
+    //FlowImageLogWriter + ClassFlowImage
+    #define IMAGE_LOG_QUEUE_LENGTH 32                   // log images waiting for the writer task
+    #define IMAGE_LOG_QUEUE_MAX_SIZE (1536*1024)        // pixels waiting for the writer task, further images are dropped
+    #define IMAGE_LOG_POOL_MAX_SIZE (64*1024)           // released ROI buffers are kept for the next round
+    #define IMAGE_LOG_MIN_FREE_PSRAM (512*1024)         // below that the image is written directly by the flow
+    #define IMAGE_LOG_TASK_STACK (6*1024)
+    #define IMAGE_LOG_TASK_CORE 1                       // the flow runs on core 0
+
+    //FlowRollup
+    #define ROLLUP_FILE "/sdcard/config/rollup.bin"     // hourly / daily / monthly aggregates per number
+    #define ROLLUP_FILE_TMP "/sdcard/config/rollup.tmp" // Save() writes here first
+    #define ROLLUP_NAME_LENGTH 32
+
     //ClassFlowMQTT
     #define LWT_TOPIC        "connection"
     #define LWT_CONNECTED    "connected"
     #define LWT_DISCONNECTED "connection lost"
 
+    //interface_mqtt
+    #define MQTT_QUEUE_FILE "/sdcard/log/mqtt_queue.dat"        // messages which could not be published, replayed after a reconnect
+    #define MQTT_QUEUE_MAX_SIZE (256*1024)                      // no more messages are queued beyond this size
+    #define MQTT_QUEUE_REPLAY_MAX 100                           // max. number of queued messages published per call
+    #define MQTT_QUEUE_REPLAY_MAX_BYTES (16*1024)               // max. content of the queued messages published per call
+    #define MQTT_QUEUE_REPLAY_MAX_OUTBOX (16*1024)              // replay pauses while more unacknowledged messages are in the outbox (RAM)
+    #define MQTT_QUEUE_LOCK_TIMEOUT_MS 100                      // /metrics waits at most this long for the queue, then reports the last known depth
+
     //ClassFlowPostProcessing
     #define PREVALUE_TIME_FORMAT_OUTPUT "%Y-%m-%dT%H:%M:%S%z"
     #define PREVALUE_TIME_FORMAT_INPUT "%d-%d-%dT%d:%d:%d"
@@ -134,6 +195,18 @@
     #define MAX_JPG_SIZE 128000
 
 
+    //CFindTemplate
+    #define FIND_TEMPLATE_MAX_PYRAMID_LEVEL 3           // coarsest search on 1/8 resolution
+    #define FIND_TEMPLATE_MIN_TEMPLATE_SIZE 8           // minimum template size (pixel) on the coarsest level
+    #define FIND_TEMPLATE_MIN_POSITIONS_PYRAMID 256     // below this number of search positions the full resolution search is used directly
+    #define FIND_TEMPLATE_COARSE_CANDIDATES 3           // number of candidates from the coarsest level which get refined
+
+    //CTfLiteClass
+    #define TFLITE_ARENA_PROBE_SIZE (800 * 1024)        // tensor arena for the first allocation of an unknown model
+    #define TFLITE_ARENA_MARGIN (8 * 1024)              // added to the measured arena usage
+    #define TFLITE_ARENA_SIZE_FILE "/sdcard/config/tflite_arena.txt"  // measured arena size per model hash
+    #define TFLITE_RESOLVER_MAX_OPS 24                  // maximum number of different operators in one model
+
     //CAlignAndCutImage + CImageBasis
     #define _USE_MATH_DEFINES
     #define GET_MEMORY(X) heap_caps_malloc(X, MALLOC_CAP_SPIRAM)
@@ -146,6 +219,12 @@
 
     //interface_influxdb
     #define MAX_HTTP_OUTPUT_BUFFER 2048
+    #define INFLUXDB_TIMEOUT_MS 5000                            // timeout of one POST
+    #define INFLUXDB_SPOOL_FILE "/sdcard/log/influxdb_spool.txt"   // unsent lines, replayed when the server is reachable again
+    #define INFLUXDB_SPOOL_MAX_SIZE (256*1024)                  // no more lines are spooled beyond this size
+    #define INFLUXDB_REPLAY_CHUNK (8*1024)                      // max. size of one replay POST
+    #define INFLUXDB_BACKOFF_MIN_S 60                           // first retry after a failed POST
+    #define INFLUXDB_BACKOFF_MAX_S 3600                         // the retry interval doubles up to this value
 
     //server_mqtt
     #define LWT_TOPIC        "connection"
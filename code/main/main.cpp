@@ -208,6 +208,7 @@ extern "C" void app_main(void)
     }
 
     LogFile.CreateLogDirectories();
+    LogFile.StartLogFileWriter();       // from now on the log lines are written to the SD card in blocks
     MakeDir("/sdcard/demo");            // needed for demo mode
 
 
@@ -364,6 +365,7 @@ extern "C" void app_main(void)
 
     server = start_webserver();   
     register_server_camera_uri(server); 
+    start_stream_server();
     register_server_tflite_uri(server);
     register_server_file_uri(server, "/sdcard");
     register_server_ota_sdcard_uri(server);
@@ -0,0 +1,81 @@
+#include <unity.h>
+#include <string>
+#include <FlowMetrics.h>
+
+
+/**
+ * @brief nearest rank quantile: 0 = min, 100 = max, p95 of 20 values is the 19th
+ */
+void test_MetricsQuantile()
+{
+    int64_t values[20];
+    for (int i = 0; i < 20; ++i)
+        values[i] = (i + 1) * 10;
+
+    TEST_ASSERT_EQUAL_INT(10, (int) FlowMetrics::Quantile(values, 20, 0));
+    TEST_ASSERT_EQUAL_INT(100, (int) FlowMetrics::Quantile(values, 20, 50));
+    TEST_ASSERT_EQUAL_INT(190, (int) FlowMetrics::Quantile(values, 20, 95));
+    TEST_ASSERT_EQUAL_INT(200, (int) FlowMetrics::Quantile(values, 20, 100));
+
+    // p95 of less than 20 values is the max
+    TEST_ASSERT_EQUAL_INT(100, (int) FlowMetrics::Quantile(values, 10, 95));
+    TEST_ASSERT_EQUAL_INT(10, (int) FlowMetrics::Quantile(values, 1, 95));
+    TEST_ASSERT_EQUAL_INT(10, (int) FlowMetrics::Quantile(values, 1, 0));
+    TEST_ASSERT_EQUAL_INT(0, (int) FlowMetrics::Quantile(values, 0, 95));
+}
+
+
+static void assertLine(std::string _text, std::string _line)
+{
+    if (_text.find(_line + "\n") == std::string::npos)
+        TEST_FAIL_MESSAGE(_line.c_str());
+}
+
+
+static std::string seconds(int _ms)
+{
+    char zw[20];
+    snprintf(zw, sizeof(zw), "%.6f", _ms / 1000.0);
+    return zw;
+}
+
+
+/**
+ * @brief the quantiles are taken over the ring (last FLOW_METRICS_RING_SIZE runs), sum and count over all runs
+ */
+void test_MetricsPrometheus()
+{
+    FlowMetrics metrics;
+    int runs = FLOW_METRICS_RING_SIZE + 8;
+    int first = runs - FLOW_METRICS_RING_SIZE + 1;      // oldest run in the ring
+
+    for (int ms = 1; ms <= runs; ++ms)
+        metrics.AddMeasurement("Alignment", ms * 1000, -ms, ms != 3);
+    metrics.AddMeasurement("Round", 5000000, 100);
+
+    std::string text = metrics.GetPrometheus();
+    printf("%s", text.c_str());
+
+    assertLine(text, "# TYPE flow_step_duration_seconds summary");
+    assertLine(text, "# TYPE flow_step_heap_delta_bytes summary");
+
+    int median = first + (FLOW_METRICS_RING_SIZE * 50 + 99) / 100 - 1;
+    int p95 = first + (FLOW_METRICS_RING_SIZE * 95 + 99) / 100 - 1;
+    assertLine(text, "flow_step_duration_seconds{step=\"Alignment\",quantile=\"0\"} " + seconds(first));
+    assertLine(text, "flow_step_duration_seconds{step=\"Alignment\",quantile=\"0.5\"} " + seconds(median));
+    assertLine(text, "flow_step_duration_seconds{step=\"Alignment\",quantile=\"0.95\"} " + seconds(p95));
+    assertLine(text, "flow_step_duration_seconds{step=\"Alignment\",quantile=\"1\"} " + seconds(runs));
+    assertLine(text, "flow_step_duration_seconds_sum{step=\"Alignment\"} " + seconds(runs * (runs + 1) / 2));
+    assertLine(text, "flow_step_duration_seconds_count{step=\"Alignment\"} " + std::to_string(runs));
+
+    assertLine(text, "flow_step_heap_delta_bytes{step=\"Alignment\",quantile=\"0\"} " + std::to_string(-runs));
+    assertLine(text, "flow_step_heap_delta_bytes{step=\"Alignment\",quantile=\"1\"} " + std::to_string(-first));
+    assertLine(text, "flow_step_heap_delta_bytes_sum{step=\"Alignment\"} " + std::to_string(-runs * (runs + 1) / 2));
+    assertLine(text, "flow_step_heap_delta_bytes_count{step=\"Alignment\"} " + std::to_string(runs));
+    assertLine(text, "flow_step_errors_total{step=\"Alignment\"} 1");
+
+    // a single run: all quantiles are the same
+    assertLine(text, "flow_step_duration_seconds{step=\"Round\",quantile=\"0.95\"} 5.000000");
+    assertLine(text, "flow_step_duration_seconds_count{step=\"Round\"} 1");
+    assertLine(text, "flow_step_errors_total{step=\"Round\"} 0");
+}
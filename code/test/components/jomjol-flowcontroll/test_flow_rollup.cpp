@@ -0,0 +1,176 @@
+#include <unity.h>
+#include <time.h>
+#include <FlowRollup.h>
+
+class UnderTestRollup : public FlowRollup {
+    public:
+    using FlowRollup::loaded;
+};
+
+
+static time_t rollupTime(int year, int month, int day, int hour, int minute)
+{
+    struct tm timeinfo = {};
+    timeinfo.tm_year = year - 1900;
+    timeinfo.tm_mon = month - 1;
+    timeinfo.tm_mday = day;
+    timeinfo.tm_hour = hour;
+    timeinfo.tm_min = minute;
+    timeinfo.tm_isdst = -1;
+    return mktime(&timeinfo);
+}
+
+
+/**
+ * @brief consumption and min/max rate of the current hour / day / month, the first reading has no change
+ */
+void test_RollupUpdate()
+{
+    UnderTestRollup rollup;
+    rollup.loaded = true;       // do not read ROLLUP_FILE of the SD card
+
+    rollup.Update("main", rollupTime(2023, 1, 10, 8, 0), 100.0, 0, false);
+    rollup.Update("main", rollupTime(2023, 1, 10, 8, 5), 100.5, 0.1, false);
+    rollup.Update("main", rollupTime(2023, 1, 10, 8, 10), 101.5, 0.2, false);
+
+    NumberRollup* number = rollup.Get("main");
+    TEST_ASSERT_NOT_NULL(number);
+    TEST_ASSERT_EQUAL_UINT32(2023011008, number->current[RollupHour].key);
+    TEST_ASSERT_EQUAL_UINT32(20230110, number->current[RollupDay].key);
+    TEST_ASSERT_EQUAL_UINT32(202301, number->current[RollupMonth].key);
+
+    for (int i = 0; i < RollupPeriods; ++i) {
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 1.5, number->current[i].consumption);
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 0.1, number->current[i].rateMin);
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 0.2, number->current[i].rateMax);
+        TEST_ASSERT_EQUAL_UINT32(3, number->current[i].readings);
+        TEST_ASSERT_EQUAL_UINT32(0, number->current[i].errors);
+        TEST_ASSERT_EQUAL_UINT32(0, number->previous[i].key);
+    }
+
+    TEST_ASSERT_NULL(rollup.Get("other"));
+}
+
+
+/**
+ * @brief a new hour / day / month moves the current period to previous, the change across the border
+ * counts for the new period
+ */
+void test_RollupPeriodChange()
+{
+    UnderTestRollup rollup;
+    rollup.loaded = true;
+
+    rollup.Update("main", rollupTime(2023, 1, 31, 23, 50), 100.0, 0, false);
+    rollup.Update("main", rollupTime(2023, 1, 31, 23, 55), 101.0, 0.2, false);
+    rollup.Update("main", rollupTime(2023, 2, 1, 0, 0), 103.0, 0.4, false);
+
+    NumberRollup* number = rollup.Get("main");
+    TEST_ASSERT_NOT_NULL(number);
+
+    TEST_ASSERT_EQUAL_UINT32(2023020100, number->current[RollupHour].key);
+    TEST_ASSERT_EQUAL_UINT32(20230201, number->current[RollupDay].key);
+    TEST_ASSERT_EQUAL_UINT32(202302, number->current[RollupMonth].key);
+    TEST_ASSERT_EQUAL_UINT32(2023013123, number->previous[RollupHour].key);
+    TEST_ASSERT_EQUAL_UINT32(20230131, number->previous[RollupDay].key);
+    TEST_ASSERT_EQUAL_UINT32(202301, number->previous[RollupMonth].key);
+
+    for (int i = 0; i < RollupPeriods; ++i) {
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 2.0, number->current[i].consumption);
+        TEST_ASSERT_EQUAL_UINT32(1, number->current[i].readings);
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 0.4, number->current[i].rateMin);
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 0.4, number->current[i].rateMax);
+
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 1.0, number->previous[i].consumption);
+        TEST_ASSERT_EQUAL_UINT32(2, number->previous[i].readings);
+    }
+
+    // a period without readings in between: previous is the last period with readings
+    rollup.Update("main", rollupTime(2023, 2, 1, 3, 0), 104.0, 0.1, false);
+    TEST_ASSERT_EQUAL_UINT32(2023020103, number->current[RollupHour].key);
+    TEST_ASSERT_EQUAL_UINT32(2023020100, number->previous[RollupHour].key);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 3.0, number->current[RollupDay].consumption);
+}
+
+
+/**
+ * @brief error readings are counted, but do not change the value: the next valid reading gets the whole change
+ */
+void test_RollupErrorReadings()
+{
+    UnderTestRollup rollup;
+    rollup.loaded = true;
+
+    rollup.Update("main", rollupTime(2023, 5, 3, 12, 0), 50.0, 0, false);
+    rollup.Update("main", rollupTime(2023, 5, 3, 12, 5), 999.0, 0, true);
+    rollup.Update("main", rollupTime(2023, 5, 3, 12, 10), 51.0, 0.1, false);
+
+    NumberRollup* number = rollup.Get("main");
+    TEST_ASSERT_NOT_NULL(number);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 51.0, number->lastValue);
+
+    for (int i = 0; i < RollupPeriods; ++i) {
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 1.0, number->current[i].consumption);
+        TEST_ASSERT_EQUAL_UINT32(3, number->current[i].readings);
+        TEST_ASSERT_EQUAL_UINT32(1, number->current[i].errors);
+        TEST_ASSERT_EQUAL_UINT32(1, number->current[i].rates);
+    }
+
+    // only errors: no value yet, so the first valid reading has no change
+    rollup.Update("second", rollupTime(2023, 5, 3, 12, 0), 10.0, 0, true);
+    rollup.Update("second", rollupTime(2023, 5, 3, 12, 5), 12.0, 0.4, false);
+
+    number = rollup.Get("second");
+    TEST_ASSERT_NOT_NULL(number);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, number->current[RollupHour].consumption);
+    TEST_ASSERT_EQUAL_UINT32(0, number->current[RollupHour].rates);
+    TEST_ASSERT_EQUAL_UINT32(1, number->current[RollupHour].errors);
+}
+
+
+/**
+ * @brief a PreValue set from outside must not count as consumption
+ */
+void test_RollupResetLastValue()
+{
+    UnderTestRollup rollup;
+    rollup.loaded = true;
+
+    rollup.Update("main", rollupTime(2023, 5, 3, 12, 0), 50.0, 0, false);
+    rollup.Update("main", rollupTime(2023, 5, 3, 12, 5), 50.5, 0.1, false);
+    rollup.ResetLastValue("main");
+    rollup.Update("main", rollupTime(2023, 5, 3, 12, 10), 1000.0, 0, false);
+    rollup.Update("main", rollupTime(2023, 5, 3, 12, 15), 1000.25, 0.05, false);
+
+    NumberRollup* number = rollup.Get("main");
+    TEST_ASSERT_NOT_NULL(number);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.75, number->current[RollupHour].consumption);
+    TEST_ASSERT_EQUAL_UINT32(4, number->current[RollupHour].readings);
+    TEST_ASSERT_EQUAL_UINT32(2, number->current[RollupHour].rates);
+
+    rollup.ResetLastValue("unknown");       // no number: nothing happens
+    TEST_ASSERT_NULL(rollup.Get("unknown"));
+}
+
+
+/**
+ * @brief negative changes (AllowNegativeRates) reduce the consumption, the rate min is negative then
+ */
+void test_RollupNegativeChange()
+{
+    UnderTestRollup rollup;
+    rollup.loaded = true;
+
+    rollup.Update("main", rollupTime(2023, 5, 3, 12, 0), 20.0, 0, false);
+    rollup.Update("main", rollupTime(2023, 5, 3, 12, 5), 22.0, 0.4, false);
+    rollup.Update("main", rollupTime(2023, 5, 3, 12, 10), 21.5, -0.1, false);
+
+    NumberRollup* number = rollup.Get("main");
+    TEST_ASSERT_NOT_NULL(number);
+
+    for (int i = 0; i < RollupPeriods; ++i) {
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 1.5, number->current[i].consumption);
+        TEST_ASSERT_FLOAT_WITHIN(0.001, -0.1, number->current[i].rateMin);
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 0.4, number->current[i].rateMax);
+    }
+}
@@ -0,0 +1,96 @@
+#include <unity.h>
+#include <CRotateImage.h>
+
+
+static void applyTransform(AffineTransform _t, float _x, float _y, float &_x_source, float &_y_source)
+{
+    _x_source = _t.m[0][0] * _x + _t.m[0][1] * _y + _t.m[0][2];
+    _y_source = _t.m[1][0] * _x + _t.m[1][1] * _y + _t.m[1][2];
+}
+
+
+static void assertIdentity(AffineTransform _t)
+{
+    TEST_ASSERT_FLOAT_WITHIN(1e-5, 1, _t.m[0][0]);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5, 0, _t.m[0][1]);
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 0, _t.m[0][2]);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5, 0, _t.m[1][0]);
+    TEST_ASSERT_FLOAT_WITHIN(1e-5, 1, _t.m[1][1]);
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, 0, _t.m[1][2]);
+}
+
+
+/**
+ * @brief the composed transform maps a point like the two transforms one after the other
+ */
+void test_AffineTransformCompose()
+{
+    AffineTransform rotate = CRotateImage::RotateTransform(12.5, 320, 240);
+    AffineTransform crop = CRotateImage::CropTransform(100, 50, 1.5, 2);
+    AffineTransform translate = CRotateImage::TranslateTransform(-7, 11);
+    AffineTransform mirror = CRotateImage::MirrorTransform(640);
+
+    AffineTransform composed = rotate.Compose(translate).Compose(crop);
+    AffineTransform composedMirror = mirror.Compose(rotate);
+
+    float points[][2] = {{0, 0}, {19, 31}, {639, 479}, {-5.5, 200.25}};
+
+    for (int i = 0; i < sizeof(points) / sizeof(points[0]); ++i)
+    {
+        float x1, y1, x2, y2, x3, y3, x, y;
+
+        applyTransform(crop, points[i][0], points[i][1], x1, y1);
+        applyTransform(translate, x1, y1, x2, y2);
+        applyTransform(rotate, x2, y2, x3, y3);
+        applyTransform(composed, points[i][0], points[i][1], x, y);
+        TEST_ASSERT_FLOAT_WITHIN(1e-3, x3, x);
+        TEST_ASSERT_FLOAT_WITHIN(1e-3, y3, y);
+
+        applyTransform(rotate, points[i][0], points[i][1], x1, y1);
+        applyTransform(mirror, x1, y1, x2, y2);
+        applyTransform(composedMirror, points[i][0], points[i][1], x, y);
+        TEST_ASSERT_FLOAT_WITHIN(1e-3, x2, x);
+        TEST_ASSERT_FLOAT_WITHIN(1e-3, y2, y);
+    }
+
+    // identity is the neutral element
+    AffineTransform identity;
+    TEST_ASSERT_TRUE(identity.isIdentity());
+    AffineTransform left = identity.Compose(crop);
+    AffineTransform right = crop.Compose(identity);
+    TEST_ASSERT_EQUAL_MEMORY(crop.m, left.m, sizeof(crop.m));
+    TEST_ASSERT_EQUAL_MEMORY(crop.m, right.m, sizeof(crop.m));
+}
+
+
+/**
+ * @brief a transform composed with its inverse gives the identity, in both orders
+ */
+void test_AffineTransformInverse()
+{
+    // exact in float
+    AffineTransform translate = CRotateImage::TranslateTransform(13, -4);
+    AffineTransform translateBack = CRotateImage::TranslateTransform(-13, 4);
+    TEST_ASSERT_TRUE(translate.Compose(translateBack).isIdentity());
+    TEST_ASSERT_TRUE(translateBack.Compose(translate).isIdentity());
+
+    AffineTransform mirror = CRotateImage::MirrorTransform(640);
+    TEST_ASSERT_TRUE(mirror.Compose(mirror).isIdentity());
+    TEST_ASSERT_FALSE(mirror.isIdentity());
+
+    // rotation around the same center, rounding errors of sin / cos
+    float angles[] = {0.3, -2.7, 45, 90, 179.9};
+    for (int i = 0; i < sizeof(angles) / sizeof(angles[0]); ++i)
+    {
+        AffineTransform rotate = CRotateImage::RotateTransform(angles[i], 320, 240);
+        AffineTransform rotateBack = CRotateImage::RotateTransform(-angles[i], 320, 240);
+        assertIdentity(rotate.Compose(rotateBack));
+        assertIdentity(rotateBack.Compose(rotate));
+    }
+
+    // the alignment (rotation + shift) undone step by step
+    AffineTransform alignment = CRotateImage::RotateTransform(1.8, 320, 240).Compose(CRotateImage::TranslateTransform(5, -3));
+    AffineTransform alignmentBack = CRotateImage::TranslateTransform(-5, 3).Compose(CRotateImage::RotateTransform(-1.8, 320, 240));
+    assertIdentity(alignment.Compose(alignmentBack));
+    assertIdentity(alignmentBack.Compose(alignment));
+}
@@ -0,0 +1,104 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <string.h>
+#include <CFindTemplate.h>
+
+
+/* Synthetic image: gradient background with rectangles of random size and color (fixed seed) */
+static uint8_t* createTemplateTestImage(int _width, int _height, int _channels)
+{
+    uint8_t* image = (uint8_t*) malloc(_width * _height * _channels);
+    uint32_t seed = 12345;
+
+    for (int y = 0; y < _height; ++y)
+        for (int x = 0; x < _width; ++x)
+            for (int ch = 0; ch < _channels; ++ch)
+                image[(y * _width + x) * _channels + ch] = (x + 2 * y + 40 * ch) % 256;
+
+    for (int i = 0; i < 40; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        int x0 = (seed >> 8) % _width;
+        seed = seed * 1103515245 + 12345;
+        int y0 = (seed >> 8) % _height;
+        seed = seed * 1103515245 + 12345;
+        int dx = 6 + (seed >> 8) % 40;
+        seed = seed * 1103515245 + 12345;
+        int dy = 6 + (seed >> 8) % 40;
+        seed = seed * 1103515245 + 12345;
+        uint32_t color = seed >> 8;
+
+        for (int y = y0; (y < y0 + dy) && (y < _height); ++y)
+            for (int x = x0; (x < x0 + dx) && (x < _width); ++x)
+                for (int ch = 0; ch < _channels; ++ch)
+                    image[(y * _width + x) * _channels + ch] = (color >> (8 * ch)) & 0xFF;
+    }
+
+    return image;
+}
+
+
+static uint8_t* cutTemplate(uint8_t* _image, int _width, int _channels, int _x, int _y, int _tpl_width, int _tpl_height)
+{
+    uint8_t* tpl = (uint8_t*) malloc(_tpl_width * _tpl_height * _channels);
+
+    for (int y = 0; y < _tpl_height; ++y)
+        memcpy(tpl + y * _tpl_width * _channels, _image + ((_y + y) * _width + _x) * _channels, _tpl_width * _channels);
+
+    return tpl;
+}
+
+
+/**
+ * @brief the coarse to fine search finds a template cut out of the image at a known offset,
+ * with all channels and with the red channel only (alignment algo "Default"), like the full resolution search
+ */
+void test_FindTemplatePyramid()
+{
+    const int width = 240, height = 180, channels = 3;
+    const int tpl_size = 64;
+    uint8_t* image = createTemplateTestImage(width, height, channels);
+
+    CFindTemplate finder(image, channels, width, height, channels);        // external image, stays ours
+    finder.tpl_width = tpl_size;
+    finder.tpl_height = tpl_size;
+
+    int offsets[][2] = {{137, 71}, {0, 0}, {width - tpl_size, height - tpl_size}, {53, 102}};
+
+    for (int i = 0; i < sizeof(offsets) / sizeof(offsets[0]); ++i)
+    {
+        int x = offsets[i][0], y = offsets[i][1];
+        uint8_t* tpl = cutTemplate(image, width, channels, x, y, tpl_size, tpl_size);
+
+        int anzchannels_list[] = {channels, 1};
+        for (int anzchannels : anzchannels_list)
+        {
+            printf("Offset %d, %d, %d channel(s)\n", x, y, anzchannels);
+
+            int found_x = -1, found_y = -1;
+            TEST_ASSERT_TRUE(finder.SearchPyramid(tpl, FIND_TEMPLATE_MAX_PYRAMID_LEVEL, 0, width - tpl_size, 0, height - tpl_size, anzchannels, found_x, found_y));
+            TEST_ASSERT_EQUAL(x, found_x);
+            TEST_ASSERT_EQUAL(y, found_y);
+
+            // restricted search window, the template is not at its origin
+            found_x = -1;
+            found_y = -1;
+            int x_start = std::max(x - 40, 0), y_start = std::max(y - 30, 0);
+            int x_stop = std::min(x + 40, width - tpl_size), y_stop = std::min(y + 30, height - tpl_size);
+            TEST_ASSERT_TRUE(finder.SearchPyramid(tpl, 2, x_start, x_stop, y_start, y_stop, anzchannels, found_x, found_y));
+            TEST_ASSERT_EQUAL(x, found_x);
+            TEST_ASSERT_EQUAL(y, found_y);
+
+            uint64_t minSSD = UINT64_MAX;
+            int full_x = -1, full_y = -1;
+            finder.SearchFullResolution(tpl, 0, width - tpl_size, 0, height - tpl_size, anzchannels, minSSD, full_x, full_y);
+            TEST_ASSERT_EQUAL(found_x, full_x);
+            TEST_ASSERT_EQUAL(found_y, full_y);
+            TEST_ASSERT_TRUE(minSSD == 0);
+        }
+
+        free(tpl);
+    }
+
+    free(image);
+}
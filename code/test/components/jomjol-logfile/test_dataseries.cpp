@@ -0,0 +1,118 @@
+#include <unity.h>
+#include <time.h>
+#include <vector>
+#include <ClassDataSeries.h>
+#include <Helper.h>
+#include "../../../include/defines.h"
+
+#define TEST_DATASERIES_ROOT "/sdcard/test_series"
+
+
+static time_t seriesTime(int year, int month, int day, int hour, int minute)
+{
+    struct tm timeinfo = {};
+    timeinfo.tm_year = year - 1900;
+    timeinfo.tm_mon = month - 1;
+    timeinfo.tm_mday = day;
+    timeinfo.tm_hour = hour;
+    timeinfo.tm_min = minute;
+    timeinfo.tm_isdst = -1;
+    return mktime(&timeinfo);
+}
+
+
+/**
+ * @brief records of two numbers over midnight (two day files), queried by time range,
+ * with a reduced number of points and with invalid arguments
+ */
+void test_DataSeriesQuery()
+{
+    removeFolder(TEST_DATASERIES_ROOT, "TEST");     // records of a previous run
+    MakeDir(TEST_DATASERIES_ROOT);
+    ClassDataSeries series(TEST_DATASERIES_ROOT, DATASERIES_FILE);
+
+    // 22:00 ... 02:00 every 10 minutes, written per round like the flow does
+    time_t start = seriesTime(2023, 3, 10, 22, 0);
+    time_t end = seriesTime(2023, 3, 11, 2, 0);
+    int anz = 0;
+    for (time_t t = start; t <= end; t += 600, ++anz) {
+        series.Add(t, "main", 100 + anz, std::to_string(100 + anz), 0.1, false);
+        series.Add(t, "second", 500 - anz, std::to_string(500 - anz), -0.1, false);
+        series.Flush();
+    }
+    TEST_ASSERT_EQUAL(25, anz);
+
+    std::vector<DataSeriesRecord> records;
+    auto collect = [&records](const DataSeriesRecord& _record) { records.push_back(_record); };
+
+    // whole range: all records of the number in time order
+    TEST_ASSERT_TRUE(series.Query("main", start, end, 0, collect));
+    TEST_ASSERT_EQUAL(25, records.size());
+    for (int i = 0; i < records.size(); ++i) {
+        TEST_ASSERT_EQUAL_UINT32(start + i * 600, records[i].timestamp);
+        TEST_ASSERT_EQUAL(records[0].number, records[i].number);
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 100 + i, records[i].value);
+        TEST_ASSERT_FLOAT_WITHIN(0.001, 100 + i, records[i].raw);
+        TEST_ASSERT_EQUAL(0, records[i].flags);
+    }
+
+    records.clear();
+    TEST_ASSERT_TRUE(series.Query("second", start, end, 0, collect));
+    TEST_ASSERT_EQUAL(25, records.size());
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 476, records[24].value);
+
+    // part of the range across midnight, the borders are between the records
+    records.clear();
+    TEST_ASSERT_TRUE(series.Query("main", seriesTime(2023, 3, 10, 23, 5), seriesTime(2023, 3, 11, 0, 35), 0, collect));
+    TEST_ASSERT_EQUAL(9, records.size());
+    TEST_ASSERT_EQUAL_UINT32(seriesTime(2023, 3, 10, 23, 10), records[0].timestamp);
+    TEST_ASSERT_EQUAL_UINT32(seriesTime(2023, 3, 11, 0, 30), records[8].timestamp);
+
+    // a border exactly on a record: both are inclusive
+    records.clear();
+    TEST_ASSERT_TRUE(series.Query("main", seriesTime(2023, 3, 11, 0, 0), seriesTime(2023, 3, 11, 0, 20), 0, collect));
+    TEST_ASSERT_EQUAL(3, records.size());
+
+    // 4 points: the last record of each hour
+    records.clear();
+    TEST_ASSERT_TRUE(series.Query("main", start, end, 4, collect));
+    TEST_ASSERT_EQUAL(4, records.size());
+    TEST_ASSERT_EQUAL_UINT32(seriesTime(2023, 3, 10, 23, 0), records[0].timestamp);
+    TEST_ASSERT_EQUAL_UINT32(seriesTime(2023, 3, 11, 0, 0), records[1].timestamp);
+    TEST_ASSERT_EQUAL_UINT32(seriesTime(2023, 3, 11, 1, 0), records[2].timestamp);
+    TEST_ASSERT_EQUAL_UINT32(end, records[3].timestamp);
+
+    // no records in the range
+    records.clear();
+    TEST_ASSERT_TRUE(series.Query("main", seriesTime(2023, 3, 12, 0, 0), seriesTime(2023, 3, 13, 0, 0), 0, collect));
+    TEST_ASSERT_EQUAL(0, records.size());
+
+    // unknown number, end before start
+    TEST_ASSERT_FALSE(series.Query("unknown", start, end, 0, collect));
+    TEST_ASSERT_FALSE(series.Query("main", end, start, 0, collect));
+    TEST_ASSERT_EQUAL(0, records.size());
+}
+
+
+/**
+ * @brief error and raw value flags, records older than the last one of the file (clock set back) are dropped
+ */
+void test_DataSeriesFlags()
+{
+    ClassDataSeries series(TEST_DATASERIES_ROOT, DATASERIES_FILE);     // records of test_DataSeriesQuery()
+    time_t t = seriesTime(2023, 3, 11, 2, 10);
+
+    series.Add(t, "main", 200, "20N", 0, true);
+    series.Flush();
+    series.Add(seriesTime(2023, 3, 11, 1, 55), "main", 300, "300", 0, false);
+    series.Flush();
+
+    std::vector<DataSeriesRecord> records;
+    TEST_ASSERT_TRUE(series.Query("main", seriesTime(2023, 3, 11, 1, 55), t, 0, [&records](const DataSeriesRecord& _record) { records.push_back(_record); }));
+    TEST_ASSERT_EQUAL(2, records.size());
+    TEST_ASSERT_EQUAL_UINT32(seriesTime(2023, 3, 11, 2, 0), records[0].timestamp);
+    TEST_ASSERT_EQUAL_UINT32(t, records[1].timestamp);
+    TEST_ASSERT_EQUAL(DATASERIES_FLAG_ERROR | DATASERIES_FLAG_RAW_INVALID, records[1].flags);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 200, records[1].value);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0, records[1].raw);
+}
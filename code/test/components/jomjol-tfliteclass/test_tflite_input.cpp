@@ -0,0 +1,70 @@
+#include <unity.h>
+#include <math.h>
+#include <algorithm>
+#include <CTfLiteClass.h>
+#include <CAlignAndCutImage.h>
+#include <CRotateImage.h>
+
+class UnderTestTfLite : public CTfLiteClass {
+    public:
+    using CTfLiteClass::interpreter;
+};
+
+
+/**
+ * @brief the input tensor sampled directly from the image (ROI transform) has to
+ * match the former path: cut the ROI, resize it with stbir and copy it into the tensor
+ */
+void test_LoadInputImageBasis()
+{
+    CAlignAndCutImage image("/sdcard/config/reference.jpg");
+    TEST_ASSERT_TRUE(image.ImageOkay());
+
+    UnderTestTfLite tflite;
+    TEST_ASSERT_TRUE(tflite.LoadModel("/sdcard/config/dig-class11_1600_s2.tflite"));
+    TEST_ASSERT_TRUE(tflite.MakeAllocate());
+    tflite.GetInputDimension(true);
+
+    int modelx = tflite.ReadInputDimenstion(0);
+    int modely = tflite.ReadInputDimenstion(1);
+    int channels = tflite.ReadInputDimenstion(2);
+    TEST_ASSERT_EQUAL(image.channels, channels);
+    TEST_ASSERT_EQUAL(kTfLiteFloat32, tflite.interpreter->input(0)->type);
+
+    // digits of the reference config, analog ROIs and a large ROI (~5x downscaling)
+    int rois[][4] = {{294, 126, 30, 54}, {343, 126, 30, 54}, {432, 230, 92, 92}, {379, 332, 92, 92}, {100, 100, 96, 160}};
+
+    for (int i = 0; i < sizeof(rois) / sizeof(rois[0]); ++i)
+    {
+        int x = rois[i][0], y = rois[i][1], dx = rois[i][2], dy = rois[i][3];
+        printf("ROI %d, %d, %d x %d\n", x, y, dx, dy);
+
+        CImageBasis cut(dx, dy, channels);
+        image.CutAndSave(x, y, dx, dy, &cut);
+        CImageBasis resized(modelx, modely, channels);
+        cut.Resize(modelx, modely, &resized);
+
+        TEST_ASSERT_TRUE(tflite.LoadInputImageBasis(&image, CRotateImage::CropTransform(x, y, (float) dx / modelx, (float) dy / modely)));
+
+        float* input = tflite.interpreter->input(0)->data.f;
+        float diff_sum = 0;
+        float diff_max = 0;
+        int index = 0;
+
+        for (int py = 0; py < modely; ++py)
+            for (int px = 0; px < modelx; ++px)
+                for (int ch = 0; ch < channels; ++ch)
+                {
+                    float diff = fabs(input[index++] - resized.GetPixelColor(px, py, ch));
+                    diff_sum += diff;
+                    diff_max = std::max(diff_max, diff);
+                }
+
+        float diff_mean = diff_sum / index;
+        printf("Mean difference %f, max. difference %f\n", diff_mean, diff_max);
+
+        // box filter vs. Mitchell filter of stbir, a point sampling differs up to 94 (mean 11.8) for the large ROI
+        TEST_ASSERT_FLOAT_WITHIN(4, 0, diff_mean);
+        TEST_ASSERT_FLOAT_WITHIN(32, 0, diff_max);
+    }
+}
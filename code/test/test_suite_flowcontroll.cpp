@@ -5,6 +5,12 @@
 #include "components/jomjol-flowcontroll/test_flow_pp_negative.cpp"
 #include "components/jomjol-flowcontroll/test_PointerEvalAnalogToDigitNew.cpp"
 #include "components/jomjol-flowcontroll/test_getReadoutRawString.cpp"
+#include "components/jomjol-flowcontroll/test_flow_rollup.cpp"
+#include "components/jomjol-flowcontroll/test_flow_metrics.cpp"
+#include "components/jomjol-image-proc/test_affine_transform.cpp"
+#include "components/jomjol-image-proc/test_find_template.cpp"
+#include "components/jomjol-logfile/test_dataseries.cpp"
+#include "components/jomjol-tfliteclass/test_tflite_input.cpp"
 // SD-Card ////////////////////
 #include "nvs_flash.h"
 #include "esp_vfs_fat.h"
@@ -121,6 +127,31 @@ extern "C" void app_main()
 
     // getReadoutRawString test
     RUN_TEST(test_getReadoutRawString);
+
+    // hourly / daily / monthly aggregates
+    RUN_TEST(test_RollupUpdate);
+    RUN_TEST(test_RollupPeriodChange);
+    RUN_TEST(test_RollupErrorReadings);
+    RUN_TEST(test_RollupResetLastValue);
+    RUN_TEST(test_RollupNegativeChange);
+
+    // flow step metrics
+    RUN_TEST(test_MetricsQuantile);
+    RUN_TEST(test_MetricsPrometheus);
+
+    // alignment transforms
+    RUN_TEST(test_AffineTransformCompose);
+    RUN_TEST(test_AffineTransformInverse);
+
+    // coarse to fine template search
+    RUN_TEST(test_FindTemplatePyramid);
+
+    // data series store (SD card)
+    RUN_TEST(test_DataSeriesQuery);
+    RUN_TEST(test_DataSeriesFlags);
+
+    // direct ROI sampling into the input tensor
+    RUN_TEST(test_LoadInputImageBasis);
   
   UNITY_END();
 }
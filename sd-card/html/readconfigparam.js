@@ -133,6 +133,7 @@ function ParseConfig() {
      ParamAddValue(param, catname, "SearchFieldY");     
      ParamAddValue(param, catname, "AlignmentAlgo");
      ParamAddValue(param, catname, "FlipImageSize");
+     ParamAddValue(param, catname, "ROIDirectSampling");
 
      var catname = "Digits";
      category[catname] = new Object(); 
@@ -141,6 +142,7 @@ function ParseConfig() {
      param[catname] = new Object();
      ParamAddValue(param, catname, "Model");
      ParamAddValue(param, catname, "CNNGoodThreshold", 1); 
+     ParamAddValue(param, catname, "TensorArenaMargin");
      ParamAddValue(param, catname, "LogImageLocation");
      ParamAddValue(param, catname, "LogfileRetentionInDays");
 
@@ -150,6 +152,7 @@ function ParseConfig() {
      category[catname]["found"] = false;
      param[catname] = new Object();
      ParamAddValue(param, catname, "Model");
+     ParamAddValue(param, catname, "TensorArenaMargin");
      ParamAddValue(param, catname, "LogImageLocation");
      ParamAddValue(param, catname, "LogfileRetentionInDays");
 
@@ -184,6 +187,9 @@ function ParseConfig() {
      ParamAddValue(param, catname, "SetRetainFlag");
      ParamAddValue(param, catname, "HomeassistantDiscovery");
      ParamAddValue(param, catname, "MeterType");
+     ParamAddValue(param, catname, "PublishMaxAge");
+     ParamAddValue(param, catname, "PublishJSONOnly");
+     ParamAddValue(param, catname, "PublishQueue");
 
      var catname = "InfluxDB";
      category[catname] = new Object(); 
@@ -233,6 +239,8 @@ function ParseConfig() {
      param[catname] = new Object();
      ParamAddValue(param, catname, "DataLogActive");
      ParamAddValue(param, catname, "DataLogRetentionInDays");     
+     ParamAddValue(param, catname, "DataLogSyncInterval");
+     ParamAddValue(param, catname, "DataSeriesRetentionInDays");
 
      var catname = "Debug";
      category[catname] = new Object(); 
@@ -320,6 +328,20 @@ function ParseConfig() {
           param["DataLogging"]["DataLogRetentionInDays"]["value1"] = "3";
      }
 
+     if (param["DataLogging"]["DataLogSyncInterval"]["enabled"] == false && param["DataLogging"]["DataLogSyncInterval"]["value1"] == "")
+     {
+          param["DataLogging"]["DataLogSyncInterval"]["found"] = true;
+          param["DataLogging"]["DataLogSyncInterval"]["enabled"] = true;
+          param["DataLogging"]["DataLogSyncInterval"]["value1"] = "1";
+     }
+
+     if (param["DataLogging"]["DataSeriesRetentionInDays"]["enabled"] == false && param["DataLogging"]["DataSeriesRetentionInDays"]["value1"] == "")
+     {
+          param["DataLogging"]["DataSeriesRetentionInDays"]["found"] = true;
+          param["DataLogging"]["DataSeriesRetentionInDays"]["enabled"] = true;
+          param["DataLogging"]["DataSeriesRetentionInDays"]["value1"] = "90";
+     }
+
 }
 
 function ParamAddValue(param, _cat, _param, _anzParam = 1, _isNUMBER = false, _checkRegExList = null){